@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Compares the system allocator against the size class allocator and
+# compile-time arena (-DVM_ARENA_ALLOCATOR) on wall time and peak RSS.
+# Peak RSS needs /usr/bin/time and prints "-" without it. Fails if the
+# two builds print different output.
+#
+# Usage: bench/allocator.sh [script.lang ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+build system || exit 1
+build arena -DVM_ARENA_ALLOCATOR || exit 1
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/alloc_heavy.lang bench/string_build.lang
+    bench/table_heavy.lang bench/stack_heavy.lang)
+fi
+
+# peakKB runs a binary on a script and prints its maximum resident set
+# size in kilobytes
+peakKB() {
+  if [ ! -x /usr/bin/time ]; then
+    echo "-"
+  elif [ "$(uname)" = "Darwin" ]; then
+    /usr/bin/time -l "$1" "$2" 2>&1 >/dev/null |
+      awk '/maximum resident set size/ { printf "%d\n", $1 / 1024 }'
+  else
+    /usr/bin/time -v "$1" "$2" 2>&1 >/dev/null |
+      awk -F': ' '/Maximum resident set size/ { print $2 }'
+  fi
+}
+
+printf "%-22s %10s %10s %8s %12s %12s\n" "script" "system s" "arena s" \
+  "speedup" "system KB" "arena KB"
+
+for SCRIPT in "${SCRIPTS[@]}"; do
+  if ! diff -q <("$BUILD_DIR/system" "$SCRIPT" 2>&1) \
+    <("$BUILD_DIR/arena" "$SCRIPT" 2>&1) >/dev/null; then
+    echo "$SCRIPT: output differs" >&2
+    exit 1
+  fi
+
+  SYSTEM=$(seconds "$BUILD_DIR/system" "$SCRIPT")
+  ARENA=$(seconds "$BUILD_DIR/arena" "$SCRIPT")
+  SYSTEM_KB=$(peakKB "$BUILD_DIR/system" "$SCRIPT")
+  ARENA_KB=$(peakKB "$BUILD_DIR/arena" "$SCRIPT")
+
+  awk -v name="$(basename "$SCRIPT")" -v s="$SYSTEM" -v a="$ARENA" \
+    -v sk="$SYSTEM_KB" -v ak="$ARENA_KB" 'BEGIN {
+      printf "%-22s %10.3f %10.3f %7.2fx %12s %12s\n", name, s, a, s / a, sk, ak
+    }'
+done
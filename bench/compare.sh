@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Runs the same scripts under two sets of vm flags, checks that their
+# output matches and reports dispatches and run time for both.
+#
+# Usage: bench/compare.sh "<base flags>" "<new flags>" [script.lang ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+read -r -a BASE <<<"$1"
+read -r -a NEW <<<"$2"
+shift 2
+
+build vm || exit 1
+build count -DVM_COUNT_INSTRUCTIONS || exit 1
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/*.lang)
+fi
+
+# dispatches prints the number of instructions run() dispatched
+dispatches() {
+  "$BUILD_DIR/count" "$@" 2>&1 >/dev/null | awk '/^instructions:/ { print $2 }'
+}
+
+echo "base: ${BASE[*]:-(none)}  new: ${NEW[*]:-(none)}"
+printf "%-22s %14s %14s %10s %10s %8s\n" "script" "base ops" "new ops" \
+  "base s" "new s" "speedup"
+
+for SCRIPT in "${SCRIPTS[@]}"; do
+  if ! diff -q <("$BUILD_DIR/vm" "${BASE[@]}" "$SCRIPT" 2>&1) \
+    <("$BUILD_DIR/vm" "${NEW[@]}" "$SCRIPT" 2>&1) >/dev/null; then
+    echo "$SCRIPT: output differs" >&2
+    exit 1
+  fi
+
+  BASE_OPS=$(dispatches "${BASE[@]}" "$SCRIPT")
+  NEW_OPS=$(dispatches "${NEW[@]}" "$SCRIPT")
+  BASE_TIME=$(seconds "$BUILD_DIR/vm" "${BASE[@]}" "$SCRIPT")
+  NEW_TIME=$(seconds "$BUILD_DIR/vm" "${NEW[@]}" "$SCRIPT")
+
+  awk -v name="$(basename "$SCRIPT")" -v bo="$BASE_OPS" -v no="$NEW_OPS" \
+    -v bt="$BASE_TIME" -v nt="$NEW_TIME" 'BEGIN {
+      printf "%-22s %14d %14d %10.3f %10.3f %7.2fx\n",
+        name, bo, no, bt, nt, bt / nt
+    }'
+done
@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# Compares the concurrent collector (--concurrent-gc) against the
+# stop-the-world ones on a heap of millions of objects: wall time, the
+# pause percentiles and the longest pause --gc-stats reports. Fails if
+# the collectors print different output. Pauses only shrink when the
+# collector thread gets a core of its own.
+#
+# Usage: bench/concurrent.sh [script.lang ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+build vm -DVM_CONCURRENT_GC -pthread || exit 1
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/big_heap.lang bench/nursery.lang)
+fi
+
+HEAPS=("--concurrent-gc" "--no-nursery" "")
+NAMES=("concurrent" "stw" "nursery")
+
+gcHeader collector
+
+for SCRIPT in "${SCRIPTS[@]}"; do
+  # The table debug output depends on when interned strings die, only
+  # the script's result is compared
+  EXPECTED=$("$BUILD_DIR/vm" "$SCRIPT" 2>&1 | tail -n 1)
+  for i in "${!HEAPS[@]}"; do
+    if [ "$("$BUILD_DIR/vm" ${HEAPS[$i]} "$SCRIPT" 2>&1 | tail -n 1)" != \
+      "$EXPECTED" ]; then
+      echo "$SCRIPT: output differs with ${NAMES[$i]}" >&2
+      exit 1
+    fi
+  done
+
+  for i in "${!HEAPS[@]}"; do
+    gcRow "$SCRIPT" "${HEAPS[$i]}" "${NAMES[$i]}"
+  done
+done
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Compares the computed-goto dispatch loop in run() against the portable
+# switch fallback on loop-heavy scripts and reports instructions per second.
+#
+# Usage: bench/dispatch.sh [script.lang ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+build goto || exit 1
+build switch -DVM_SWITCH_DISPATCH || exit 1
+build count -DVM_COUNT_INSTRUCTIONS || exit 1
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/loop_sum.lang bench/while_globals.lang bench/loop_branches.lang)
+fi
+
+printf "%-28s %14s %10s %10s %10s %10s %8s\n" "script" "instructions" \
+  "switch s" "goto s" "switch M/s" "goto M/s" "speedup"
+
+for SCRIPT in "${SCRIPTS[@]}"; do
+  COUNT=$("$BUILD_DIR/count" "$SCRIPT" 2>&1 >/dev/null |
+    awk '/^instructions:/ { print $2 }')
+  SWITCH=$(seconds "$BUILD_DIR/switch" "$SCRIPT")
+  GOTO=$(seconds "$BUILD_DIR/goto" "$SCRIPT")
+
+  awk -v name="$(basename "$SCRIPT")" -v n="$COUNT" -v s="$SWITCH" \
+    -v g="$GOTO" 'BEGIN {
+      printf "%-28s %14d %10.3f %10.3f %10.1f %10.1f %7.2fx\n",
+        name, n, s, g, n / s / 1e6, n / g / 1e6, s / g
+    }'
+done
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Builds bench/flood_bench.c and replays its colliding key sets against
+# Table and vm.strings, then once more with the probe limits out of
+# reach, to show what the reseeding fallback saves. Exits with 1 if the
+# colliding keys are much slower than random ones with the limits in
+# place.
+#
+# Usage: bench/flood.sh
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+$CC $CFLAGS $LIBRARY_FILES bench/flood_bench.c -o "$BUILD_DIR/flood" || exit 1
+$CC $CFLAGS -DTABLE_PROBE_LIMIT=2147483647 -DINTERN_PROBE_LIMIT=2147483647 \
+  $LIBRARY_FILES bench/flood_bench.c -o "$BUILD_DIR/flood_unlimited" || exit 1
+
+echo "== without reseeding"
+"$BUILD_DIR/flood_unlimited"
+echo
+echo "== with reseeding"
+"$BUILD_DIR/flood"
@@ -0,0 +1,241 @@
+// Replays key sets built to collide against Table and checks that they
+// cost no more than random keys do. Each set is interned the way
+// copyString interns a script's strings, set in a table of its own and
+// looked up again:
+//
+//   random  keys0, keys1...
+//   fnv1a   keys whose FNV-1a hashes agree in their low 14 bits, what
+//           hash & (capacity - 1) placed in one slot before hashes were
+//           seeded
+//   leaked  keys built with this VM's seed in hand to start their probes
+//           in one group of a table with the seed every table starts
+//           with, the worst a leaked seed allows
+//   sharded the same for vm.strings: SHARDED_COUNT of the keys land in
+//           one shard and start their probes at one slot of it
+//
+// Every set is timed RUNS times, interning into an empty vm.strings each
+// time, and keeps its best times. It exits with 1 if any set's slowest
+// batch of inserts or its lookups take more than FLOOD_BOUND times those
+// of the random keys. bench/flood.sh builds it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../intern/intern.h"
+#include "../memory/memory.h"
+#include "../object/object.h"
+#include "../table/table.h"
+#include "../virtual_machine/vm.h"
+
+#define KEY_COUNT 8192
+#define BATCH 512
+#define LOOKUP_ROUNDS 16
+#define RUNS 5
+#define FLOOD_BOUND 4.0
+// Finding keys that collide in a shard takes 2^17 candidates each
+#define SHARDED_COUNT 1024
+#define SHARD_CAPACITY 4096
+
+// A filter decides whether a candidate becomes the key at index
+typedef bool (*KeyFilter)(const char *chars, int length, int index);
+
+typedef struct {
+  double internWorst; // ns per key of the slowest batch through copyString
+  double setWorst;    // ns per key of the slowest batch through tableSet
+  double get;         // ns per tableGet
+  int longestProbe;   // Slots in vm.strings or groups in the table
+  int reseeds;        // Of vm.strings and the table together
+} FloodResult;
+
+static char chars[KEY_COUNT][32];
+static int lengths[KEY_COUNT];
+static ObjString *keys[KEY_COUNT];
+static volatile long sink;
+
+static double seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static bool anyKey(const char *chars, int length, int index) {
+  (void)chars;
+  (void)length;
+  (void)index;
+  return true;
+}
+
+static bool fnv1aCollides(const char *chars, int length, int index) {
+  (void)index;
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++) {
+    hash ^= (uint8_t)chars[i];
+    hash *= 16777619;
+  }
+  return (hash & 0x3fff) == 0;
+}
+
+// leakedCollides takes the keys that start their probe in group 0 of an
+// unseeded table of KEY_COUNT * 2 entries, and so of every smaller one
+static bool leakedCollides(const char *chars, int length, int index) {
+  (void)index;
+  Table unseeded;
+  initTable(&unseeded);
+  uint32_t hash = TABLE_HASH(&unseeded, hashString(chars, length));
+  return ((hash >> 7) & (KEY_COUNT * 2 / 16 - 1)) == 0;
+}
+
+// shardCollides takes SHARDED_COUNT keys that go to the first shard of
+// vm.strings and start their probe at its first slot while it holds up
+// to SHARD_CAPACITY slots, then any key
+static bool shardCollides(const char *chars, int length, int index) {
+  if (index >= SHARDED_COUNT)
+    return true;
+
+  InternSlots unseeded = {.seed = 0};
+  uint32_t hash = hashString(chars, length);
+  return INTERN_SHARD(hash) == 0 &&
+         (INTERN_HASH(&unseeded, hash) & (SHARD_CAPACITY - 1)) == 0;
+}
+
+// makeKeys fills chars with the first KEY_COUNT keys of a prefix and a
+// count that filter lets through
+static void makeKeys(const char *prefix, KeyFilter filter) {
+  // The count is kept as decimal digits and incremented in place, the
+  // collisions take hundreds of millions of candidates to find
+  char candidate[32];
+  int prefixLength = (int)strlen(prefix);
+  int digits = 1;
+  memcpy(candidate, prefix, prefixLength);
+  candidate[prefixLength] = '0';
+
+  for (int i = 0; i < KEY_COUNT;) {
+    int length = prefixLength + digits;
+    if (filter(candidate, length, i)) {
+      memcpy(chars[i], candidate, length);
+      lengths[i++] = length;
+    }
+
+    int digit = length - 1;
+    while (digit >= prefixLength && candidate[digit] == '9')
+      candidate[digit--] = '0';
+    if (digit >= prefixLength) {
+      candidate[digit]++;
+    } else {
+      candidate[prefixLength] = '1';
+      candidate[length] = '0';
+      digits++;
+    }
+  }
+}
+
+// timeBatches runs insert over the keys BATCH at a time and returns the
+// ns per key of the slowest batch
+static double timeBatches(void (*insert)(Table *, int), Table *table) {
+  double worst = 0;
+  for (int batch = 0; batch < KEY_COUNT; batch += BATCH) {
+    double start = seconds();
+    for (int i = batch; i < batch + BATCH; i++)
+      insert(table, i);
+    double taken = (seconds() - start) * 1e9 / BATCH;
+    if (taken > worst)
+      worst = taken;
+  }
+  return worst;
+}
+
+static void intern(Table *table, int i) {
+  (void)table;
+  keys[i] = copyString(chars[i], lengths[i]);
+}
+
+static void set(Table *table, int i) {
+  tableSet(table, keys[i], NUMBER_VAL(i));
+}
+
+// run interns the keys into an empty vm.strings, sets them in a table
+// and looks them up
+static void run(FloodResult *result) {
+  freeInternTable(&vm.strings);
+  result->internWorst = timeBatches(intern, NULL);
+
+  Table table;
+  initTable(&table);
+  result->setWorst = timeBatches(set, &table);
+
+  long found = 0;
+  Value value;
+  double start = seconds();
+  for (int round = 0; round < LOOKUP_ROUNDS; round++)
+    for (int i = 0; i < KEY_COUNT; i++)
+      found += tableGet(&table, keys[i], &value);
+  result->get = (seconds() - start) * 1e9 / ((long)LOOKUP_ROUNDS * KEY_COUNT);
+  sink = found;
+
+  TableStats strings, stats;
+  internStats(&vm.strings, &strings);
+  tableStats(&table, &stats);
+  result->longestProbe = strings.longestProbe > stats.longestProbe
+                             ? strings.longestProbe
+                             : stats.longestProbe;
+  result->reseeds = strings.reseeds + stats.reseeds;
+  freeTable(&table);
+}
+
+// flood makes a set of keys and keeps the best times of RUNS runs
+static void flood(const char *prefix, KeyFilter filter, FloodResult *best) {
+  makeKeys(prefix, filter);
+  for (int i = 0; i < RUNS; i++) {
+    FloodResult result;
+    run(&result);
+    if (i == 0 || result.internWorst < best->internWorst)
+      best->internWorst = result.internWorst;
+    if (i == 0 || result.setWorst < best->setWorst)
+      best->setWorst = result.setWorst;
+    if (i == 0 || result.get < best->get)
+      best->get = result.get;
+    best->longestProbe = result.longestProbe;
+    best->reseeds = result.reseeds;
+  }
+}
+
+// report prints a key set's row, and whether it stayed within
+// FLOOD_BOUND of the random keys
+static bool report(const char *name, FloodResult *result,
+                   FloodResult *random) {
+  bool bounded = result->internWorst <= random->internWorst * FLOOD_BOUND &&
+                 result->setWorst <= random->setWorst * FLOOD_BOUND &&
+                 result->get <= random->get * FLOOD_BOUND;
+  printf("%-8s %14.1f %14.1f %10.1f %10d %10d   %s\n", name,
+         result->internWorst, result->setWorst, result->get,
+         result->longestProbe, result->reseeds,
+         bounded ? "ok" : "too slow");
+  return bounded;
+}
+
+int main() {
+  initVM();
+  // The keys live outside the VM's roots, keep the collector away
+  nurseryEnabled = false;
+  vm.nextGC = SIZE_MAX;
+
+  FloodResult random, fnv1a, leaked, sharded;
+  flood("keys", anyKey, &random);
+  flood("fnv", fnv1aCollides, &fnv1a);
+  flood("leak", leakedCollides, &leaked);
+  flood("shard", shardCollides, &sharded);
+
+  printf("%d keys, slowest batch of %d and lookups in ns per key, best of "
+         "%d\n",
+         KEY_COUNT, BATCH, RUNS);
+  printf("%-8s %14s %14s %10s %10s %10s\n", "keys", "intern worst",
+         "set worst", "get", "longest", "reseeds");
+  report("random", &random, &random);
+  bool bounded = report("fnv1a", &fnv1a, &random);
+  bounded = report("leaked", &leaked, &random) && bounded;
+  bounded = report("sharded", &sharded, &random) && bounded;
+  return bounded ? 0 : 1;
+}
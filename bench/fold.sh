@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# Compares compiling with constant folding against leaving every
+# operator to run() (--no-folding), reporting dispatches and run time.
+# Both instruction formats are checked, register mode fuses the loads
+# folding leaves into its operators.
+#
+# Usage: bench/fold.sh [script.lang ...]
+
+cd "$(dirname "$0")"
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/constants.lang bench/fold_check.lang bench/table_heavy.lang)
+fi
+
+./compare.sh "--no-folding" "" "${SCRIPTS[@]}" || exit 1
+exec ./compare.sh "--register --no-folding" "--register" "${SCRIPTS[@]}"
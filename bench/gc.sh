@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Runs a script under a range of heap growth factors (--gc-growth) and
+# reports the wall time next to the collector's counters: full and
+# nursery collections, total and longest pause, and the peak heap.
+#
+# Usage: bench/gc.sh [script.lang] [growth ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+build vm || exit 1
+
+SCRIPT=${1:-bench/alloc_heavy.lang}
+shift
+GROWTHS=("$@")
+if [ ${#GROWTHS[@]} -eq 0 ]; then
+  GROWTHS=(1.25 1.5 2 4 8)
+fi
+
+printf "%-8s %10s %8s %8s %10s %12s %12s\n" "growth" "seconds" "full" \
+  "nursery" "pause ms" "max pause ms" "peak bytes"
+
+for GROWTH in "${GROWTHS[@]}"; do
+  SECONDS_TAKEN=$(seconds "$BUILD_DIR/vm" --gc-growth "$GROWTH" "$SCRIPT")
+  "$BUILD_DIR/vm" --gc-growth "$GROWTH" --gc-stats "$SCRIPT" 2>&1 >/dev/null |
+    awk -v growth="$GROWTH" -v s="$SECONDS_TAKEN" '
+      /collections/ { full = $2; nursery = $5 }
+      /paused/ { pause = $2; longest = $5; peak = $9 }
+      END {
+        printf "%-8s %10.3f %8s %8s %10s %12s %12s\n", growth, s, full,
+          nursery, pause, longest, peak
+      }'
+done
@@ -0,0 +1,13 @@
+#!/bin/bash
+
+# Builds bench/hash_bench.c and prints hashString's throughput and key
+# spread next to the FNV-1a it replaced.
+#
+# Usage: bench/hash.sh
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+$CC $CFLAGS $LIBRARY_FILES bench/hash_bench.c -o "$BUILD_DIR/hash" || exit 1
+"$BUILD_DIR/hash"
@@ -0,0 +1,93 @@
+// Compares hashString against the byte-at-a-time FNV-1a it replaced:
+// throughput from identifiers to multi-megabyte strings, and how evenly
+// sequential keys spread over power of two tables, through the low bits
+// of the hash and through the high ones. bench/hash.sh builds it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../object/object.h"
+
+#define KEY_COUNT (1 << 16)
+
+static volatile uint32_t sink;
+
+static uint32_t fnv1a(const char *key, int length) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++) {
+    hash ^= (uint8_t)key[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+static double seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// throughput hashes a string of length bytes until about 256 MB went
+// through, and prints the GB/s
+static double throughput(uint32_t (*hash)(const char *, int), char *chars,
+                         int length) {
+  long rounds = (256L << 20) / length;
+  uint32_t result = 0;
+  double start = seconds();
+  for (long i = 0; i < rounds; i++) {
+    chars[0] = (char)i;
+    result ^= hash(chars, length);
+  }
+  sink = result;
+  return (double)rounds * length / (seconds() - start) / 1e9;
+}
+
+// spread puts KEY_COUNT sequential keys in 2^bits buckets by the low or
+// the high bits of their hash, and prints the fullest bucket against the
+// KEY_COUNT / 2^bits an even spread gives
+static double spread(uint32_t (*hash)(const char *, int), int bits,
+                     bool high) {
+  int buckets = 1 << bits;
+  int *counts = calloc(buckets, sizeof(int));
+  char chars[32];
+  for (int i = 0; i < KEY_COUNT; i++) {
+    int length = snprintf(chars, sizeof(chars), "key%d", i);
+    uint32_t value = hash(chars, length);
+    counts[high ? value >> (32 - bits) : value & (buckets - 1)]++;
+  }
+
+  int fullest = 0;
+  for (int i = 0; i < buckets; i++)
+    if (counts[i] > fullest)
+      fullest = counts[i];
+  free(counts);
+  return fullest / ((double)KEY_COUNT / buckets);
+}
+
+int main() {
+  static const int lengths[] = {4, 8, 16, 32, 64, 256, 4096, 1 << 20,
+                                16 << 20};
+  char *chars = malloc(16 << 20);
+  for (int i = 0; i < 16 << 20; i++)
+    chars[i] = 'a' + i % 26;
+
+  printf("%-10s %12s %12s\n", "length", "fnv1a GB/s", "hash GB/s");
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    printf("%-10d %12.2f %12.2f\n", lengths[i],
+           throughput(fnv1a, chars, lengths[i]),
+           throughput(hashString, chars, lengths[i]));
+
+  printf("\nfullest bucket over an even share, %d keys\n", KEY_COUNT);
+  printf("%-10s %12s %12s %12s %12s\n", "buckets", "fnv1a low",
+         "hash low", "fnv1a high", "hash high");
+  for (int bits = 8; bits <= 16; bits += 4)
+    printf("%-10d %12.2f %12.2f %12.2f %12.2f\n", 1 << bits,
+           spread(fnv1a, bits, false), spread(hashString, bits, false),
+           spread(fnv1a, bits, true), spread(hashString, bits, true));
+
+  free(chars);
+  return 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Reports how the intern table holds up on scripts that intern many
+# short-lived strings: wall time, and the size, tombstones and probe
+# lengths --mem-stats reports for vm.strings at exit, with and without
+# the nursery.
+#
+# Usage: bench/intern.sh [script.lang ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+build vm || exit 1
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/intern.lang bench/nursery.lang bench/table_heavy.lang)
+fi
+
+# report prints one row for a script run with the given heap flag
+report() {
+  local SECONDS_TAKEN
+  SECONDS_TAKEN=$(seconds "$BUILD_DIR/vm" $2 "$1")
+  "$BUILD_DIR/vm" $2 --mem-stats "$1" 2>&1 >/dev/null |
+    awk -v name="$(basename "$1")" -v heap="$3" -v s="$SECONDS_TAKEN" '
+      /intern slots/ { peak = $5 }
+      /intern table/ { strings = $5; tombstones = $8; capacity = $11
+                       average = $13; longest = $17 }
+      END {
+        printf "%-20s %-10s %8.3f %9s %10s %9s %12s %9s %9s\n", name, heap,
+          s, strings, tombstones, capacity, peak, average, longest
+      }'
+}
+
+printf "%-20s %-10s %8s %9s %10s %9s %12s %9s %9s\n" "script" "heap" \
+  "seconds" "strings" "tombstones" "capacity" "peak bytes" "avg probe" \
+  "max probe"
+
+for SCRIPT in "${SCRIPTS[@]}"; do
+  report "$SCRIPT" "" "nursery"
+  report "$SCRIPT" "--no-nursery" "single"
+done
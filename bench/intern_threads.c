@@ -0,0 +1,191 @@
+// Interns strings on 1 to MAX_THREADS threads sharing vm.strings, the
+// way compiling or running scripts on several threads would. Most
+// operations look up a string interned before the threads started, the
+// rest intern new strings every thread interns too, racing for them.
+// Each run is timed twice: with the lock-free lookups and per-shard
+// locks, and with one lock around every operation, which is what
+// sharing a Table would take. Afterwards every thread must have got the
+// same object for each new string. bench/intern_threads.sh builds it.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../intern/intern.h"
+#include "../memory/memory.h"
+#include "../object/object.h"
+#include "../virtual_machine/vm.h"
+
+#define MAX_THREADS 8
+#define HOT_COUNT (1 << 16)
+#define NEW_COUNT (1 << 14)
+#define OPERATIONS (1 << 21)
+// One operation in NEW_EVERY interns a new string
+#define NEW_EVERY 16
+
+typedef struct {
+  int thread;
+  int threads;
+  bool oneLock;
+  int run;
+  long lookups;
+  long found; // Lookups that found their string
+  ObjString *interned[NEW_COUNT];
+} Worker;
+
+static char hotChars[HOT_COUNT][16];
+static int hotLengths[HOT_COUNT];
+static Worker workers[MAX_THREADS];
+static pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+
+static double seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// find and add go through tableLock when the run has one lock
+static ObjString *find(Worker *worker, const char *chars, int length,
+                       uint32_t hash) {
+  if (!worker->oneLock)
+    return internFind(&vm.strings, chars, length, hash);
+
+  pthread_mutex_lock(&tableLock);
+  ObjString *string = internFind(&vm.strings, chars, length, hash);
+  pthread_mutex_unlock(&tableLock);
+  return string;
+}
+
+static ObjString *add(Worker *worker, ObjString *string) {
+  if (!worker->oneLock)
+    return internAdd(&vm.strings, string);
+
+  pthread_mutex_lock(&tableLock);
+  ObjString *interned = internAdd(&vm.strings, string);
+  pthread_mutex_unlock(&tableLock);
+  return interned;
+}
+
+// internNew interns a string outside the collected heap, the threads
+// cannot allocate from it. The loser of a race frees its copy
+static ObjString *internNew(Worker *worker, const char *chars, int length) {
+  uint32_t hash = hashString(chars, length);
+  ObjString *interned = find(worker, chars, length, hash);
+  if (interned != NULL)
+    return interned;
+
+  ObjString *string = malloc(STRING_SIZE(length));
+  string->obj.type = OBJ_STRING;
+  string->length = length;
+  string->hash = hash;
+  string->hashed = true;
+  string->interned = true;
+  memcpy(string->chars, chars, length);
+  string->chars[length] = '\0';
+
+  interned = add(worker, string);
+  if (interned != string)
+    free(string);
+  return interned;
+}
+
+// work runs a thread's share of OPERATIONS. The threads go through the
+// new strings from different starting points
+static void *work(void *argument) {
+  Worker *worker = argument;
+  uint32_t random = 2463534242u + worker->thread;
+  int operations = OPERATIONS / worker->threads;
+  int next = worker->thread * NEW_COUNT / worker->threads;
+  char chars[32];
+  long lookups = 0, found = 0;
+
+  for (int i = 0; i < operations; i++) {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    if (i % NEW_EVERY == 0) {
+      int key = next++ % NEW_COUNT;
+      int length = snprintf(chars, sizeof(chars), "new%d_%d", worker->run,
+                            key);
+      worker->interned[key] = internNew(worker, chars, length);
+    } else {
+      int key = random % HOT_COUNT;
+      lookups++;
+      found += find(worker, hotChars[key], hotLengths[key],
+                    hashString(hotChars[key], hotLengths[key])) != NULL;
+    }
+  }
+  worker->lookups = lookups;
+  worker->found = found;
+  return NULL;
+}
+
+// run times OPERATIONS spread over threads and returns millions of
+// operations a second. It ends the process if a lookup missed or two
+// threads got different objects for one string
+static double run(int threads, bool oneLock, int runs) {
+  pthread_t ids[MAX_THREADS];
+  for (int i = 0; i < threads; i++) {
+    workers[i] = (Worker){.thread = i, .threads = threads,
+                          .oneLock = oneLock, .run = runs};
+    memset(workers[i].interned, 0, sizeof(workers[i].interned));
+  }
+
+  double start = seconds();
+  for (int i = 0; i < threads; i++)
+    pthread_create(&ids[i], NULL, work, &workers[i]);
+  for (int i = 0; i < threads; i++)
+    pthread_join(ids[i], NULL);
+  double taken = seconds() - start;
+
+  for (int key = 0; key < NEW_COUNT; key++) {
+    ObjString *first = NULL;
+    for (int i = 0; i < threads; i++) {
+      ObjString *interned = workers[i].interned[key];
+      if (interned == NULL)
+        continue;
+      if (first != NULL && interned != first) {
+        fprintf(stderr, "new%d_%d interned twice\n", runs, key);
+        exit(1);
+      }
+      first = interned;
+    }
+  }
+  for (int i = 0; i < threads; i++)
+    if (workers[i].found != workers[i].lookups) {
+      fprintf(stderr, "a lookup missed an interned string\n");
+      exit(1);
+    }
+  return OPERATIONS / taken / 1e6;
+}
+
+int main() {
+  initVM();
+  // The strings live outside the VM's roots, keep the collector away
+  nurseryEnabled = false;
+  vm.nextGC = SIZE_MAX;
+
+  for (int i = 0; i < HOT_COUNT; i++) {
+    hotLengths[i] = snprintf(hotChars[i], sizeof(hotChars[i]), "hot%d", i);
+    copyString(hotChars[i], hotLengths[i]);
+  }
+
+  printf("%d operations, one in %d interns a new string, Mops/s\n",
+         OPERATIONS, NEW_EVERY);
+  printf("%-8s %12s %12s %12s\n", "threads", "sharded", "one lock",
+         "speedup");
+  int runs = 0;
+  double single = 0;
+  for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+    double sharded = run(threads, false, runs++);
+    double locked = run(threads, true, runs++);
+    if (threads == 1)
+      single = sharded;
+    printf("%-8d %12.2f %12.2f %11.2fx\n", threads, sharded, locked,
+           sharded / single);
+  }
+  return 0;
+}
@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Builds bench/intern_threads.c and prints how interning scales with the
+# threads sharing vm.strings, next to one lock around the whole table.
+# The speedup is capped by the cores the machine has.
+#
+# Usage: bench/intern_threads.sh
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+$CC $CFLAGS -pthread $LIBRARY_FILES bench/intern_threads.c \
+  -o "$BUILD_DIR/intern_threads" || exit 1
+echo "$(getconf _NPROCESSORS_ONLN) cores"
+"$BUILD_DIR/intern_threads"
@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Differential test for the JIT. Runs every script under run() and under
+# --jit, fails if stdout, stderr or the exit code differ, and reports
+# whether the JIT compiled the script and the time of both engines.
+#
+# Usage: bench/jit.sh [script.lang ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+build vm || exit 1
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/*.lang test.lang)
+fi
+
+# engine prints the script's stdout, stderr and exit code under one
+# engine, the first argument names its capture files
+engine() {
+  local NAME=$1
+  shift
+  "$BUILD_DIR/vm" "$@" >"$BUILD_DIR/$NAME.out" 2>"$BUILD_DIR/$NAME.err"
+  echo "exit $?"
+  echo "--- stdout"
+  cat "$BUILD_DIR/$NAME.out"
+  echo "--- stderr"
+  cat "$BUILD_DIR/$NAME.err"
+}
+
+printf "%-22s %-12s %10s %10s %8s\n" "script" "jit" "run() s" "jit s" \
+  "speedup"
+
+FAILED=0
+for SCRIPT in "${SCRIPTS[@]}"; do
+  if ! diff -u --label run --label jit <(engine run "$SCRIPT") \
+    <(engine jit --jit "$SCRIPT"); then
+    echo "$SCRIPT: engines disagree" >&2
+    FAILED=1
+    continue
+  fi
+
+  if "$BUILD_DIR/vm" --jit-stats "$SCRIPT" 2>&1 >/dev/null |
+    grep -q "compiled,"; then
+    STATUS=compiled
+  else
+    STATUS=interpreted
+  fi
+
+  RUN_TIME=$(seconds "$BUILD_DIR/vm" "$SCRIPT")
+  JIT_TIME=$(seconds "$BUILD_DIR/vm" --jit "$SCRIPT")
+
+  awk -v name="$(basename "$SCRIPT")" -v status="$STATUS" -v rt="$RUN_TIME" \
+    -v jt="$JIT_TIME" 'BEGIN {
+      printf "%-22s %-12s %10.3f %10.3f %7.2fx\n", name, status, rt, jt, rt / jt
+    }'
+done
+
+exit $FAILED
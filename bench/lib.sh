@@ -0,0 +1,52 @@
+# Build and timing helpers shared by the bench scripts. Source it after
+# changing to the repository root. CC and CFLAGS change how the vm is
+# built, every binary goes to a BUILD_DIR removed on exit.
+
+CC=${CC:-clang}
+CFLAGS=${CFLAGS:-"-O2 -DNDEBUG"}
+BUILD_DIR=$(mktemp -d)
+trap 'rm -rf "$BUILD_DIR"' EXIT
+
+# Every source of the vm, and the same without main.c for the harnesses
+# in bench/ that bring a main() of their own
+C_FILES=$(find . -name "*.c" -not -path "./bench/*" \
+  -not -path "./node_modules/*")
+LIBRARY_FILES=$(find . -name "*.c" -not -path "./bench/*" \
+  -not -path "./node_modules/*" -not -name main.c)
+
+# build compiles the vm into $BUILD_DIR/<name>, any further arguments
+# are passed to the compiler
+build() {
+  local NAME=$1
+  shift
+  $CC $CFLAGS "$@" $C_FILES -o "$BUILD_DIR/$NAME"
+}
+
+# seconds runs a command with its output discarded and prints the
+# elapsed wall time
+seconds() {
+  local TIMEFORMAT=%R
+  { time "$@" >/dev/null 2>&1; } 2>&1
+}
+
+# gcRow prints one row for a script run by the vm with the given heap
+# flags: wall time, collections and the pause percentiles --gc-stats
+# reports. gcHeader prints the header above the rows
+gcRow() {
+  local SECONDS_TAKEN
+  SECONDS_TAKEN=$(seconds "$BUILD_DIR/vm" $2 "$1")
+  "$BUILD_DIR/vm" $2 --gc-stats "$1" 2>&1 >/dev/null |
+    awk -v name="$(basename "$1")" -v heap="$3" -v s="$SECONDS_TAKEN" '
+      /collections/ { collections = $2 + $5 }
+      /paused/ { longest = $5 }
+      /half the pauses/ { p50 = $6; p99 = $10 }
+      END {
+        printf "%-20s %-11s %8.3f %12s %10s %10s %10s\n", name, heap, s,
+          collections, "<" p50, "<" p99, longest * 1000
+      }'
+}
+
+gcHeader() {
+  printf "%-20s %-11s %8s %12s %10s %10s %10s\n" "script" "$1" "seconds" \
+    "collections" "p50 us" "p99 us" "max us"
+}
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Compares the generational heap against a single generation
+# (--no-nursery) on string-heavy scripts: wall time, collections, and the
+# pause percentiles --gc-stats reports. Fails if the two heaps print
+# different output.
+#
+# Usage: bench/nursery.sh [script.lang ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+build vm || exit 1
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/nursery.lang bench/alloc_heavy.lang bench/string_build.lang)
+fi
+
+gcHeader heap
+
+for SCRIPT in "${SCRIPTS[@]}"; do
+  if ! diff -q <("$BUILD_DIR/vm" "$SCRIPT" 2>&1) \
+    <("$BUILD_DIR/vm" --no-nursery "$SCRIPT" 2>&1) >/dev/null; then
+    echo "$SCRIPT: output differs" >&2
+    exit 1
+  fi
+
+  gcRow "$SCRIPT" "" "nursery"
+  gcRow "$SCRIPT" "--no-nursery" "single"
+done
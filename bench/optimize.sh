@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Compares running scripts as compiled (-O0) against running them after
+# the IR passes of -O2, reporting dispatches and run time. Run the vm with
+# --optimizer-stats for the time each pass takes.
+#
+# Usage: bench/optimize.sh [script.lang ...]
+
+cd "$(dirname "$0")"
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/stack_heavy.lang bench/constants.lang bench/nursery.lang
+    bench/alloc_heavy.lang bench/locals_arith.lang bench/table_heavy.lang)
+fi
+
+exec ./compare.sh "-O0" "-O2" "${SCRIPTS[@]}"
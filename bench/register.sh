@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Compares the stack instruction format against the register format
+# (--register) on the same scripts, reporting dispatches and run time.
+#
+# Usage: bench/register.sh [script.lang ...]
+
+cd "$(dirname "$0")"
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/locals_sum.lang bench/locals_arith.lang bench/loop_sum.lang)
+fi
+
+exec ./compare.sh "--no-superinstructions" \
+  "--register --no-superinstructions" "${SCRIPTS[@]}"
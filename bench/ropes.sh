@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# Builds strings of growing size one 16 character piece at a time, with
+# ropes and with flat copying concatenation (--no-ropes). Rope time grows
+# linearly with the size, flat time quadratically. Flat concatenation
+# also keeps every intermediate string, so it stops at FLAT_MAX_KB.
+#
+# Usage: bench/ropes.sh [kilobytes ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+FLAT_MAX_KB=${FLAT_MAX_KB:-128}
+
+build vm || exit 1
+
+SIZES=("$@")
+if [ ${#SIZES[@]} -eq 0 ]; then
+  SIZES=(16 32 64 128 256 512 1024)
+fi
+
+printf "%-10s %10s %10s\n" "size" "ropes s" "flat s"
+
+for KB in "${SIZES[@]}"; do
+  SCRIPT="$BUILD_DIR/build_$KB.lang"
+  sed "s/65536/$((KB * 64))/g" bench/string_build.lang >"$SCRIPT"
+
+  if [ "$("$BUILD_DIR/vm" "$SCRIPT" 2>/dev/null | tail -n 1)" != "true" ]; then
+    echo "$KB KB: wrong output" >&2
+    exit 1
+  fi
+
+  ROPES=$(seconds "$BUILD_DIR/vm" "$SCRIPT")
+  FLAT="-"
+  if [ "$KB" -le "$FLAT_MAX_KB" ]; then
+    FLAT=$(seconds "$BUILD_DIR/vm" --no-ropes "$SCRIPT")
+  fi
+  printf "%-10s %10s %10s\n" "${KB} KB" "$ROPES" "$FLAT"
+done
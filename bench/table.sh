@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Builds bench/table_bench.c against the working tree and against a git
+# revision, and prints the time each Table operation takes in both.
+#
+# Usage: bench/table.sh [revision]   (defaults to HEAD)
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+REVISION=${1:-HEAD}
+
+# buildHarness compiles the harness with every source of a tree but
+# main.c
+buildHarness() {
+  local FILES
+  FILES=$(cd "$1" && find . -name "*.c" -not -path "./bench/*" \
+    -not -path "./node_modules/*" -not -name main.c)
+  (cd "$1" && $CC $CFLAGS $FILES bench/table_bench.c -o "$2")
+}
+
+mkdir "$BUILD_DIR/base"
+git archive "$REVISION" | tar -x -C "$BUILD_DIR/base" || exit 1
+mkdir -p "$BUILD_DIR/base/bench"
+cp bench/table_bench.c "$BUILD_DIR/base/bench/"
+
+buildHarness "$BUILD_DIR/base" "$BUILD_DIR/table_base" || exit 1
+buildHarness . "$BUILD_DIR/table_new" || exit 1
+
+echo "== $REVISION"
+"$BUILD_DIR/table_base"
+echo "== working tree"
+"$BUILD_DIR/table_new"
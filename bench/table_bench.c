@@ -0,0 +1,132 @@
+// Times the Table operations the VM leans on: globals-sized lookups,
+// inserts, hits and misses in a table that fits the cache and in one
+// that does not, and deletes mixed with inserts. bench/table.sh builds
+// it against two trees and compares them.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../memory/memory.h"
+#include "../object/object.h"
+#include "../table/table.h"
+#include "../virtual_machine/vm.h"
+
+#define KEY_COUNT (1 << 20)
+#define SMALL_COUNT 64
+#define CHURN_COUNT (1 << 16)
+
+static ObjString *keys[KEY_COUNT];
+static ObjString *missing[KEY_COUNT];
+static volatile long sink;
+
+static double seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// report prints the time per operation of a run of count operations
+static void report(const char *name, double start, long count) {
+  printf("%-12s %8.2f ns/op\n", name, (seconds() - start) * 1e9 / count);
+}
+
+static void makeKeys(ObjString **into, const char *prefix) {
+  char chars[32];
+  for (int i = 0; i < KEY_COUNT; i++) {
+    int length = snprintf(chars, sizeof(chars), "%s%d", prefix, i);
+    into[i] = copyString(chars, length);
+  }
+}
+
+// lookupSmall looks up the keys of a table the size of a script's
+// globals
+static void lookupSmall() {
+  Table table;
+  initTable(&table);
+  for (int i = 0; i < SMALL_COUNT; i++)
+    tableSet(&table, keys[i], NUMBER_VAL(i));
+
+  double start = seconds();
+  long found = 0;
+  Value value;
+  for (long i = 0; i < 20000000; i++)
+    found += tableGet(&table, keys[i & (SMALL_COUNT - 1)], &value);
+  report("small get", start, 20000000);
+  sink = found;
+  freeTable(&table);
+}
+
+// lookup fills a table with count keys and looks them up in a scattered
+// order, then looks up as many keys it does not hold
+static void lookup(const char *size, int count) {
+  char name[32];
+  Table table;
+  initTable(&table);
+  long rounds = 4L * KEY_COUNT / count;
+
+  double start = seconds();
+  for (int i = 0; i < count; i++)
+    tableSet(&table, keys[i], NUMBER_VAL(i));
+  snprintf(name, sizeof(name), "set %s", size);
+  report(name, start, count);
+
+  long found = 0;
+  Value value;
+  start = seconds();
+  for (long round = 0; round < rounds; round++)
+    for (unsigned i = 0; i < (unsigned)count; i++)
+      found += tableGet(&table, keys[(i * 7919u) & (count - 1)], &value);
+  snprintf(name, sizeof(name), "hit %s", size);
+  report(name, start, rounds * count);
+
+  start = seconds();
+  for (long round = 0; round < rounds; round++)
+    for (int i = 0; i < count; i++)
+      found += tableGet(&table, missing[i], &value);
+  snprintf(name, sizeof(name), "miss %s", size);
+  report(name, start, rounds * count);
+  sink = found;
+  freeTable(&table);
+}
+
+// churn keeps CHURN_COUNT keys in a table while deleting the oldest and
+// inserting a new one, the way the intern table sees strings come and go
+static void churn() {
+  Table table;
+  initTable(&table);
+  for (int i = 0; i < CHURN_COUNT; i++)
+    tableSet(&table, keys[i], NIL_VAL);
+
+  double start = seconds();
+  for (int i = CHURN_COUNT; i < KEY_COUNT; i++) {
+    tableDelete(&table, keys[i - CHURN_COUNT]);
+    tableSet(&table, keys[i], NIL_VAL);
+  }
+  report("churn", start, KEY_COUNT - CHURN_COUNT);
+
+  TableStats stats;
+  tableStats(&table, &stats);
+  printf("%-12s %d keys, %d tombstones in %d entries, %.2f probes on "
+         "average, %d at most\n",
+         "", stats.count, stats.tombstones, stats.capacity,
+         stats.averageProbe, stats.longestProbe);
+  freeTable(&table);
+}
+
+int main() {
+  initVM();
+  // The keys live outside the VM's roots, keep the collector away
+  nurseryEnabled = false;
+  vm.nextGC = SIZE_MAX;
+  makeKeys(keys, "key");
+  makeKeys(missing, "missing");
+
+  lookupSmall();
+  lookup("4k", 4096);
+  lookup("1M", KEY_COUNT);
+  churn();
+  return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Compares the 16 byte tagged union Value against the NaN-boxed 8 byte
+# word (-DVM_NAN_BOXING) on stack-heavy and table-heavy scripts. Fails if
+# the two representations print different output.
+#
+# Usage: bench/values.sh [script.lang ...]
+
+cd "$(dirname "$0")/.."
+
+source bench/lib.sh
+
+build union || exit 1
+build nan -DVM_NAN_BOXING || exit 1
+
+SCRIPTS=("$@")
+if [ ${#SCRIPTS[@]} -eq 0 ]; then
+  SCRIPTS=(bench/stack_heavy.lang bench/table_heavy.lang
+    bench/locals_arith.lang bench/while_globals.lang)
+fi
+
+printf "%-22s %10s %10s %8s\n" "script" "union s" "nan s" "speedup"
+
+for SCRIPT in "${SCRIPTS[@]}"; do
+  if ! diff -q <("$BUILD_DIR/union" "$SCRIPT" 2>&1) \
+    <("$BUILD_DIR/nan" "$SCRIPT" 2>&1) >/dev/null; then
+    echo "$SCRIPT: output differs" >&2
+    exit 1
+  fi
+
+  UNION=$(seconds "$BUILD_DIR/union" "$SCRIPT")
+  NAN=$(seconds "$BUILD_DIR/nan" "$SCRIPT")
+
+  awk -v name="$(basename "$SCRIPT")" -v u="$UNION" -v n="$NAN" 'BEGIN {
+      printf "%-22s %10.3f %10.3f %7.2fx\n", name, u, n, u / n
+    }'
+done
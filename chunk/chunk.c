@@ -4,12 +4,107 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+// Size in bytes of each instruction, opcode included
+static const uint8_t instructionLengths[] = {
+    [OP_CONSTANT] = 2,
+    [OP_NEGATE] = 1,
+    [OP_RETURN] = 1,
+    [OP_PRINT] = 1,
+    [OP_JUMP_IF_FALSE] = 3,
+    [OP_JUMP] = 3,
+    [OP_LOOP] = 3,
+    [OP_NIL] = 1,
+    [OP_TRUE] = 1,
+    [OP_FALSE] = 1,
+    [OP_POP] = 1,
+    [OP_GET_GLOBAL] = 2,
+    [OP_SET_GLOBAL] = 2,
+    [OP_DEFINE_GLOBAL] = 2,
+    [OP_GET_GLOBAL_SLOT] = 2,
+    [OP_SET_GLOBAL_SLOT] = 2,
+    [OP_DEFINE_GLOBAL_SLOT] = 2,
+    [OP_GET_LOCAL] = 2,
+    [OP_SET_LOCAL] = 2,
+    [OP_EQUAL] = 1,
+    [OP_GREATOR] = 1,
+    [OP_LESS] = 1,
+    [OP_ADD] = 1,
+    [OP_SUBSTRACT] = 1,
+    [OP_MULTIPLY] = 1,
+    [OP_DIVIDE] = 1,
+    [OP_NOT] = 1,
+    [OP_ADD_RK] = 3,
+    [OP_SUBSTRACT_RK] = 3,
+    [OP_MULTIPLY_RK] = 3,
+    [OP_DIVIDE_RK] = 3,
+    [OP_EQUAL_RK] = 3,
+    [OP_GREATOR_RK] = 3,
+    [OP_LESS_RK] = 3,
+    [OP_ADD_SET] = 4,
+    [OP_SUBSTRACT_SET] = 4,
+    [OP_MULTIPLY_SET] = 4,
+    [OP_DIVIDE_SET] = 4,
+    [OP_MOVE] = 3,
+    [OP_LESS_LOCAL_CONSTANT_JUMP] = 5,
+    [OP_ADD_LOCAL_CONSTANT] = 4,
+    [OP_LESS_RK_JUMP] = 5,
+    [OP_NOT_EQUAL] = 1,
+    [OP_NOT_LESS] = 1,
+    [OP_NOT_GREATOR] = 1,
+    [OP_SET_GLOBAL_SLOT_POP] = 2,
+    [OP_SET_LOCAL_POP] = 2,
+    [OP_ADD_NUM] = 1,
+    [OP_ADD_STR] = 1,
+    [OP_SUBSTRACT_NUM] = 1,
+    [OP_MULTIPLY_NUM] = 1,
+    [OP_DIVIDE_NUM] = 1,
+    [OP_GREATOR_NUM] = 1,
+    [OP_LESS_NUM] = 1,
+    [OP_ADD_INT] = 1,
+    [OP_SUBSTRACT_INT] = 1,
+    [OP_MULTIPLY_INT] = 1,
+    [OP_GREATOR_INT] = 1,
+    [OP_LESS_INT] = 1,
+};
+
+// The generic instruction each quickened form was rewritten from
+static const uint8_t genericInstructions[] = {
+    [OP_ADD_NUM] = OP_ADD,
+    [OP_ADD_STR] = OP_ADD,
+    [OP_SUBSTRACT_NUM] = OP_SUBSTRACT,
+    [OP_MULTIPLY_NUM] = OP_MULTIPLY,
+    [OP_DIVIDE_NUM] = OP_DIVIDE,
+    [OP_GREATOR_NUM] = OP_GREATOR,
+    [OP_LESS_NUM] = OP_LESS,
+    [OP_ADD_INT] = OP_ADD,
+    [OP_SUBSTRACT_INT] = OP_SUBSTRACT,
+    [OP_MULTIPLY_INT] = OP_MULTIPLY,
+    [OP_GREATOR_INT] = OP_GREATOR,
+    [OP_LESS_INT] = OP_LESS,
+};
+
+// instructionLength returns the size in bytes of an instruction
+int instructionLength(uint8_t instruction) {
+  return instructionLengths[instruction];
+}
+
+// genericInstruction undoes quickening, other instructions are returned
+// as they are
+uint8_t genericInstruction(uint8_t instruction) {
+  if (instruction < sizeof(genericInstructions) /
+                        sizeof(genericInstructions[0]) &&
+      genericInstructions[instruction] != OP_CONSTANT)
+    return genericInstructions[instruction];
+  return instruction;
+}
+
 // Initialize a new chunk
 void initChunk(Chunk *chunk) {
   chunk->count = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
   chunk->lines = NULL;
+  chunk->maxStackDepth = 0;
   initValueArray(&chunk->constants);
 }
 
@@ -20,9 +115,10 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line) {
     int oldCapacity = chunk->capacity;
     // Increased the capacity
     chunk->capacity = GROW_CAPACITY(oldCapacity);
-    chunk->code =
-        GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+    chunk->code = ARENA_GROW_ARRAY(uint8_t, chunk->code, oldCapacity,
+                                   chunk->capacity, MEM_CHUNK_CODE);
+    chunk->lines = ARENA_GROW_ARRAY(int, chunk->lines, oldCapacity,
+                                    chunk->capacity, MEM_CHUNK_LINES);
   }
 
   chunk->code[chunk->count] = byte;
@@ -33,9 +129,11 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line) {
 // Empty a chunk
 void freeChunk(Chunk *chunk) {
   // Free the code
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  ARENA_FREE_ARRAY(uint8_t, chunk->code, chunk->capacity, MEM_CHUNK_CODE);
   // Free the lines
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
+  ARENA_FREE_ARRAY(int, chunk->lines, chunk->capacity, MEM_CHUNK_LINES);
+  // Free the constants, the objects among them belong to the collector
+  freeValueArray(&chunk->constants);
 
   initChunk(chunk);
 }
@@ -21,6 +21,11 @@ typedef enum {
   OP_GET_GLOBAL,
   OP_SET_GLOBAL,
   OP_DEFINE_GLOBAL,
+  // Globals by the slot index the compiler resolved, the name forms
+  // above look the slot up in vm.globals
+  OP_GET_GLOBAL_SLOT,
+  OP_SET_GLOBAL_SLOT,
+  OP_DEFINE_GLOBAL_SLOT,
   OP_GET_LOCAL,
   OP_SET_LOCAL,
   OP_EQUAL,
@@ -31,14 +36,58 @@ typedef enum {
   OP_MULTIPLY,
   OP_DIVIDE,
   OP_NOT,
+  // Register mode instructions, the _RK forms push the result of two
+  // register operands and the _SET forms store it into a local slot
+  OP_ADD_RK,
+  OP_SUBSTRACT_RK,
+  OP_MULTIPLY_RK,
+  OP_DIVIDE_RK,
+  OP_EQUAL_RK,
+  OP_GREATOR_RK,
+  OP_LESS_RK,
+  OP_ADD_SET,
+  OP_SUBSTRACT_SET,
+  OP_MULTIPLY_SET,
+  OP_DIVIDE_SET,
+  OP_MOVE,
+  // Superinstructions fused from common sequences after compilation,
+  // see superinstruction/superinstruction.c
+  OP_LESS_LOCAL_CONSTANT_JUMP,
+  OP_ADD_LOCAL_CONSTANT,
+  OP_LESS_RK_JUMP,
+  OP_NOT_EQUAL,
+  OP_NOT_LESS,
+  OP_NOT_GREATOR,
+  OP_SET_GLOBAL_SLOT_POP,
+  OP_SET_LOCAL_POP,
+  // Quickened forms run() rewrites a generic instruction into once it
+  // has seen its operand types. Compiled chunks never contain them
+  OP_ADD_NUM,
+  OP_ADD_STR,
+  OP_SUBSTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_GREATOR_NUM,
+  OP_LESS_NUM,
+  OP_ADD_INT,
+  OP_SUBSTRACT_INT,
+  OP_MULTIPLY_INT,
+  OP_GREATOR_INT,
+  OP_LESS_INT,
 } OpCode;
 
+// A register operand addresses a local slot, or the constant pool
+// when RK_CONSTANT is set. Both indexes are limited to RK_MAX
+#define RK_CONSTANT 0x80
+#define RK_MAX 0x7f
+
 typedef struct Chunk {
   int capacity;         // Capacity of the array
   int count;            // Current count of the array
   uint8_t *code;        // Code
   ValueArray constants; // Constants
   int *lines;           // Store the lines of code
+  int maxStackDepth;    // Deepest value stack the code needs, verified
 } Chunk;
 
 void initChunk(Chunk *chunk);
@@ -46,5 +95,7 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line);
 void freeChunk(Chunk *chunk);
 // Write to the constants array and return the index
 int addConstant(Chunk *chunk, Value v);
+int instructionLength(uint8_t instruction);
+uint8_t genericInstruction(uint8_t instruction);
 
 #endif
@@ -1,8 +1,28 @@
 #ifndef vm_common_h
 #define vm_common_h
 
+// Release builds (-DNDEBUG) drop the debug output
+#ifndef NDEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
+
+// run() dispatches through a table of label addresses when the compiler
+// supports computed gotos (gcc and clang do), build with
+// -DVM_SWITCH_DISPATCH to fall back to the portable switch loop
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_COMPUTED_GOTO
+#endif
+
+// Build with -DVM_NAN_BOXING to pack every Value into one 8 byte word
+// instead of the 16 byte tagged union, see value/value.h
+
+// Build with -DVM_ARENA_ALLOCATOR to serve small blocks from size class
+// free lists and compile-time data from a bump arena, see memory/memory.c
+
+// Build with -DVM_CONCURRENT_GC (and -pthread) for --concurrent-gc, which
+// marks and sweeps on a collector thread, see memory/memory.c
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 #include <stdbool.h>
@@ -2,7 +2,10 @@
 #include "../chunk/chunk.h"
 #include "../commons/common.h"
 #include "../object/object.h"
+#include "../optimizer/optimizer.h"
 #include "../scanner/scanner.h"
+#include "../verifier/verifier.h"
+#include "../virtual_machine/vm.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -57,10 +60,43 @@ typedef struct ParseRule {
   Precedence precedence;
 } ParseRule;
 
+// Tail describes the instructions at the end of the chunk that
+// register mode may still rewrite. It only stays valid while nothing
+// else is emitted after it and no jump lands at its end
+typedef enum { TAIL_LOAD, TAIL_REGISTER, TAIL_SET_LOCAL } TailKind;
+
+typedef struct Tail {
+  TailKind kind;
+  int start;  // offset of the first instruction of the sequence
+  int end;    // chunk count right after the sequence
+  uint8_t rk; // register operand of a TAIL_LOAD
+} Tail;
+
+// Known describes what the compiler knows about the value the
+// instructions at the end of the chunk leave on the stack, so operators
+// applied to it can be folded. Like Tail it only stays valid while
+// nothing else is emitted after it and no jump lands at its end
+typedef struct Known {
+  int start;       // offset of the instruction loading a constant
+  int end;         // chunk count right after the value is computed
+  int constants;   // size of the constant pool before that instruction
+  bool isConstant; // value holds what the instructions load
+  bool isNumber;   // always a number, unless the code fails first
+  Value value;
+} Known;
+
 // Set the global variables
 Parser parser;
 Compiler *current;
 Chunk *compilingChunk;
+CompileMode compileMode = COMPILE_STACK;
+Tail tail = {TAIL_LOAD, -1, -1, 0};
+Known known = {.start = -1, .end = -1};
+bool foldingEnabled = true;
+// Operands of a binary expression waiting to be folded into the
+// register form of its operator
+bool pendingRegisterOperands = false;
+uint8_t pendingA, pendingB;
 
 // function declarations
 static void binary(bool canAssign);
@@ -193,15 +229,132 @@ static bool match(TokenType type) {
   return true;
 }
 
+// setTail records the instructions from start to the end of the
+// chunk as a sequence register mode may rewrite
+static void setTail(TailKind kind, int start, uint8_t rk) {
+  tail.kind = kind;
+  tail.start = start;
+  tail.end = currentChunk()->count;
+  tail.rk = rk;
+}
+
+// tailIs checks if the end of the chunk is still a sequence of kind
+static bool tailIs(TailKind kind) {
+  return tail.end == currentChunk()->count && tail.kind == kind;
+}
+
+// setKnown records the value the instructions from start to the end of
+// the chunk leave, value only matters for a constant
+static void setKnown(int start, int constants, bool isConstant,
+                     Value value) {
+  known.start = start;
+  known.end = currentChunk()->count;
+  known.constants = constants;
+  known.isConstant = isConstant;
+  known.isNumber = isConstant && IS_NUMBER(value);
+  known.value = value;
+}
+
+// setKnownNumber records that the instruction just emitted always
+// leaves a number
+static void setKnownNumber() {
+  setKnown(-1, currentChunk()->constants.count, false, NIL_VAL);
+  known.isNumber = true;
+}
+
+// knownConstantAt checks if the end of the chunk is still a constant
+// load that starts at start
+static bool knownConstantAt(int start) {
+  return foldingEnabled && known.end == currentChunk()->count &&
+         known.isConstant && known.start == start;
+}
+
 // emitConstant emits a constant bytecode
 static void emitConstant(Value value) {
-  emitBytes(OP_CONSTANT, makeConstant(value));
+  int start = currentChunk()->count;
+  int constants = currentChunk()->constants.count;
+  uint8_t constant = makeConstant(value);
+  emitBytes(OP_CONSTANT, constant);
+
+  if (constant <= RK_MAX)
+    setTail(TAIL_LOAD, start, RK_CONSTANT | constant);
+  setKnown(start, constants, true, value);
+}
+
+// emitValue loads a constant, booleans and nil have instructions of
+// their own
+static void emitValue(Value value) {
+  if (!IS_BOOL(value) && !IS_NIL(value)) {
+    emitConstant(value);
+    return;
+  }
+
+  int start = currentChunk()->count;
+  if (IS_NIL(value))
+    emitByte(OP_NIL);
+  else
+    emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  setKnown(start, currentChunk()->constants.count, true, value);
+}
+
+// emitFolded replaces the instructions from start to the end of the
+// chunk, and the constants they added to the pool, with a load of value.
+// The tail described the dropped instructions, only a constant load
+// sets a new one
+static void emitFolded(int start, int constants, Value value) {
+  currentChunk()->count = start;
+  currentChunk()->constants.count = constants;
+  tail.end = -1;
+  emitValue(value);
+}
+
+// registerForm returns the three address form of a stack operator
+// or -1 if there is none
+static int registerForm(uint8_t instruction) {
+  switch (instruction) {
+  case OP_ADD:
+    return OP_ADD_RK;
+  case OP_SUBSTRACT:
+    return OP_SUBSTRACT_RK;
+  case OP_MULTIPLY:
+    return OP_MULTIPLY_RK;
+  case OP_DIVIDE:
+    return OP_DIVIDE_RK;
+  case OP_EQUAL:
+    return OP_EQUAL_RK;
+  case OP_GREATOR:
+    return OP_GREATOR_RK;
+  case OP_LESS:
+    return OP_LESS_RK;
+  default:
+    return -1;
+  }
+}
+
+// emitOperator emits a binary operator, folding pending register
+// operands into its three address form
+static void emitOperator(uint8_t instruction) {
+  if (!pendingRegisterOperands) {
+    emitByte(instruction);
+    return;
+  }
+
+  pendingRegisterOperands = false;
+  int start = currentChunk()->count;
+  emitByte((uint8_t)registerForm(instruction));
+  emitBytes(pendingA, pendingB);
+  setTail(TAIL_REGISTER, start, 0);
 }
 
 // number adds a number to the vm
 static void number(bool canAssign) {
   double value = strtod(parser.previous.start, NULL);
-  emitConstant(NUMBER_VAL(value));
+  // Integral literals start out as ints, run() keeps them ints for as
+  // long as their arithmetic fits
+  if (value >= INT32_MIN && value <= INT32_MAX && value == (int32_t)value)
+    emitConstant(INT_VAL((int32_t)value));
+  else
+    emitConstant(NUMBER_VAL(value));
 }
 
 // parsePrecedence handles parsing of expressions with
@@ -240,65 +393,198 @@ static void grouping(bool canAssign) {
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression .");
 }
 
+// foldUnary computes a unary operator on a constant the way run()
+// would, returns false if run() fails on it so the error stays in the
+// code
+static bool foldUnary(TokenType operatorType, Value value, Value *result) {
+  switch (operatorType) {
+  case TOKEN_BANG:
+    return foldInstruction(OP_NOT, value, NIL_VAL, result);
+  case TOKEN_MINUS:
+    return foldInstruction(OP_NEGATE, value, NIL_VAL, result);
+  default:
+    return false;
+  }
+}
+
 // Parses unary expressions
 static void unary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
+  int start = currentChunk()->count;
 
   // // Compile the operand
   // expression();
 
   parsePrecedence(PREC_UNARY);
 
+  Value value;
+  if (knownConstantAt(start) &&
+      foldUnary(operatorType, known.value, &value)) {
+    emitFolded(start, known.constants, value);
+    return;
+  }
+
   switch (operatorType) {
   case TOKEN_BANG:
     emitByte(OP_NOT);
     break;
   case TOKEN_MINUS:
     emitByte(OP_NEGATE);
+    setKnownNumber();
     break;
   default:
     return;
   }
 }
 
+// foldBinary computes a binary operator on two constants the way run()
+// would, returns false if run() fails on them so the error stays in the
+// code. != <= and >= run as the negation of == > and <, which differs
+// from the comparison itself for NaN
+static bool foldBinary(TokenType operatorType, Value a, Value b,
+                       Value *result) {
+  uint8_t instruction;
+  bool negate = false;
+  switch (operatorType) {
+  case TOKEN_BANG_EQUAL:
+    negate = true;
+    // Fallthrough
+  case TOKEN_EQUAL_EQUAL:
+    instruction = OP_EQUAL;
+    break;
+  case TOKEN_LESS_EQUAL:
+    negate = true;
+    // Fallthrough
+  case TOKEN_GREATER:
+    instruction = OP_GREATOR;
+    break;
+  case TOKEN_GREATER_EQUAL:
+    negate = true;
+    // Fallthrough
+  case TOKEN_LESS:
+    instruction = OP_LESS;
+    break;
+  case TOKEN_PLUS:
+    instruction = OP_ADD;
+    break;
+  case TOKEN_MINUS:
+    instruction = OP_SUBSTRACT;
+    break;
+  case TOKEN_STAR:
+    instruction = OP_MULTIPLY;
+    break;
+  case TOKEN_SLASH:
+    instruction = OP_DIVIDE;
+    break;
+  default:
+    return false;
+  }
+
+  if (!foldInstruction(instruction, a, b, result))
+    return false;
+  return !negate || foldInstruction(OP_NOT, *result, NIL_VAL, result);
+}
+
+// isIdentity checks if applying the operator with a constant right
+// operand leaves any number exactly as it was. Only the int constants
+// qualify, x * 1.0 and x - 0.0 turn an int x into a double
+static bool isIdentity(TokenType operatorType, Value constant) {
+  if (!IS_INT(constant))
+    return false;
+
+  switch (operatorType) {
+  case TOKEN_STAR:
+    return AS_INT(constant) == 1;
+  case TOKEN_MINUS:
+    return AS_INT(constant) == 0;
+  default:
+    return false;
+  }
+}
+
 // binary parses binary expressions
 static void binary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
   ParseRule *rule = getRule(operatorType);
+  Tail left = tail;
+  bool leftIsLoad = tailIs(TAIL_LOAD);
+  Known leftKnown = known;
+  int rightStart = currentChunk()->count;
+  if (leftKnown.end != rightStart)
+    leftKnown.isConstant = leftKnown.isNumber = false;
 
   // Recursive call to parse it with precedence
   parsePrecedence((Precedence)rule->precedence + 1);
 
+  // Two constant operands fold into one. A right operand that cannot
+  // change a left operand known to be a number is dropped, any other
+  // identity would lose a type error, turn -0 into 0 or ints into doubles
+  Value value;
+  if (knownConstantAt(rightStart)) {
+    if (leftKnown.isConstant &&
+        foldBinary(operatorType, leftKnown.value, known.value, &value)) {
+      emitFolded(leftKnown.start, leftKnown.constants, value);
+      return;
+    }
+    if (leftKnown.isNumber && isIdentity(operatorType, known.value)) {
+      currentChunk()->count = rightStart;
+      currentChunk()->constants.count = known.constants;
+      // The left operand's tail still holds if it ended where the
+      // right operand started
+      tail = left;
+      if (left.end != rightStart)
+        tail.end = -1;
+      known = leftKnown;
+      return;
+    }
+  }
+
+  // When both operands are single local or constant loads register
+  // mode drops the loads and lets the operator address them directly
+  if (compileMode == COMPILE_REGISTER && leftIsLoad && tailIs(TAIL_LOAD) &&
+      left.end == tail.start) {
+    pendingRegisterOperands = true;
+    pendingA = left.rk;
+    pendingB = tail.rk;
+    currentChunk()->count = left.start;
+  }
+
   switch (operatorType) {
   case TOKEN_BANG_EQUAL:
-    emitBytes(OP_EQUAL, OP_NOT);
+    emitOperator(OP_EQUAL);
+    emitByte(OP_NOT);
     break;
   case TOKEN_EQUAL_EQUAL:
-    emitByte(OP_EQUAL);
+    emitOperator(OP_EQUAL);
     break;
   case TOKEN_GREATER:
-    emitByte(OP_GREATOR);
+    emitOperator(OP_GREATOR);
     break;
   case TOKEN_GREATER_EQUAL:
-    emitBytes(OP_LESS, OP_NOT);
+    emitOperator(OP_LESS);
+    emitByte(OP_NOT);
     break;
   case TOKEN_LESS:
-    emitByte(OP_LESS);
+    emitOperator(OP_LESS);
     break;
   case TOKEN_LESS_EQUAL:
-    emitBytes(OP_GREATOR, OP_NOT);
+    emitOperator(OP_GREATOR);
+    emitByte(OP_NOT);
     break;
   case TOKEN_PLUS:
-    emitByte(OP_ADD);
+    emitOperator(OP_ADD);
     break;
   case TOKEN_STAR:
-    emitByte(OP_MULTIPLY);
+    emitOperator(OP_MULTIPLY);
+    setKnownNumber();
     break;
   case TOKEN_SLASH:
-    emitByte(OP_DIVIDE);
+    emitOperator(OP_DIVIDE);
+    setKnownNumber();
     break;
   case TOKEN_MINUS:
-    emitByte(OP_SUBSTRACT);
+    emitOperator(OP_SUBSTRACT);
+    setKnownNumber();
     break;
   default:
     return;
@@ -309,13 +595,13 @@ static void binary(bool canAssign) {
 static void literal(bool canAssign) {
   switch (parser.previous.type) {
   case TOKEN_TRUE:
-    emitByte(OP_TRUE);
+    emitValue(BOOL_VAL(true));
     break;
   case TOKEN_FALSE:
-    emitByte(OP_FALSE);
+    emitValue(BOOL_VAL(false));
     break;
   case TOKEN_NIL:
-    emitByte(OP_NIL);
+    emitValue(NIL_VAL);
     break;
   default:
     return;
@@ -337,13 +623,16 @@ static void string(bool canAssign) {
 // To Declare variables, we add it to our list of constants
 // in our vm
 
-// identifierConstant adds the identifier to the chunks->constant
-// array as an Obj and then returns the index
+// identifierConstant resolves a global variable's name to the index of
+// its slot in vm.globalSlots, which the global instructions take as
+// their operand. The name itself stays reachable through vm.globals
 static uint8_t identifierConstant(Token *name) {
-  // copyString handles allocation of string to objectString type
-  // and returns the objectString which is then casted to OBJ_VAL t
-  // to the Obj type, which is then made a constant
-  return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+  int slot = globalSlot(copyString(name->start, name->length));
+  if (slot == -1) {
+    error("Too many global variables");
+    return 0;
+  }
+  return (uint8_t)slot;
 }
 
 // parseVariable parses the variable and displays the error
@@ -363,8 +652,8 @@ static void markInitialized() {
 }
 
 // In the byte code variables are defines as one
-// OP_DEFINE_GLOBAL command followed by the index
-// of the actual variable
+// OP_DEFINE_GLOBAL_SLOT command followed by the
+// slot of the actual variable
 static void defineVariable(uint8_t variableIndex) {
   // ignore if it is a local variable
   if (current->scopeDepth > 0) {
@@ -372,7 +661,7 @@ static void defineVariable(uint8_t variableIndex) {
     return;
   }
 
-  emitBytes(OP_DEFINE_GLOBAL, variableIndex);
+  emitBytes(OP_DEFINE_GLOBAL_SLOT, variableIndex);
 }
 
 // varDeclaration function defines the variable
@@ -399,11 +688,12 @@ static void varDeclaration() {
 static int resolveLocal(Compiler *compiler, Token *name) {
   for (int i = compiler->localCount - 1; i >= 0; i--) {
     Local *local = &compiler->locals[i];
-    if (identifierEquals(name, &local->name))
+    if (identifierEquals(name, &local->name)) {
       if (local->depth == -1) {
         error("Can't read local variable in its own initializer.");
       }
-    return i;
+      return i;
+    }
   }
 
   return -1;
@@ -418,17 +708,25 @@ static void namedVariable(Token name, bool canAssign) {
     setOp = OP_SET_LOCAL;
   } else {
     idx = identifierConstant(&name);
-    getOp = OP_GET_GLOBAL;
-    setOp = OP_SET_GLOBAL;
+    getOp = OP_GET_GLOBAL_SLOT;
+    setOp = OP_SET_GLOBAL_SLOT;
   }
 
   if (canAssign && match(TOKEN_EQUAL)) {
     // Next token is an equal
     expression();
+    Tail value = tail;
+    bool simpleValue = tailIs(TAIL_LOAD) || tailIs(TAIL_REGISTER);
     emitBytes(setOp, (uint8_t)idx);
-  } else {
 
+    if (setOp == OP_SET_LOCAL && simpleValue)
+      setTail(TAIL_SET_LOCAL, value.start, 0);
+  } else {
+    int start = currentChunk()->count;
     emitBytes(getOp, (uint8_t)idx);
+
+    if (getOp == OP_GET_LOCAL && idx <= RK_MAX)
+      setTail(TAIL_LOAD, start, (uint8_t)idx);
   }
 }
 
@@ -444,10 +742,62 @@ static void printStatement() {
   emitByte(OP_PRINT);
 }
 
+// storeLocal rewrites a `local = value` sequence whose result is
+// discarded into one instruction that writes the slot directly,
+// returns false if value has no such form
+static bool storeLocal() {
+  Chunk *chunk = currentChunk();
+  uint8_t *value = &chunk->code[tail.start];
+  uint8_t slot = chunk->code[chunk->count - 1];
+  uint8_t instruction;
+
+  switch (value[0]) {
+  case OP_CONSTANT:
+  case OP_GET_LOCAL: {
+    uint8_t rk = value[0] == OP_CONSTANT ? RK_CONSTANT | value[1] : value[1];
+    chunk->count = tail.start;
+    emitBytes(OP_MOVE, slot);
+    emitByte(rk);
+    return true;
+  }
+  case OP_ADD_RK:
+    instruction = OP_ADD_SET;
+    break;
+  case OP_SUBSTRACT_RK:
+    instruction = OP_SUBSTRACT_SET;
+    break;
+  case OP_MULTIPLY_RK:
+    instruction = OP_MULTIPLY_SET;
+    break;
+  case OP_DIVIDE_RK:
+    instruction = OP_DIVIDE_SET;
+    break;
+  default:
+    return false;
+  }
+
+  uint8_t a = value[1];
+  uint8_t b = value[2];
+  chunk->count = tail.start;
+  emitBytes(instruction, slot);
+  emitBytes(a, b);
+  return true;
+}
+
+// emitDiscard pops the value of an expression statement, in register
+// mode an assignment to a local is stored without touching the stack
+static void emitDiscard() {
+  if (compileMode == COMPILE_REGISTER && tailIs(TAIL_SET_LOCAL) &&
+      storeLocal())
+    return;
+
+  emitByte(OP_POP);
+}
+
 static void expressionStatement() {
   expression();
   consume(TOKEN_SEMICOLON, "Expect ; after expression");
-  emitByte(OP_POP);
+  emitDiscard();
 }
 
 // For panic mode recovery
@@ -502,6 +852,10 @@ static void patchJump(int offset) {
   // Write the low bits and the high bits
   currentChunk()->code[offset] = (jumpLength >> 8) & 0xff;
   currentChunk()->code[offset + 1] = jumpLength & 0xff;
+
+  // A jump lands here so the code before it can no longer be rewritten
+  tail.end = -1;
+  known.end = -1;
 }
 
 // emitLoop handles loop statement
@@ -564,7 +918,7 @@ static void forStatement() {
     int bodyJump = emitJump(OP_JUMP);
     int incrementStart = currentChunk()->count;
     expression();
-    emitByte(OP_POP);
+    emitDiscard();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
 
     emitLoop(loopStart);
@@ -790,6 +1144,7 @@ bool compile(char *source, Chunk *chunk) {
   initCompiler(&compiler);
 
   compilingChunk = chunk;
+  known.end = -1;
 
   advance();
   while (!match(TOKEN_EOF)) {
@@ -797,5 +1152,7 @@ bool compile(char *source, Chunk *chunk) {
   }
 
   endCompiler();
-  return !parser.hadError;
+  // Work out the stack depth the chunk needs and refuse code that could
+  // corrupt the stack before it gets to run
+  return !parser.hadError && verifyChunk(chunk) && optimizeChunk(chunk);
 }
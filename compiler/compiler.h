@@ -3,6 +3,17 @@
 
 #include "../chunk/chunk.h"
 
+// CompileMode selects the instruction format the compiler emits
+typedef enum {
+  COMPILE_STACK,    // every operand goes through the value stack
+  COMPILE_REGISTER, // three address ops read locals and constants directly
+} CompileMode;
+
+extern CompileMode compileMode;
+// foldingEnabled computes operators on constants while compiling,
+// --no-folding leaves them all to run()
+extern bool foldingEnabled;
+
 bool compile(char* source, Chunk* chunk);
 
 #endif
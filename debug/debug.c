@@ -1,5 +1,6 @@
 #include "../chunk/chunk.h"
 #include "../value//value.h"
+#include "../virtual_machine/vm.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,6 +26,68 @@ static int byteInstruction(const char *name, Chunk *chunk, int offset) {
   return offset + 2;
 }
 
+// globalInstruction prints a global slot with the name it belongs to
+static int globalInstruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  printf(" %-16s %4d '%s'\n", name, slot,
+         slot < vm.globalCount ? vm.globalSlots[slot].name->chars : "?");
+  return offset + 2;
+}
+
+// printRegister prints a register operand as a local slot or a constant
+static void printRegister(Chunk *chunk, uint8_t rk) {
+  if (rk & RK_CONSTANT) {
+    printf(" K%d '", rk & RK_MAX);
+    printValue(chunk->constants.values[rk & RK_MAX]);
+    printf("'");
+  } else {
+    printf(" L%d", rk);
+  }
+}
+
+static int registerInstruction(const char *name, Chunk *chunk, int offset) {
+  printf(" %-16s", name);
+  printRegister(chunk, chunk->code[offset + 1]);
+  printRegister(chunk, chunk->code[offset + 2]);
+  printf("\n");
+  return offset + 3;
+}
+
+static int storeInstruction(const char *name, Chunk *chunk, int offset) {
+  printf(" %-16s L%d <-", name, chunk->code[offset + 1]);
+  printRegister(chunk, chunk->code[offset + 2]);
+  printRegister(chunk, chunk->code[offset + 3]);
+  printf("\n");
+  return offset + 4;
+}
+
+static int moveInstruction(const char *name, Chunk *chunk, int offset) {
+  printf(" %-16s L%d <-", name, chunk->code[offset + 1]);
+  printRegister(chunk, chunk->code[offset + 2]);
+  printf("\n");
+  return offset + 3;
+}
+
+// fusedJumpInstruction prints a superinstruction ending in a jump, its
+// operands come before the jump offset
+static int fusedJumpInstruction(const char *name, Chunk *chunk, int offset,
+                                bool registers) {
+  printf(" %-16s", name);
+  if (registers) {
+    printRegister(chunk, chunk->code[offset + 1]);
+    printRegister(chunk, chunk->code[offset + 2]);
+  } else {
+    printf(" L%d K%d '", chunk->code[offset + 1], chunk->code[offset + 2]);
+    printValue(chunk->constants.values[chunk->code[offset + 2]]);
+    printf("'");
+  }
+
+  uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+  jump |= chunk->code[offset + 4];
+  printf(" -> %d\n", offset + 5 + jump);
+  return offset + 5;
+}
+
 static int jumpInstruction(const char *name, int sign, Chunk *chunk,
                            int offset) {
   uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
@@ -76,11 +139,17 @@ int dissassembleInstruction(Chunk *chunk, int offset) {
   case OP_POP:
     return simpleInstruction("OP_POP", offset);
   case OP_DEFINE_GLOBAL:
-    return simpleInstruction("OP_DEFINE_GLOBAL", offset);
+    return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
   case OP_GET_GLOBAL:
     return constantInstruction("OP_GET_GLOBAL", chunk, offset);
   case OP_SET_GLOBAL:
     return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+  case OP_GET_GLOBAL_SLOT:
+    return globalInstruction("OP_GET_GLOBAL_SLOT", chunk, offset);
+  case OP_SET_GLOBAL_SLOT:
+    return globalInstruction("OP_SET_GLOBAL_SLOT", chunk, offset);
+  case OP_DEFINE_GLOBAL_SLOT:
+    return globalInstruction("OP_DEFINE_GLOBAL_SLOT", chunk, offset);
   case OP_GET_LOCAL:
     return byteInstruction("OP_GET_LOCAL", chunk, offset);
   case OP_SET_LOCAL:
@@ -91,6 +160,77 @@ int dissassembleInstruction(Chunk *chunk, int offset) {
     return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
   case OP_LOOP:
     return jumpInstruction("OP_LOOP", -1, chunk, offset);
+  case OP_ADD_RK:
+    return registerInstruction("OP_ADD_RK", chunk, offset);
+  case OP_SUBSTRACT_RK:
+    return registerInstruction("OP_SUBSTRACT_RK", chunk, offset);
+  case OP_MULTIPLY_RK:
+    return registerInstruction("OP_MULTIPLY_RK", chunk, offset);
+  case OP_DIVIDE_RK:
+    return registerInstruction("OP_DIVIDE_RK", chunk, offset);
+  case OP_EQUAL_RK:
+    return registerInstruction("OP_EQUAL_RK", chunk, offset);
+  case OP_GREATOR_RK:
+    return registerInstruction("OP_GREATOR_RK", chunk, offset);
+  case OP_LESS_RK:
+    return registerInstruction("OP_LESS_RK", chunk, offset);
+  case OP_ADD_SET:
+    return storeInstruction("OP_ADD_SET", chunk, offset);
+  case OP_SUBSTRACT_SET:
+    return storeInstruction("OP_SUBSTRACT_SET", chunk, offset);
+  case OP_MULTIPLY_SET:
+    return storeInstruction("OP_MULTIPLY_SET", chunk, offset);
+  case OP_DIVIDE_SET:
+    return storeInstruction("OP_DIVIDE_SET", chunk, offset);
+  case OP_MOVE:
+    return moveInstruction("OP_MOVE", chunk, offset);
+  case OP_LESS_LOCAL_CONSTANT_JUMP:
+    return fusedJumpInstruction("OP_LESS_LOCAL_CONSTANT_JUMP", chunk, offset,
+                                false);
+  case OP_ADD_LOCAL_CONSTANT: {
+    uint8_t constant = chunk->code[offset + 2];
+    printf(" %-16s L%d <- L%d K%d '", "OP_ADD_LOCAL_CONSTANT",
+           chunk->code[offset + 3], chunk->code[offset + 1], constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
+  }
+  case OP_LESS_RK_JUMP:
+    return fusedJumpInstruction("OP_LESS_RK_JUMP", chunk, offset, true);
+  case OP_NOT_EQUAL:
+    return simpleInstruction("OP_NOT_EQUAL", offset);
+  case OP_NOT_LESS:
+    return simpleInstruction("OP_NOT_LESS", offset);
+  case OP_NOT_GREATOR:
+    return simpleInstruction("OP_NOT_GREATOR", offset);
+  case OP_SET_GLOBAL_SLOT_POP:
+    return globalInstruction("OP_SET_GLOBAL_SLOT_POP", chunk, offset);
+  case OP_SET_LOCAL_POP:
+    return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+  case OP_ADD_NUM:
+    return simpleInstruction("OP_ADD_NUM", offset);
+  case OP_ADD_STR:
+    return simpleInstruction("OP_ADD_STR", offset);
+  case OP_SUBSTRACT_NUM:
+    return simpleInstruction("OP_SUBSTRACT_NUM", offset);
+  case OP_MULTIPLY_NUM:
+    return simpleInstruction("OP_MULTIPLY_NUM", offset);
+  case OP_DIVIDE_NUM:
+    return simpleInstruction("OP_DIVIDE_NUM", offset);
+  case OP_GREATOR_NUM:
+    return simpleInstruction("OP_GREATOR_NUM", offset);
+  case OP_LESS_NUM:
+    return simpleInstruction("OP_LESS_NUM", offset);
+  case OP_ADD_INT:
+    return simpleInstruction("OP_ADD_INT", offset);
+  case OP_SUBSTRACT_INT:
+    return simpleInstruction("OP_SUBSTRACT_INT", offset);
+  case OP_MULTIPLY_INT:
+    return simpleInstruction("OP_MULTIPLY_INT", offset);
+  case OP_GREATOR_INT:
+    return simpleInstruction("OP_GREATOR_INT", offset);
+  case OP_LESS_INT:
+    return simpleInstruction("OP_LESS_INT", offset);
 
   default:
     return offset + 1;
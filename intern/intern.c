@@ -0,0 +1,304 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../memory/memory.h"
+#include "../virtual_machine/vm.h"
+#include "intern.h"
+
+// Keys and tombstones fill at most this share of a shard's slots
+#define INTERN_MAX_LOAD 0.7
+// A shard whose keys filled less than this share of it before a
+// collection is rebuilt smaller
+#define INTERN_MIN_LOAD 0.25
+#define INTERN_MIN_CAPACITY 16
+// A collection that leaves more than this share of a shard tombstones
+// rebuilds it, rather than have inserts do it while other threads look
+#define INTERN_MAX_TOMBSTONES 0.125
+// Two million random keys at the highest load probe 33 to 37 slots at
+// most. An insert that probes past this many is taken for keys made to
+// collide, and the shard picks a new seed
+#ifndef INTERN_PROBE_LIMIT
+#define INTERN_PROBE_LIMIT 128
+#endif
+
+// Marks a slot whose key was removed. Lookups walk past it, inserts can
+// reuse it. Only a rebuild clears it
+static char tombstone;
+#define TOMBSTONE ((ObjString *)&tombstone)
+
+#define LOAD(slot, field, order) \
+  atomic_load_explicit(&(slot)->field, memory_order_##order)
+#define STORE(slot, field, value, order) \
+  atomic_store_explicit(&(slot)->field, value, memory_order_##order)
+
+void initInternTable(InternTable *table) {
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    InternShard *shard = &table->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    atomic_init(&shard->slots, NULL);
+    shard->count = 0;
+    shard->tombstones = 0;
+    shard->reseeds = 0;
+    shard->reseededAt = 0;
+    shard->retired = NULL;
+  }
+}
+
+// Slots come from the C library and not reallocate(): an insert on one
+// thread must not start a collection or update the heap's counters
+// under another. countInternAllocation counts them atomically instead
+#define SLOTS_BYTES(capacity) \
+  (sizeof(InternSlots) + sizeof(InternSlot) * (size_t)(capacity))
+
+// allocateSlots returns empty slots of capacity
+static InternSlots *allocateSlots(int capacity) {
+  InternSlots *slots = calloc(1, SLOTS_BYTES(capacity));
+  if (slots == NULL)
+    exit(1);
+  countInternAllocation(0, SLOTS_BYTES(capacity));
+  slots->capacity = capacity;
+  return slots;
+}
+
+// freeSlots frees slots no lookup can still be in, or nothing if NULL
+static void freeSlots(InternSlots *slots) {
+  if (slots == NULL)
+    return;
+  countInternAllocation(SLOTS_BYTES(slots->capacity), 0);
+  free(slots);
+}
+
+// freeRetired frees the slots inserts replaced, once no lookup can be
+// in them
+static void freeRetired(InternShard *shard) {
+  while (shard->retired != NULL) {
+    InternSlots *next = shard->retired->nextRetired;
+    freeSlots(shard->retired);
+    shard->retired = next;
+  }
+}
+
+// freeInternTable frees the slots of every shard, leaving the table
+// empty. The strings themselves belong to the heap
+void freeInternTable(InternTable *table) {
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    InternShard *shard = &table->shards[i];
+    freeRetired(shard);
+    freeSlots(atomic_load(&shard->slots));
+    pthread_mutex_destroy(&shard->lock);
+  }
+  initInternTable(table);
+}
+
+// findIn looks for a string with the chars in one version of a shard's
+// slots. It stops at the first empty slot of the probe
+static ObjString *findIn(InternSlots *slots, const char *chars, int length,
+                         uint32_t hash) {
+  uint32_t mask = (uint32_t)slots->capacity - 1;
+  uint32_t index = INTERN_HASH(slots, hash) & mask;
+  for (uint32_t step = 1;; index = (index + step++) & mask) {
+    InternSlot *slot = &slots->slots[index];
+    ObjString *key = LOAD(slot, key, acquire);
+    if (key == NULL)
+      return NULL;
+    if (key != TOMBSTONE && LOAD(slot, hash, relaxed) == hash &&
+        key->length == length && memcmp(key->chars, chars, length) == 0)
+      return key;
+  }
+}
+
+// internFind returns the interned string with the chars, or NULL. It
+// takes no lock, an insert running meanwhile on another thread either
+// published its string before the lookup read the slot or not at all
+ObjString *internFind(InternTable *table, const char *chars, int length,
+                      uint32_t hash) {
+  InternShard *shard = &table->shards[INTERN_SHARD(hash)];
+  InternSlots *slots = atomic_load_explicit(&shard->slots,
+                                            memory_order_acquire);
+  if (slots == NULL)
+    return NULL;
+  return findIn(slots, chars, length, hash);
+}
+
+// publish stores a key in a slot, its hash first
+static void publish(InternSlot *slot, ObjString *key) {
+  STORE(slot, hash, key->hash, relaxed);
+  STORE(slot, key, key, release);
+}
+
+// place puts a key in the first empty slot of its probe, in slots that
+// hold no tombstones
+static void place(InternSlots *slots, ObjString *key) {
+  uint32_t mask = (uint32_t)slots->capacity - 1;
+  uint32_t index = INTERN_HASH(slots, key->hash) & mask;
+  for (uint32_t step = 1; LOAD(&slots->slots[index], key, relaxed) != NULL;)
+    index = (index + step++) & mask;
+  publish(&slots->slots[index], key);
+}
+
+// capacityFor picks the smallest capacity count keys fill at most half
+// of
+static int capacityFor(int count) {
+  int capacity = INTERN_MIN_CAPACITY;
+  while (count > capacity / 2)
+    capacity = GROW_CAPACITY(capacity);
+  return capacity;
+}
+
+// rebuild moves a shard's keys to new slots of capacity, placed by seed,
+// and publishes them. Lookups on other threads may still be reading the
+// old slots unless the caller has them all stopped, so those are retired
+// rather than freed
+static InternSlots *rebuild(InternShard *shard, int capacity, uint64_t seed,
+                            bool retire) {
+  InternSlots *slots = allocateSlots(capacity);
+  slots->seed = seed;
+
+  InternSlots *old = atomic_load_explicit(&shard->slots, memory_order_relaxed);
+  if (old != NULL) {
+    for (int i = 0; i < old->capacity; i++) {
+      ObjString *key = LOAD(&old->slots[i], key, relaxed);
+      if (key != NULL && key != TOMBSTONE)
+        place(slots, key);
+    }
+  }
+  shard->tombstones = 0;
+  atomic_store_explicit(&shard->slots, slots, memory_order_release);
+
+  if (old != NULL && retire) {
+    old->nextRetired = shard->retired;
+    shard->retired = old;
+  } else {
+    freeSlots(old);
+  }
+  return slots;
+}
+
+// internAdd interns a string with its hash set and returns it. If
+// another thread interned an equal string since the caller looked, that
+// one is returned instead and the caller drops its own. Keys whose
+// probe grew past INTERN_PROBE_LIMIT are scattered with a new seed, once
+// per capacity as Table does
+ObjString *internAdd(InternTable *table, ObjString *string) {
+  InternShard *shard = &table->shards[INTERN_SHARD(string->hash)];
+  pthread_mutex_lock(&shard->lock);
+
+  InternSlots *slots = atomic_load_explicit(&shard->slots,
+                                            memory_order_relaxed);
+  if (slots == NULL || shard->count + shard->tombstones + 1 >
+                           slots->capacity * INTERN_MAX_LOAD)
+    slots = rebuild(shard, capacityFor(shard->count + 1),
+                    slots == NULL ? 0 : slots->seed, true);
+
+  // One walk to the end of the probe finds an equal string added since
+  // the caller looked, or else the first slot the string can take
+  uint32_t mask = (uint32_t)slots->capacity - 1;
+  uint32_t index = INTERN_HASH(slots, string->hash) & mask;
+  InternSlot *reuse = NULL;
+  int probe = 1;
+  for (;; index = (index + probe++) & mask) {
+    InternSlot *slot = &slots->slots[index];
+    ObjString *key = LOAD(slot, key, relaxed);
+    if (key == NULL)
+      break;
+    if (key == TOMBSTONE) {
+      if (reuse == NULL)
+        reuse = slot;
+    } else if (LOAD(slot, hash, relaxed) == string->hash &&
+               key->length == string->length &&
+               memcmp(key->chars, string->chars, string->length) == 0) {
+      pthread_mutex_unlock(&shard->lock);
+      return key;
+    }
+  }
+
+  if (reuse != NULL)
+    shard->tombstones--;
+  else
+    reuse = &slots->slots[index];
+  publish(reuse, string);
+  shard->count++;
+
+  if (probe > INTERN_PROBE_LIMIT && shard->reseededAt != slots->capacity) {
+    shard->reseeds++;
+    shard->reseededAt = slots->capacity;
+    rebuild(shard, slots->capacity, randomSeed(), true);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return string;
+}
+
+// internRemoveWhite removes the strings the collection in progress did
+// not reach, before they are freed. It runs with every other thread that
+// uses the table stopped, so it takes no locks and frees the retired
+// slots. A shard the keys kept mostly empty even before the collection
+// is rebuilt smaller, one left with many tombstones at the same size
+void internRemoveWhite(InternTable *table) {
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    InternShard *shard = &table->shards[i];
+    freeRetired(shard);
+    InternSlots *slots = atomic_load_explicit(&shard->slots,
+                                              memory_order_relaxed);
+    if (slots == NULL)
+      continue;
+
+    int before = shard->count;
+    for (int j = 0; j < slots->capacity; j++) {
+      ObjString *key = LOAD(&slots->slots[j], key, relaxed);
+      if (key != NULL && key != TOMBSTONE && !objectReached((Obj *)key)) {
+        STORE(&slots->slots[j], key, TOMBSTONE, relaxed);
+        shard->count--;
+        shard->tombstones++;
+      }
+    }
+
+    if (slots->capacity > INTERN_MIN_CAPACITY &&
+        before < slots->capacity * INTERN_MIN_LOAD)
+      rebuild(shard, capacityFor(before), slots->seed, false);
+    else if (shard->tombstones > slots->capacity * INTERN_MAX_TOMBSTONES)
+      rebuild(shard, slots->capacity, slots->seed, false);
+  }
+}
+
+// internStats adds up the shards. Probes are counted in slots
+void internStats(InternTable *table, TableStats *stats) {
+  stats->count = 0;
+  stats->tombstones = 0;
+  stats->capacity = 0;
+  stats->averageProbe = 0;
+  stats->longestProbe = 0;
+  stats->reseeds = 0;
+
+  long probes = 0;
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    InternShard *shard = &table->shards[i];
+    stats->count += shard->count;
+    stats->tombstones += shard->tombstones;
+    stats->reseeds += shard->reseeds;
+    InternSlots *slots = atomic_load(&shard->slots);
+    if (slots == NULL)
+      continue;
+
+    stats->capacity += slots->capacity;
+    uint32_t mask = (uint32_t)slots->capacity - 1;
+    for (uint32_t j = 0; j < (uint32_t)slots->capacity; j++) {
+      ObjString *key = LOAD(&slots->slots[j], key, relaxed);
+      if (key == NULL || key == TOMBSTONE)
+        continue;
+
+      uint32_t index = INTERN_HASH(slots, key->hash) & mask;
+      int probe = 1;
+      while (index != j)
+        index = (index + probe++) & mask;
+      probes += probe;
+      if (probe > stats->longestProbe)
+        stats->longestProbe = probe;
+    }
+  }
+  if (stats->count > 0)
+    stats->averageProbe = (double)probes / stats->count;
+}
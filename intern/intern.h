@@ -0,0 +1,68 @@
+#ifndef vm_intern_h
+#define vm_intern_h
+
+#include "../object/object.h"
+#include "../table/table.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// The interned strings are split over 2^INTERN_SHARD_BITS shards by the
+// top bits of their hash, each with a lock of its own
+#define INTERN_SHARD_BITS 5
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+#define INTERN_SHARD(hash) ((uint32_t)(hash) >> (32 - INTERN_SHARD_BITS))
+
+// A slot is written once, its hash before its key. Lookups read the key
+// first and only then the hash
+typedef struct {
+  _Atomic(ObjString *) key; // NULL when empty, or a tombstone
+  _Atomic uint32_t hash;
+} InternSlot;
+
+// The slots of a shard. An insert that has to grow or reseed the shard
+// builds new slots and publishes them whole, the ones they replace stay
+// readable until no lookup can still be in them
+typedef struct InternSlots {
+  int capacity;                    // A power of two
+  uint64_t seed;                   // Mixed into key hashes by INTERN_HASH
+  struct InternSlots *nextRetired; // Replaced slots waiting to be freed
+  InternSlot slots[];
+} InternSlots;
+
+// INTERN_HASH places a key in a shard's slots like TABLE_HASH does in a
+// table, with a multiplier of its own so keys that crowd one do not
+// crowd the other. Probes go on to the slots 1, 3, 6... further
+#define INTERN_HASH(slots, hash)                                         \
+  ((uint32_t)((((uint64_t)(hash) ^ (slots)->seed) * 0xff51afd7ed558ccdull) \
+              >> 32))
+
+typedef struct {
+  // Held by inserts and rebuilds. Each shard gets cache lines of its
+  // own so threads interning into different shards do not share them
+  _Alignas(64) pthread_mutex_t lock;
+  _Atomic(InternSlots *) slots; // NULL until the first insert
+  int count;                    // Live keys
+  int tombstones;               // Removed keys probes still walk past
+  int reseeds;                  // Times a long probe picked a new seed
+  int reseededAt;               // Capacity of the last reseed
+  InternSlots *retired;
+} InternShard;
+
+// The set of interned strings. Lookups take no lock and can run on any
+// number of threads alongside inserts. Equal strings interned at once on
+// two threads still end up as one object, so interned strings can be
+// compared by pointer
+typedef struct {
+  InternShard shards[INTERN_SHARDS];
+} InternTable;
+
+void initInternTable(InternTable *table);
+void freeInternTable(InternTable *table);
+ObjString *internFind(InternTable *table, const char *chars, int length,
+                      uint32_t hash);
+ObjString *internAdd(InternTable *table, ObjString *string);
+void internRemoveWhite(InternTable *table);
+void internStats(InternTable *table, TableStats *stats);
+
+#endif
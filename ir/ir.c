@@ -0,0 +1,719 @@
+#include "ir.h"
+#include "../memory/memory.h"
+#include "../object/object.h"
+#include "../virtual_machine/vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *irOpNames[] = {
+    [IR_PARAM] = "param",
+    [IR_CONSTANT] = "constant",
+    [IR_GET_LOCAL] = "get_local",
+    [IR_SET_LOCAL] = "set_local",
+    [IR_GET_GLOBAL] = "get_global",
+    [IR_SET_GLOBAL] = "set_global",
+    [IR_DEFINE_GLOBAL] = "define_global",
+    [IR_NEGATE] = "negate",
+    [IR_NOT] = "not",
+    [IR_EQUAL] = "equal",
+    [IR_GREATOR] = "greater",
+    [IR_LESS] = "less",
+    [IR_ADD] = "add",
+    [IR_SUBSTRACT] = "subtract",
+    [IR_MULTIPLY] = "multiply",
+    [IR_DIVIDE] = "divide",
+    [IR_PRINT] = "print",
+    [IR_POP] = "pop",
+};
+
+// The instruction each operation lowers to, IR_CONSTANT picks its own
+static const uint8_t irOpcodes[] = {
+    [IR_GET_LOCAL] = OP_GET_LOCAL,
+    [IR_SET_LOCAL] = OP_SET_LOCAL,
+    [IR_GET_GLOBAL] = OP_GET_GLOBAL_SLOT,
+    [IR_SET_GLOBAL] = OP_SET_GLOBAL_SLOT,
+    [IR_DEFINE_GLOBAL] = OP_DEFINE_GLOBAL_SLOT,
+    [IR_NEGATE] = OP_NEGATE,
+    [IR_NOT] = OP_NOT,
+    [IR_EQUAL] = OP_EQUAL,
+    [IR_GREATOR] = OP_GREATOR,
+    [IR_LESS] = OP_LESS,
+    [IR_ADD] = OP_ADD,
+    [IR_SUBSTRACT] = OP_SUBSTRACT,
+    [IR_MULTIPLY] = OP_MULTIPLY,
+    [IR_DIVIDE] = OP_DIVIDE,
+    [IR_PRINT] = OP_PRINT,
+    [IR_POP] = OP_POP,
+};
+
+int irOperandCount(uint8_t op) {
+  switch (op) {
+  case IR_SET_LOCAL:
+  case IR_SET_GLOBAL:
+  case IR_DEFINE_GLOBAL:
+  case IR_NEGATE:
+  case IR_NOT:
+  case IR_PRINT:
+  case IR_POP:
+    return 1;
+  case IR_EQUAL:
+  case IR_GREATOR:
+  case IR_LESS:
+  case IR_ADD:
+  case IR_SUBSTRACT:
+  case IR_MULTIPLY:
+  case IR_DIVIDE:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+bool irIsOperator(uint8_t op) { return op >= IR_NEGATE && op <= IR_DIVIDE; }
+
+uint8_t irOpcode(uint8_t op) { return irOpcodes[op]; }
+
+// -------------------- Building
+
+// addInstruction appends an instruction to the block being built and
+// returns its value
+static int addInstruction(Ir *ir, uint8_t op, int block, int a, int b,
+                          int line) {
+  if (ir->count + 1 > ir->capacity) {
+    int oldCapacity = ir->capacity;
+    ir->capacity = GROW_CAPACITY(oldCapacity);
+    ir->instructions = ARENA_GROW_ARRAY(IrInstruction, ir->instructions,
+                                        oldCapacity, ir->capacity,
+                                        MEM_COMPILER);
+  }
+
+  IrInstruction *instruction = &ir->instructions[ir->count];
+  instruction->op = op;
+  instruction->dead = false;
+  instruction->slot = 0;
+  instruction->block = block;
+  instruction->a = a;
+  instruction->b = b;
+  instruction->source = -1;
+  instruction->line = line;
+  instruction->value = NIL_VAL;
+  return ir->count++;
+}
+
+// jumpTarget returns the offset a jump at offset lands on
+static int jumpTarget(Chunk *chunk, int offset) {
+  uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) |
+                             chunk->code[offset + 2]);
+  if (chunk->code[offset] == OP_LOOP)
+    return offset + 3 - jump;
+  return offset + 3 + jump;
+}
+
+// findLeaders marks the offsets that start a block. Returns false if the
+// chunk has an instruction the IR cannot represent: the register forms
+// and the global instructions that look their name up
+static bool findLeaders(Chunk *chunk, bool *leaders) {
+  memset(leaders, 0, sizeof(bool) * (chunk->count + 1));
+  leaders[0] = true;
+
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t instruction = chunk->code[offset];
+    int next = offset + instructionLength(instruction);
+    switch (instruction) {
+    case OP_JUMP:
+    case OP_LOOP:
+    case OP_JUMP_IF_FALSE:
+      leaders[jumpTarget(chunk, offset)] = true;
+      leaders[next] = true;
+      break;
+    case OP_RETURN:
+      leaders[next] = true;
+      break;
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_GLOBAL_SLOT:
+    case OP_SET_GLOBAL_SLOT:
+    case OP_DEFINE_GLOBAL_SLOT:
+    case OP_NEGATE:
+    case OP_NOT:
+    case OP_EQUAL:
+    case OP_GREATOR:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBSTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_PRINT:
+    case OP_POP:
+      break;
+    default:
+      return false;
+    }
+    offset = next;
+  }
+  return true;
+}
+
+// operatorFor returns the IR operation of a stack operator instruction
+static uint8_t operatorFor(uint8_t instruction) {
+  for (uint8_t op = IR_NEGATE; op <= IR_DIVIDE; op++)
+    if (irOpcodes[op] == instruction)
+      return op;
+  return IR_POP;
+}
+
+// buildBlock turns the code of a block into instructions, tracking the
+// value in each stack slot instead of pushing and popping, and works out
+// how the block ends
+static void buildBlock(Ir *ir, int index, int end, int *stack,
+                       const int *blockAt) {
+  Chunk *chunk = ir->chunk;
+  IrBlock *block = &ir->blocks[index];
+  block->start = ir->count;
+  block->reachable = true;
+
+  int depth = 0;
+  for (; depth < block->depth; depth++) {
+    stack[depth] = addInstruction(ir, IR_PARAM, index, -1, -1,
+                                  chunk->lines[block->offset]);
+    ir->instructions[stack[depth]].slot = (uint8_t)depth;
+  }
+
+  block->terminator = IR_FALLTHROUGH;
+  block->next = end < chunk->count ? blockAt[end] : -1;
+  block->target = -1;
+  block->condition = -1;
+  block->line = chunk->lines[block->offset];
+
+  for (int offset = block->offset; offset < end;) {
+    uint8_t instruction = chunk->code[offset];
+    uint8_t operand =
+        instructionLength(instruction) > 1 ? chunk->code[offset + 1] : 0;
+    int line = chunk->lines[offset];
+    int value;
+
+    switch (instruction) {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+      value = addInstruction(ir, IR_CONSTANT, index, -1, -1, line);
+      ir->instructions[value].value =
+          instruction == OP_CONSTANT ? chunk->constants.values[operand]
+          : instruction == OP_NIL    ? NIL_VAL
+                                     : BOOL_VAL(instruction == OP_TRUE);
+      stack[depth++] = value;
+      break;
+    case OP_GET_LOCAL:
+      value = addInstruction(ir, IR_GET_LOCAL, index, -1, -1, line);
+      ir->instructions[value].slot = operand;
+      ir->instructions[value].source = stack[operand];
+      stack[depth++] = value;
+      break;
+    case OP_SET_LOCAL:
+      // The slot takes the value and the copy left on top is the same
+      value = addInstruction(ir, IR_SET_LOCAL, index, stack[depth - 1], -1,
+                             line);
+      ir->instructions[value].slot = operand;
+      ir->instructions[value].source = stack[operand];
+      stack[operand] = value;
+      stack[depth - 1] = value;
+      break;
+    case OP_GET_GLOBAL_SLOT:
+      value = addInstruction(ir, IR_GET_GLOBAL, index, -1, -1, line);
+      ir->instructions[value].slot = operand;
+      stack[depth++] = value;
+      break;
+    case OP_SET_GLOBAL_SLOT:
+      value = addInstruction(ir, IR_SET_GLOBAL, index, stack[depth - 1], -1,
+                             line);
+      ir->instructions[value].slot = operand;
+      stack[depth - 1] = value;
+      break;
+    case OP_DEFINE_GLOBAL_SLOT:
+      value = addInstruction(ir, IR_DEFINE_GLOBAL, index, stack[--depth], -1,
+                             line);
+      ir->instructions[value].slot = operand;
+      break;
+    case OP_PRINT:
+      addInstruction(ir, IR_PRINT, index, stack[--depth], -1, line);
+      break;
+    case OP_POP:
+      addInstruction(ir, IR_POP, index, stack[--depth], -1, line);
+      break;
+    case OP_NEGATE:
+    case OP_NOT:
+      stack[depth - 1] = addInstruction(ir, operatorFor(instruction), index,
+                                        stack[depth - 1], -1, line);
+      break;
+    case OP_JUMP:
+    case OP_LOOP:
+      block->terminator = IR_JUMP;
+      block->target = blockAt[jumpTarget(chunk, offset)];
+      block->next = -1;
+      block->line = line;
+      break;
+    case OP_JUMP_IF_FALSE:
+      block->terminator = IR_BRANCH;
+      block->target = blockAt[jumpTarget(chunk, offset)];
+      block->condition = stack[depth - 1];
+      block->line = line;
+      break;
+    case OP_RETURN:
+      block->terminator = IR_RETURN;
+      block->next = -1;
+      block->line = line;
+      break;
+    default:
+      depth--;
+      stack[depth - 1] = addInstruction(ir, operatorFor(instruction), index,
+                                        stack[depth - 1], stack[depth], line);
+      break;
+    }
+    offset += instructionLength(instruction);
+  }
+
+  block->end = ir->count;
+  block->exitDepth = depth;
+  block->exit = ARENA_ALLOCATE(int, depth, MEM_COMPILER);
+  block->exitCapacity = depth;
+  if (depth > 0)
+    memcpy(block->exit, stack, sizeof(int) * depth);
+}
+
+// buildIr builds the IR of a verified chunk. Blocks are built once the
+// stack depth they are entered with is known, starting from the first,
+// so those no path reaches are left empty. Returns false, building
+// nothing, if the chunk has instructions the IR cannot represent
+bool buildIr(Ir *ir, Chunk *chunk) {
+  ir->chunk = chunk;
+  ir->blocks = NULL;
+  ir->blockCount = 0;
+  ir->instructions = NULL;
+  ir->count = 0;
+  ir->capacity = 0;
+
+  bool *leaders = ARENA_ALLOCATE(bool, chunk->count + 1, MEM_COMPILER);
+  if (!findLeaders(chunk, leaders)) {
+    ARENA_FREE_ARRAY(bool, leaders, chunk->count + 1, MEM_COMPILER);
+    return false;
+  }
+
+  int *blockAt = ARENA_ALLOCATE(int, chunk->count + 1, MEM_COMPILER);
+  int *ends = ARENA_ALLOCATE(int, chunk->count + 1, MEM_COMPILER);
+  for (int offset = 0; offset < chunk->count;) {
+    if (leaders[offset]) {
+      if (ir->blockCount > 0)
+        ends[ir->blockCount - 1] = offset;
+      blockAt[offset] = ir->blockCount++;
+    }
+    offset += instructionLength(chunk->code[offset]);
+  }
+  ends[ir->blockCount - 1] = chunk->count;
+
+  ir->blocks = ARENA_ALLOCATE(IrBlock, ir->blockCount, MEM_COMPILER);
+  for (int offset = 0, index = 0; index < ir->blockCount; offset++) {
+    if (offset < chunk->count && leaders[offset] &&
+        blockAt[offset] == index) {
+      IrBlock *block = &ir->blocks[index++];
+      block->offset = offset;
+      block->start = block->end = 0;
+      block->depth = -1;
+      block->exitDepth = 0;
+      block->exit = NULL;
+      block->exitCapacity = 0;
+      block->terminator = IR_RETURN;
+      block->condition = block->target = block->next = -1;
+      block->line = chunk->lines[offset];
+      block->reachable = false;
+    }
+  }
+
+  int *stack = ARENA_ALLOCATE(int, chunk->maxStackDepth + 1, MEM_COMPILER);
+  int *worklist = ARENA_ALLOCATE(int, ir->blockCount, MEM_COMPILER);
+  int worklistCount = 0;
+  ir->blocks[0].depth = 0;
+  worklist[worklistCount++] = 0;
+
+  while (worklistCount > 0) {
+    int index = worklist[--worklistCount];
+    buildBlock(ir, index, ends[index], stack, blockAt);
+
+    IrBlock *block = &ir->blocks[index];
+    int successors[] = {block->next, block->target};
+    for (int i = 0; i < 2; i++) {
+      int successor = successors[i];
+      if (successor != -1 && ir->blocks[successor].depth == -1) {
+        ir->blocks[successor].depth = block->exitDepth;
+        worklist[worklistCount++] = successor;
+      }
+    }
+  }
+
+  ARENA_FREE_ARRAY(int, worklist, ir->blockCount, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, stack, chunk->maxStackDepth + 1, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, ends, chunk->count + 1, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, blockAt, chunk->count + 1, MEM_COMPILER);
+  ARENA_FREE_ARRAY(bool, leaders, chunk->count + 1, MEM_COMPILER);
+  return true;
+}
+
+void freeIr(Ir *ir) {
+  for (int i = 0; i < ir->blockCount; i++)
+    ARENA_FREE_ARRAY(int, ir->blocks[i].exit, ir->blocks[i].exitCapacity,
+                     MEM_COMPILER);
+  ARENA_FREE_ARRAY(IrBlock, ir->blocks, ir->blockCount, MEM_COMPILER);
+  ARENA_FREE_ARRAY(IrInstruction, ir->instructions, ir->capacity,
+                   MEM_COMPILER);
+  ir->blocks = NULL;
+  ir->instructions = NULL;
+  ir->blockCount = ir->count = ir->capacity = 0;
+}
+
+// -------------------- Trees
+
+// Every value but a param or a store is pushed once and popped once, so
+// the operands of an instruction and theirs form a tree. Within a block
+// the code of a tree is contiguous and ends with its root
+
+// irTreeStart returns the first instruction of the tree of a value
+int irTreeStart(Ir *ir, int value) {
+  IrInstruction *instruction = &ir->instructions[value];
+  if (instruction->a == -1)
+    return value;
+  return irTreeStart(ir, instruction->a);
+}
+
+// treeSize counts the instructions of a tree, or returns -1 if it holds
+// one that cannot be removed. Constants and local loads never fail, nor
+// do the comparisons for equality and not, other operators and global
+// loads can be removed only where safe says they cannot fail either
+static int treeSize(Ir *ir, int value, const bool *safe) {
+  IrInstruction *instruction = &ir->instructions[value];
+  switch (instruction->op) {
+  case IR_CONSTANT:
+  case IR_GET_LOCAL:
+    return 1;
+  case IR_NOT:
+  case IR_EQUAL:
+    break;
+  case IR_GET_GLOBAL:
+    return safe != NULL && safe[value] ? 1 : -1;
+  default:
+    if (!irIsOperator(instruction->op) || safe == NULL || !safe[value])
+      return -1;
+    break;
+  }
+
+  int size = 1;
+  int operands[] = {instruction->a, instruction->b};
+  for (int i = 0; i < irOperandCount(instruction->op); i++) {
+    int operandSize = treeSize(ir, operands[i], safe);
+    if (operandSize == -1)
+      return -1;
+    size += operandSize;
+  }
+  return size;
+}
+
+// irRemovable checks if the tree of a value can go without changing
+// what the code does: no instruction in it has an effect or can fail,
+// and nothing else runs between its first instruction and its root
+bool irRemovable(Ir *ir, int value, const bool *safe) {
+  int size = treeSize(ir, value, safe);
+  if (size == -1)
+    return false;
+
+  int live = 0;
+  for (int i = irTreeStart(ir, value); i <= value; i++)
+    live += !ir->instructions[i].dead;
+  return live == size;
+}
+
+// irRemoveTree marks a value and the tree of its operands dead
+void irRemoveTree(Ir *ir, int value) {
+  IrInstruction *instruction = &ir->instructions[value];
+  instruction->dead = true;
+  if (instruction->a != -1)
+    irRemoveTree(ir, instruction->a);
+  if (instruction->b != -1)
+    irRemoveTree(ir, instruction->b);
+}
+
+int liveInstructions(Ir *ir) {
+  int live = 0;
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable)
+      continue;
+    for (int j = block->start; j < block->end; j++)
+      live += !ir->instructions[j].dead &&
+              ir->instructions[j].op != IR_PARAM;
+  }
+  return live;
+}
+
+// -------------------- Lowering
+
+// Jump patched once every block's new offset is known
+typedef struct Fixup {
+  int at;     // Offset of the jump instruction
+  int target; // Block it goes to
+} Fixup;
+
+// irSameValue checks if two constants are one, ints and doubles or -0
+// and 0 stay apart
+bool irSameValue(Value a, Value b) {
+#ifdef VM_NAN_BOXING
+  return a == b;
+#else
+  if (a.type != b.type)
+    return false;
+  switch (a.type) {
+  case VAL_BOOL:
+    return a.as.boolean == b.as.boolean;
+  case VAL_NIL:
+    return true;
+  case VAL_NUMBER:
+    return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+  case VAL_INT:
+    return a.as.integer == b.as.integer;
+  case VAL_OBJ:
+    return a.as.obj == b.as.obj;
+  default:
+    return false;
+  }
+#endif
+}
+
+// lowerConstant emits a constant load, sharing pool entries between
+// equal constants. Returns false if the pool is full
+static bool lowerConstant(Chunk *lowered, Value value, int line) {
+  if (IS_NIL(value) || IS_BOOL(value)) {
+    uint8_t instruction = IS_NIL(value)   ? OP_NIL
+                          : AS_BOOL(value) ? OP_TRUE
+                                           : OP_FALSE;
+    writeChunk(lowered, instruction, line);
+    return true;
+  }
+
+  int constant = 0;
+  while (constant < lowered->constants.count &&
+         !irSameValue(lowered->constants.values[constant], value))
+    constant++;
+  if (constant > UINT8_MAX)
+    return false;
+  if (constant == lowered->constants.count)
+    addConstant(lowered, value);
+
+  writeChunk(lowered, OP_CONSTANT, line);
+  writeChunk(lowered, (uint8_t)constant, line);
+  return true;
+}
+
+// lowerJump emits a jump to a block with its operand left to patch
+static void lowerJump(Chunk *lowered, uint8_t instruction, int target,
+                      int line, Fixup *fixups, int *fixupCount) {
+  fixups[(*fixupCount)++] = (Fixup){lowered->count, target};
+  writeChunk(lowered, instruction, line);
+  writeChunk(lowered, 0xff, line);
+  writeChunk(lowered, 0xff, line);
+}
+
+// lowerBlock emits the live instructions of a block and its way out.
+// following is the block emitted next, jumps to it are left out
+static bool lowerBlock(Ir *ir, IrBlock *block, int following,
+                       Chunk *lowered, Fixup *fixups, int *fixupCount) {
+  for (int i = block->start; i < block->end; i++) {
+    IrInstruction *instruction = &ir->instructions[i];
+    if (instruction->dead || instruction->op == IR_PARAM)
+      continue;
+
+    if (instruction->op == IR_CONSTANT) {
+      if (!lowerConstant(lowered, instruction->value, instruction->line))
+        return false;
+      continue;
+    }
+
+    writeChunk(lowered, irOpcodes[instruction->op], instruction->line);
+    switch (instruction->op) {
+    case IR_GET_LOCAL:
+    case IR_SET_LOCAL:
+    case IR_GET_GLOBAL:
+    case IR_SET_GLOBAL:
+    case IR_DEFINE_GLOBAL:
+      writeChunk(lowered, instruction->slot, instruction->line);
+      break;
+    default:
+      break;
+    }
+  }
+
+  switch (block->terminator) {
+  case IR_RETURN:
+    writeChunk(lowered, OP_RETURN, block->line);
+    break;
+  case IR_BRANCH:
+    lowerJump(lowered, OP_JUMP_IF_FALSE, block->target, block->line, fixups,
+              fixupCount);
+    if (block->next != following)
+      lowerJump(lowered, OP_JUMP, block->next, block->line, fixups,
+                fixupCount);
+    break;
+  case IR_JUMP:
+    if (block->target != following)
+      lowerJump(lowered, OP_JUMP, block->target, block->line, fixups,
+                fixupCount);
+    break;
+  case IR_FALLTHROUGH:
+    if (block->next != following)
+      lowerJump(lowered, OP_JUMP, block->next, block->line, fixups,
+                fixupCount);
+    break;
+  }
+  return true;
+}
+
+// lowerIr replaces the code and constants of the chunk the IR was built
+// from with those of the reachable blocks, in their original order.
+// Jumps back become loops and jumps to the block that follows are left
+// out. Returns false, leaving the chunk as it was, if the constants or a
+// jump no longer fit their operands
+bool lowerIr(Ir *ir) {
+  Chunk lowered;
+  initChunk(&lowered);
+  int *starts = ARENA_ALLOCATE(int, ir->blockCount, MEM_COMPILER);
+  Fixup *fixups = ARENA_ALLOCATE(Fixup, ir->blockCount * 2, MEM_COMPILER);
+  int fixupCount = 0;
+  bool lowerable = true;
+
+  for (int i = 0; lowerable && i < ir->blockCount; i++) {
+    if (!ir->blocks[i].reachable)
+      continue;
+
+    int following = i + 1;
+    while (following < ir->blockCount && !ir->blocks[following].reachable)
+      following++;
+    starts[i] = lowered.count;
+    lowerable = lowerBlock(ir, &ir->blocks[i], following, &lowered, fixups,
+                           &fixupCount);
+  }
+
+  for (int i = 0; lowerable && i < fixupCount; i++) {
+    Fixup *fixup = &fixups[i];
+    int end = fixup->at + 3;
+    int jump = starts[fixup->target] - end;
+    if (jump < 0) {
+      // Only the unconditional jumps can go back
+      lowerable = lowered.code[fixup->at] == OP_JUMP;
+      lowered.code[fixup->at] = OP_LOOP;
+      jump = -jump;
+    }
+    if (jump > UINT16_MAX)
+      lowerable = false;
+    lowered.code[fixup->at + 1] = (jump >> 8) & 0xff;
+    lowered.code[fixup->at + 2] = jump & 0xff;
+  }
+
+  ARENA_FREE_ARRAY(int, starts, ir->blockCount, MEM_COMPILER);
+  ARENA_FREE_ARRAY(Fixup, fixups, ir->blockCount * 2, MEM_COMPILER);
+  if (!lowerable) {
+    freeChunk(&lowered);
+    return false;
+  }
+
+  freeChunk(ir->chunk);
+  *ir->chunk = lowered;
+  return true;
+}
+
+// -------------------- Printing
+
+// printValueTo prints a constant the way printValue() would, without
+// the newline
+static void printValueTo(Value value, FILE *out) {
+  if (IS_NIL(value))
+    fprintf(out, "nil");
+  else if (IS_BOOL(value))
+    fprintf(out, AS_BOOL(value) ? "true" : "false");
+  else if (IS_INT(value))
+    fprintf(out, "%d", AS_INT(value));
+  else if (IS_NUMBER(value))
+    fprintf(out, "%g", AS_NUMBER(value));
+  else if (IS_STRING(value))
+    fprintf(out, "\"%s\"", flatString(AS_OBJ(value))->chars);
+}
+
+// printIr writes the live IR. Each block lists its params, each jump
+// the values it passes to them
+void printIr(Ir *ir, const char *title, FILE *out) {
+  fprintf(out, "== ir %s ==\n", title);
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable)
+      continue;
+
+    fprintf(out, "b%d (offset %d):", i, block->offset);
+    for (int j = block->start; j < block->end; j++)
+      if (ir->instructions[j].op == IR_PARAM && !ir->instructions[j].dead)
+        fprintf(out, " v%d", j);
+    fprintf(out, "\n");
+
+    for (int j = block->start; j < block->end; j++) {
+      IrInstruction *instruction = &ir->instructions[j];
+      if (instruction->dead || instruction->op == IR_PARAM)
+        continue;
+
+      fprintf(out, "  v%-4d = %s", j, irOpNames[instruction->op]);
+      switch (instruction->op) {
+      case IR_CONSTANT:
+        fprintf(out, " ");
+        printValueTo(instruction->value, out);
+        break;
+      case IR_GET_LOCAL:
+      case IR_SET_LOCAL:
+        fprintf(out, " [%d] of v%d", instruction->slot, instruction->source);
+        break;
+      case IR_GET_GLOBAL:
+      case IR_SET_GLOBAL:
+      case IR_DEFINE_GLOBAL:
+        fprintf(out, " %s", vm.globalSlots[instruction->slot].name->chars);
+        break;
+      default:
+        break;
+      }
+      if (instruction->a != -1)
+        fprintf(out, " v%d", instruction->a);
+      if (instruction->b != -1)
+        fprintf(out, " v%d", instruction->b);
+      fprintf(out, "\n");
+    }
+
+    switch (block->terminator) {
+    case IR_RETURN:
+      fprintf(out, "  return\n");
+      continue;
+    case IR_BRANCH:
+      fprintf(out, "  branch v%d b%d else b%d", block->condition, block->next,
+              block->target);
+      break;
+    case IR_JUMP:
+      fprintf(out, "  jump b%d", block->target);
+      break;
+    case IR_FALLTHROUGH:
+      fprintf(out, "  fallthrough b%d", block->next);
+      break;
+    }
+    fprintf(out, " (");
+    for (int j = 0; j < block->exitDepth; j++)
+      fprintf(out, j == 0 ? "v%d" : " v%d", block->exit[j]);
+    fprintf(out, ")\n");
+  }
+}
@@ -0,0 +1,105 @@
+#ifndef vm_ir_h
+#define vm_ir_h
+
+#include "../chunk/chunk.h"
+#include "../value/value.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Operations of the IR. Each instruction defines one value, named by its
+// index, and names the values it takes instead of popping them. The
+// operators and stores keep the stack semantics of their opcode
+typedef enum {
+  IR_PARAM,    // A stack slot's value on entry to the block
+  IR_CONSTANT, // Also nil, true and false
+  IR_GET_LOCAL,
+  IR_SET_LOCAL,
+  IR_GET_GLOBAL,
+  IR_SET_GLOBAL,
+  IR_DEFINE_GLOBAL,
+  IR_NEGATE,
+  IR_NOT,
+  IR_EQUAL,
+  IR_GREATOR,
+  IR_LESS,
+  IR_ADD,
+  IR_SUBSTRACT,
+  IR_MULTIPLY,
+  IR_DIVIDE,
+  IR_PRINT,
+  IR_POP,
+} IrOp;
+
+typedef struct {
+  uint8_t op;
+  bool dead; // Removed by a pass, lowering skips it
+  uint8_t slot; // Stack slot of a param or local, or the global slot
+  int block;
+  int a, b; // Operands in stack order, -1 when unused
+  // The value a local slot held when IR_GET_LOCAL read it or IR_SET_LOCAL
+  // wrote it. Reading a slot does not consume its value, so this is not
+  // an operand
+  int source;
+  int line;
+  Value value; // Of an IR_CONSTANT
+} IrInstruction;
+
+// How a block ends. A branch peeks at its condition, the value stays on
+// the stack for both successors to pop
+typedef enum {
+  IR_FALLTHROUGH,
+  IR_JUMP,
+  IR_BRANCH, // To target when the condition is falsey, else to next
+  IR_RETURN,
+} IrTerminator;
+
+// A basic block in SSA-like form: its params stand for the stack it is
+// entered with and every predecessor passes the values of its exit stack
+// in their place, the way phis would. Instructions are the range from
+// start to end, params first
+typedef struct {
+  int offset; // Of its first instruction in the chunk it was built from
+  int start;
+  int end;
+  int depth;     // Params, the stack slots on entry
+  int exitDepth; // Stack slots on exit
+  int *exit;     // Value in each stack slot on exit
+  int exitCapacity;
+  uint8_t terminator;
+  int condition; // Value a branch tests
+  int target;    // Block a jump or a falsey branch goes to
+  int next;      // Block a fallthrough or truthy branch goes to
+  int line;      // Of the terminator
+  bool reachable;
+} IrBlock;
+
+// The IR of a chunk, blocks in the order of the code they came from
+typedef struct {
+  Chunk *chunk;
+  IrBlock *blocks;
+  int blockCount;
+  IrInstruction *instructions;
+  int count;
+  int capacity;
+} Ir;
+
+bool buildIr(Ir *ir, Chunk *chunk);
+bool lowerIr(Ir *ir);
+void freeIr(Ir *ir);
+void printIr(Ir *ir, const char *title, FILE *out);
+int liveInstructions(Ir *ir);
+
+// irOperandCount is how many values an instruction takes
+int irOperandCount(uint8_t op);
+// irIsOperator checks for the operators, their value depends only on
+// their operands
+bool irIsOperator(uint8_t op);
+// irOpcode is the instruction an operator lowers to
+uint8_t irOpcode(uint8_t op);
+bool irSameValue(Value a, Value b);
+bool irRemovable(Ir *ir, int value, const bool *safe);
+int irTreeStart(Ir *ir, int value);
+void irRemoveTree(Ir *ir, int value);
+
+#endif
@@ -0,0 +1,604 @@
+#include "jit.h"
+#include "../object/object.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The native backend needs x86-64, mmap and the tagged union Value its
+// stencils were written against, everywhere else every chunk falls back
+// to run()
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) &&     \
+    !defined(VM_NAN_BOXING)
+#define JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+bool jitEnabled = false;
+bool jitVerbose = false;
+JitStats jitStats;
+
+// reject reports a chunk that runs in the interpreter instead
+static bool reject(const char *reason, int offset) {
+  jitStats.chunksInterpreted++;
+  if (jitVerbose)
+    fprintf(stderr, "jit: chunk %d runs in the interpreter, %s at offset %d\n",
+            jitStats.chunksCompiled + jitStats.chunksInterpreted, reason,
+            offset);
+  return false;
+}
+
+#ifdef JIT_X86_64
+
+// The inline stencils address values as a 4 byte tag followed by the
+// payload at offset 8
+_Static_assert(sizeof(Value) == 16 && sizeof(ValueType) == 4 &&
+                   offsetof(Value, as) == 8,
+               "the x86-64 stencils need the tagged union layout of Value");
+
+// Helpers do the work of the instructions the stencils do not inline, and
+// the slow paths of those they do. operand is decoded at compile time, ip
+// is the address of the next instruction for runtime errors. A helper
+// returns true when it reported a runtime error
+typedef bool (*JitHelper)(void *operand, uint8_t *ip);
+
+#define JIT_ERROR(ip, ...) (vm.ip = (ip), runtimeError(__VA_ARGS__), true)
+
+static bool jitNil(void *operand, uint8_t *ip) {
+  (void)operand;
+  (void)ip;
+  push(NIL_VAL);
+  return false;
+}
+
+static bool jitTrue(void *operand, uint8_t *ip) {
+  (void)operand;
+  (void)ip;
+  push(BOOL_VAL(true));
+  return false;
+}
+
+static bool jitFalse(void *operand, uint8_t *ip) {
+  (void)operand;
+  (void)ip;
+  push(BOOL_VAL(false));
+  return false;
+}
+
+static bool jitPrint(void *operand, uint8_t *ip) {
+  (void)operand;
+  (void)ip;
+  printValue(pop());
+  return false;
+}
+
+static bool jitNot(void *operand, uint8_t *ip) {
+  (void)operand;
+  (void)ip;
+  push(BOOL_VAL(isFalsey(pop())));
+  return false;
+}
+
+static bool jitEqual(void *operand, uint8_t *ip) {
+  (void)operand;
+  (void)ip;
+  Value b = pop();
+  Value a = pop();
+  push(BOOL_VAL(valueEquals(a, b)));
+  return false;
+}
+
+static bool jitNegate(void *operand, uint8_t *ip) {
+  (void)operand;
+  Value value = pop();
+  if (!IS_NUMBER(value))
+    return JIT_ERROR(ip, "Operand must be a number for negation");
+  push(NUMBER_VAL(-AS_NUMBER(value)));
+  return false;
+}
+
+static bool jitAdd(void *operand, uint8_t *ip) {
+  (void)operand;
+  Value b = vm.stackTop[-1];
+  Value a = vm.stackTop[-2];
+  if (IS_STRING(a) && IS_STRING(b)) {
+    concatnate();
+  } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    vm.stackTop -= 2;
+    push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+  } else {
+    return JIT_ERROR(ip, "Operands must be numbers or two strings");
+  }
+  return false;
+}
+
+#define JIT_BINARY_OP(name, valueType, op)                                     \
+  static bool name(void *operand, uint8_t *ip) {                               \
+    (void)operand;                                                             \
+    Value b = vm.stackTop[-1];                                                 \
+    Value a = vm.stackTop[-2];                                                 \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))                                        \
+      return JIT_ERROR(ip, "Operands must be numbers for binary operations");  \
+    vm.stackTop -= 2;                                                          \
+    push(valueType(AS_NUMBER(a) op AS_NUMBER(b)));                             \
+    return false;                                                              \
+  }
+
+JIT_BINARY_OP(jitSubstract, NUMBER_VAL, -)
+JIT_BINARY_OP(jitMultiply, NUMBER_VAL, *)
+JIT_BINARY_OP(jitDivide, NUMBER_VAL, /)
+JIT_BINARY_OP(jitGreator, BOOL_VAL, >)
+JIT_BINARY_OP(jitLess, BOOL_VAL, <)
+
+#undef JIT_BINARY_OP
+
+static bool jitDefineGlobal(void *operand, uint8_t *ip) {
+  (void)ip;
+  GlobalSlot *global = (GlobalSlot *)operand;
+  global->value = pop();
+  global->defined = true;
+  return false;
+}
+
+static bool jitGetGlobal(void *operand, uint8_t *ip) {
+  GlobalSlot *global = (GlobalSlot *)operand;
+  if (!global->defined)
+    return JIT_ERROR(ip, "Undefined variable %s \n", global->name->chars);
+  push(global->value);
+  return false;
+}
+
+static bool jitSetGlobal(void *operand, uint8_t *ip) {
+  GlobalSlot *global = (GlobalSlot *)operand;
+  if (!global->defined)
+    return JIT_ERROR(ip, "Undefined variable '%s'", global->name->chars);
+  global->value = vm.stackTop[-1];
+  return false;
+}
+
+#undef JIT_ERROR
+
+// Machine code templates, one per supported opcode. Each is copied as is
+// and its holes patched with the instruction's operands. The native code
+// keeps vm.stackTop in rbx and &vm.stackTop in r12, writing rbx back
+// around every helper call so both sides see the same stack
+typedef enum {
+  STENCIL_NONE, // The opcode is not supported
+  STENCIL_CALL,
+  STENCIL_CALL_CHECKED,
+  STENCIL_PUSH,
+  STENCIL_STORE,
+  STENCIL_POP,
+  STENCIL_JUMP_IF_FALSE,
+  STENCIL_ADD,
+  STENCIL_SUBSTRACT,
+  STENCIL_MULTIPLY,
+  STENCIL_DIVIDE,
+  STENCIL_GREATOR,
+  STENCIL_LESS,
+  STENCIL_JUMP,
+  STENCIL_EXIT,
+  STENCIL_ERROR_EXIT,
+  STENCIL_ENTER,
+} StencilKind;
+
+typedef enum {
+  HOLE_NONE,
+  HOLE_OPERAND,    // imm64, the decoded operand
+  HOLE_IP,         // imm64, address of the next instruction
+  HOLE_HELPER,     // imm64, address of the helper
+  HOLE_STACK_TOP,  // imm64, &vm.stackTop
+  HOLE_TARGET,     // rel32, the jump target
+  HOLE_ERROR,      // rel32, the error exit
+  HOLE_STATUS,     // imm32, the result returned to interpret()
+  HOLE_BOOL_TAG,   // imm32, VAL_BOOL
+  HOLE_NUMBER_TAG, // imm32, VAL_NUMBER
+} HoleKind;
+
+typedef struct {
+  HoleKind kind;
+  int offset;
+} Hole;
+
+#define STENCIL_HOLES_MAX 8
+
+typedef struct {
+  const uint8_t *code;
+  int length;
+  Hole holes[STENCIL_HOLES_MAX];
+} Stencil;
+
+#define HOLE32 0, 0, 0, 0
+#define HOLE64 HOLE32, HOLE32
+
+// mov [r12], rbx; mov rdi, operand; mov rsi, ip; mov rax, helper;
+// call rax; mov rbx, [r12]; test al, al; jnz error
+#define CALL_CHECKED_CODE                                                      \
+  0x49, 0x89, 0x1c, 0x24, 0x48, 0xbf, HOLE64, 0x48, 0xbe, HOLE64, 0x48, 0xb8,  \
+      HOLE64, 0xff, 0xd0, 0x49, 0x8b, 0x1c, 0x24, 0x84, 0xc0, 0x0f, 0x85,      \
+      HOLE32
+#define CALL_CHECKED_LENGTH 48
+#define CALL_CHECKED_HOLES(at)                                                 \
+  {HOLE_OPERAND, (at) + 6}, {HOLE_IP, (at) + 16}, {HOLE_HELPER, (at) + 26},    \
+      {HOLE_ERROR, (at) + 44}
+
+// cmp dword [rbx - 16], VAL_NUMBER; jne slow;
+// cmp dword [rbx - 32], VAL_NUMBER; jne slow
+#define NUMBER_GUARD_CODE(slow)                                                \
+  0x81, 0x7b, 0xf0, HOLE32, 0x75, (slow)-9, 0x81, 0x7b, 0xe0, HOLE32, 0x75,    \
+      (slow)-18
+#define NUMBER_GUARD_HOLES {HOLE_NUMBER_TAG, 3}, {HOLE_NUMBER_TAG, 12}
+
+// Both operands numbers: movsd xmm0, [rbx - 24]; <op>sd xmm0, [rbx - 8];
+// movsd [rbx - 24], xmm0; sub rbx, 16; jmp done. Otherwise the helper
+// handles strings and errors
+#define ARITHMETIC_CODE(sseOp)                                                 \
+  {NUMBER_GUARD_CODE(39), 0xf2, 0x0f, 0x10, 0x43, 0xe8, 0xf2, 0x0f, (sseOp),   \
+   0x43, 0xf8, 0xf2, 0x0f, 0x11, 0x43, 0xe8, 0x48, 0x83, 0xeb, 0x10, 0xeb,     \
+   CALL_CHECKED_LENGTH, CALL_CHECKED_CODE}
+#define ARITHMETIC_HOLES {NUMBER_GUARD_HOLES, CALL_CHECKED_HOLES(39)}
+
+// Both operands numbers: movsd xmm0, [rbx + first];
+// comisd xmm0, [rbx + second]; seta al; mov qword [rbx - 32], VAL_BOOL;
+// mov [rbx - 24], al; sub rbx, 16; jmp done. seta is false for unordered
+// operands, so a < b is tested as b > a to keep NaN comparisons false
+#define COMPARISON_CODE(first, second)                                         \
+  {NUMBER_GUARD_CODE(48), 0xf2, 0x0f, 0x10, 0x43, (first), 0x66, 0x0f, 0x2f,   \
+   0x43, (second), 0x0f, 0x97, 0xc0, 0x48, 0xc7, 0x43, 0xe0, HOLE32, 0x88,     \
+   0x43, 0xe8, 0x48, 0x83, 0xeb, 0x10, 0xeb, CALL_CHECKED_LENGTH,              \
+   CALL_CHECKED_CODE}
+#define COMPARISON_HOLES                                                       \
+  {NUMBER_GUARD_HOLES, {HOLE_BOOL_TAG, 35}, CALL_CHECKED_HOLES(48)}
+
+// mov [r12], rbx; mov rdi, operand; mov rax, helper; call rax;
+// mov rbx, [r12]
+static const uint8_t callCode[] = {0x49, 0x89, 0x1c, 0x24, 0x48, 0xbf,
+                                   HOLE64, 0x48, 0xb8, HOLE64, 0xff, 0xd0,
+                                   0x49, 0x8b, 0x1c, 0x24};
+static const uint8_t callCheckedCode[] = {CALL_CHECKED_CODE};
+// Values are copied as two quadwords, matching the stores that wrote
+// them so loads forward from the store buffer
+// mov rax, operand; mov rcx, [rax]; mov rdx, [rax + 8]; mov [rbx], rcx;
+// mov [rbx + 8], rdx; add rbx, 16
+static const uint8_t pushCode[] = {0x48, 0xb8, HOLE64, 0x48, 0x8b, 0x08,
+                                   0x48, 0x8b, 0x50, 0x08, 0x48, 0x89,
+                                   0x0b, 0x48, 0x89, 0x53, 0x08, 0x48,
+                                   0x83, 0xc3, 0x10};
+// mov rcx, [rbx - 16]; mov rdx, [rbx - 8]; mov rax, operand;
+// mov [rax], rcx; mov [rax + 8], rdx
+static const uint8_t storeCode[] = {0x48, 0x8b, 0x4b, 0xf0, 0x48, 0x8b, 0x53,
+                                    0xf8, 0x48, 0xb8, HOLE64, 0x48, 0x89,
+                                    0x08, 0x48, 0x89, 0x50, 0x08};
+// sub rbx, 16
+static const uint8_t popCode[] = {0x48, 0x83, 0xeb, 0x10};
+// cmp dword [rbx - 16], VAL_BOOL; jne skip; cmp byte [rbx - 8], 0;
+// je target; skip:
+static const uint8_t jumpIfFalseCode[] = {0x81, 0x7b, 0xf0, HOLE32, 0x75,
+                                          0x0a, 0x80, 0x7b, 0xf8, 0x00,
+                                          0x0f, 0x84, HOLE32};
+static const uint8_t addCode[] = ARITHMETIC_CODE(0x58);
+static const uint8_t substractCode[] = ARITHMETIC_CODE(0x5c);
+static const uint8_t multiplyCode[] = ARITHMETIC_CODE(0x59);
+static const uint8_t divideCode[] = ARITHMETIC_CODE(0x5e);
+static const uint8_t greatorCode[] = COMPARISON_CODE(0xe8, 0xf8);
+static const uint8_t lessCode[] = COMPARISON_CODE(0xf8, 0xe8);
+// jmp target
+static const uint8_t jumpCode[] = {0xe9, HOLE32};
+// mov [r12], rbx; mov eax, status; add rsp, 8; pop r12; pop rbx; ret
+static const uint8_t exitCode[] = {0x49, 0x89, 0x1c, 0x24, 0xb8, HOLE32,
+                                   0x48, 0x83, 0xc4, 0x08, 0x41, 0x5c,
+                                   0x5b, 0xc3};
+// The same without the write back, runtimeError() reset the stack
+static const uint8_t errorExitCode[] = {0xb8, HOLE32, 0x48, 0x83, 0xc4,
+                                        0x08, 0x41, 0x5c, 0x5b, 0xc3};
+// push rbx; push r12; sub rsp, 8; mov r12, &vm.stackTop; mov rbx, [r12].
+// The pushes and the sub keep the stack 16 byte aligned for helper calls
+static const uint8_t enterCode[] = {0x53, 0x41, 0x54, 0x48, 0x83, 0xec,
+                                    0x08, 0x49, 0xbc, HOLE64, 0x49, 0x8b,
+                                    0x1c, 0x24};
+
+static const Stencil stencils[] = {
+    [STENCIL_CALL] = {callCode,
+                      sizeof(callCode),
+                      {{HOLE_OPERAND, 6}, {HOLE_HELPER, 16}}},
+    [STENCIL_CALL_CHECKED] = {callCheckedCode, sizeof(callCheckedCode),
+                              {CALL_CHECKED_HOLES(0)}},
+    [STENCIL_PUSH] = {pushCode, sizeof(pushCode), {{HOLE_OPERAND, 2}}},
+    [STENCIL_STORE] = {storeCode, sizeof(storeCode), {{HOLE_OPERAND, 10}}},
+    [STENCIL_POP] = {popCode, sizeof(popCode), {{HOLE_NONE, 0}}},
+    [STENCIL_JUMP_IF_FALSE] = {jumpIfFalseCode,
+                               sizeof(jumpIfFalseCode),
+                               {{HOLE_BOOL_TAG, 3}, {HOLE_TARGET, 15}}},
+    [STENCIL_ADD] = {addCode, sizeof(addCode), ARITHMETIC_HOLES},
+    [STENCIL_SUBSTRACT] = {substractCode, sizeof(substractCode),
+                           ARITHMETIC_HOLES},
+    [STENCIL_MULTIPLY] = {multiplyCode, sizeof(multiplyCode),
+                          ARITHMETIC_HOLES},
+    [STENCIL_DIVIDE] = {divideCode, sizeof(divideCode), ARITHMETIC_HOLES},
+    [STENCIL_GREATOR] = {greatorCode, sizeof(greatorCode), COMPARISON_HOLES},
+    [STENCIL_LESS] = {lessCode, sizeof(lessCode), COMPARISON_HOLES},
+    [STENCIL_JUMP] = {jumpCode, sizeof(jumpCode), {{HOLE_TARGET, 1}}},
+    [STENCIL_EXIT] = {exitCode, sizeof(exitCode), {{HOLE_STATUS, 5}}},
+    [STENCIL_ERROR_EXIT] = {errorExitCode,
+                            sizeof(errorExitCode),
+                            {{HOLE_STATUS, 1}}},
+    [STENCIL_ENTER] = {enterCode, sizeof(enterCode), {{HOLE_STACK_TOP, 9}}},
+};
+
+#undef COMPARISON_HOLES
+#undef COMPARISON_CODE
+#undef ARITHMETIC_HOLES
+#undef ARITHMETIC_CODE
+#undef NUMBER_GUARD_HOLES
+#undef NUMBER_GUARD_CODE
+#undef CALL_CHECKED_HOLES
+#undef CALL_CHECKED_LENGTH
+#undef CALL_CHECKED_CODE
+#undef HOLE64
+#undef HOLE32
+
+// How a helper's operand is decoded from the instruction's operand byte
+typedef enum {
+  OPERAND_NONE,
+  OPERAND_CONSTANT, // Address of the constant
+  OPERAND_GLOBAL,   // Address of the global's GlobalSlot
+  OPERAND_SLOT,     // Address of the local's stack slot
+} OperandKind;
+
+typedef struct {
+  StencilKind stencil;
+  JitHelper helper; // Does the whole instruction, or its slow path
+  OperandKind operand;
+} JitRule;
+
+// The stack instruction set the compiler emits. Register instructions,
+// superinstructions and the name forms of the global instructions have
+// no rule, chunks using them run in the interpreter
+static const JitRule rules[] = {
+    [OP_CONSTANT] = {STENCIL_PUSH, NULL, OPERAND_CONSTANT},
+    [OP_NEGATE] = {STENCIL_CALL_CHECKED, jitNegate, OPERAND_NONE},
+    [OP_RETURN] = {STENCIL_EXIT, NULL, OPERAND_NONE},
+    [OP_PRINT] = {STENCIL_CALL, jitPrint, OPERAND_NONE},
+    [OP_JUMP_IF_FALSE] = {STENCIL_JUMP_IF_FALSE, NULL, OPERAND_NONE},
+    [OP_JUMP] = {STENCIL_JUMP, NULL, OPERAND_NONE},
+    [OP_LOOP] = {STENCIL_JUMP, NULL, OPERAND_NONE},
+    [OP_NIL] = {STENCIL_CALL, jitNil, OPERAND_NONE},
+    [OP_TRUE] = {STENCIL_CALL, jitTrue, OPERAND_NONE},
+    [OP_FALSE] = {STENCIL_CALL, jitFalse, OPERAND_NONE},
+    [OP_POP] = {STENCIL_POP, NULL, OPERAND_NONE},
+    [OP_GET_GLOBAL_SLOT] = {STENCIL_CALL_CHECKED, jitGetGlobal,
+                            OPERAND_GLOBAL},
+    [OP_SET_GLOBAL_SLOT] = {STENCIL_CALL_CHECKED, jitSetGlobal,
+                            OPERAND_GLOBAL},
+    [OP_DEFINE_GLOBAL_SLOT] = {STENCIL_CALL, jitDefineGlobal, OPERAND_GLOBAL},
+    [OP_GET_LOCAL] = {STENCIL_PUSH, NULL, OPERAND_SLOT},
+    [OP_SET_LOCAL] = {STENCIL_STORE, NULL, OPERAND_SLOT},
+    [OP_EQUAL] = {STENCIL_CALL, jitEqual, OPERAND_NONE},
+    [OP_GREATOR] = {STENCIL_GREATOR, jitGreator, OPERAND_NONE},
+    [OP_LESS] = {STENCIL_LESS, jitLess, OPERAND_NONE},
+    [OP_ADD] = {STENCIL_ADD, jitAdd, OPERAND_NONE},
+    [OP_SUBSTRACT] = {STENCIL_SUBSTRACT, jitSubstract, OPERAND_NONE},
+    [OP_MULTIPLY] = {STENCIL_MULTIPLY, jitMultiply, OPERAND_NONE},
+    [OP_DIVIDE] = {STENCIL_DIVIDE, jitDivide, OPERAND_NONE},
+    [OP_NOT] = {STENCIL_CALL, jitNot, OPERAND_NONE},
+};
+
+// getRule returns the rule of an opcode, NULL when it is not supported
+static const JitRule *getRule(uint8_t instruction) {
+  if (instruction >= sizeof(rules) / sizeof(rules[0]) ||
+      rules[instruction].stencil == STENCIL_NONE)
+    return NULL;
+  return &rules[instruction];
+}
+
+// A rel32 hole patched once every instruction's native offset is known
+typedef struct {
+  size_t hole;
+  int target; // Bytecode offset, -1 for the error exit
+} Fixup;
+
+static void patch64(uint8_t *at, uint64_t value) {
+  memcpy(at, &value, sizeof(value));
+}
+
+static void patch32(uint8_t *at, int32_t value) {
+  memcpy(at, &value, sizeof(value));
+}
+
+// decodeOperand turns an instruction's operand byte into a helper operand
+static void *decodeOperand(Chunk *chunk, int offset, OperandKind kind) {
+  uint8_t byte = chunk->code[offset + 1];
+  switch (kind) {
+  case OPERAND_CONSTANT:
+    return &chunk->constants.values[byte];
+  case OPERAND_GLOBAL:
+    return &vm.globalSlots[byte];
+  case OPERAND_SLOT:
+    return &vm.stack[byte];
+  default:
+    return NULL;
+  }
+}
+
+// jumpTarget returns the offset a jump instruction at offset lands on
+static int jumpTarget(Chunk *chunk, int offset) {
+  uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) |
+                             chunk->code[offset + 2]);
+  if (chunk->code[offset] == OP_LOOP)
+    return offset + 3 - jump;
+  return offset + 3 + jump;
+}
+
+// emit copies the stencil of the instruction at offset to the end of the
+// code and patches every hole but the jump targets, which are recorded in
+// fixups. offset is -1 for the stencils around the instructions
+static size_t emit(uint8_t *code, size_t *size, StencilKind kind,
+                   Chunk *chunk, int offset, Fixup *fixups, int *fixupCount) {
+  const Stencil *stencil = &stencils[kind];
+  const JitRule *rule = offset < 0 ? NULL : getRule(chunk->code[offset]);
+  size_t at = *size;
+  memcpy(code + at, stencil->code, stencil->length);
+  *size += stencil->length;
+
+  for (int i = 0; i < STENCIL_HOLES_MAX; i++) {
+    const Hole *hole = &stencil->holes[i];
+    uint8_t *to = code + at + hole->offset;
+    switch (hole->kind) {
+    case HOLE_NONE:
+      break;
+    case HOLE_OPERAND:
+      patch64(to, (uint64_t)(uintptr_t)decodeOperand(chunk, offset,
+                                                     rule->operand));
+      break;
+    case HOLE_IP:
+      patch64(to, (uint64_t)(uintptr_t)(chunk->code + offset +
+                                        instructionLength(chunk->code[offset])));
+      break;
+    case HOLE_HELPER:
+      patch64(to, (uint64_t)(uintptr_t)rule->helper);
+      break;
+    case HOLE_STACK_TOP:
+      patch64(to, (uint64_t)(uintptr_t)&vm.stackTop);
+      break;
+    case HOLE_TARGET:
+    case HOLE_ERROR:
+      fixups[*fixupCount].hole = at + hole->offset;
+      fixups[*fixupCount].target =
+          hole->kind == HOLE_ERROR ? -1 : jumpTarget(chunk, offset);
+      (*fixupCount)++;
+      break;
+    case HOLE_STATUS:
+      patch32(to, kind == STENCIL_ERROR_EXIT ? INTERPRET_RUNTIME_ERROR
+                                             : INTERPRET_OK);
+      break;
+    case HOLE_BOOL_TAG:
+      patch32(to, VAL_BOOL);
+      break;
+    case HOLE_NUMBER_TAG:
+      patch32(to, VAL_NUMBER);
+      break;
+    }
+  }
+  return at;
+}
+
+// countFixups returns how many rel32 holes a stencil has
+static int countFixups(StencilKind kind) {
+  int count = 0;
+  for (int i = 0; i < STENCIL_HOLES_MAX; i++)
+    if (stencils[kind].holes[i].kind == HOLE_TARGET ||
+        stencils[kind].holes[i].kind == HOLE_ERROR)
+      count++;
+  return count;
+}
+
+// jitCompile stitches together the stencils of a chunk's instructions.
+// The chunk must already be verified, so every jump lands on an
+// instruction and the native code can never run off its end
+bool jitCompile(Chunk *chunk, JitCode *jit) {
+  // Size the code first, rejecting the chunk on the first opcode
+  // without a rule
+  size_t capacity = stencils[STENCIL_ENTER].length +
+                    stencils[STENCIL_ERROR_EXIT].length;
+  int fixupCapacity = 0;
+  for (int offset = 0; offset < chunk->count;
+       offset += instructionLength(chunk->code[offset])) {
+    const JitRule *rule = getRule(chunk->code[offset]);
+    if (rule == NULL)
+      return reject("unsupported opcode", offset);
+    capacity += stencils[rule->stencil].length;
+    fixupCapacity += countFixups(rule->stencil);
+  }
+
+  uint8_t *code = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED)
+    return reject("no memory for native code", 0);
+
+  size_t *nativeOffsets = malloc(sizeof(size_t) * chunk->count);
+  Fixup *fixups = malloc(sizeof(Fixup) * (fixupCapacity + 1));
+  int fixupCount = 0;
+  size_t size = 0;
+
+  emit(code, &size, STENCIL_ENTER, chunk, -1, fixups, &fixupCount);
+  for (int offset = 0; offset < chunk->count;
+       offset += instructionLength(chunk->code[offset])) {
+    nativeOffsets[offset] = size;
+    emit(code, &size, getRule(chunk->code[offset])->stencil, chunk, offset,
+         fixups, &fixupCount);
+  }
+
+  // Every helper that fails lands on the shared error exit
+  size_t errorExit =
+      emit(code, &size, STENCIL_ERROR_EXIT, chunk, -1, fixups, &fixupCount);
+
+  for (int i = 0; i < fixupCount; i++) {
+    size_t target = fixups[i].target < 0 ? errorExit
+                                         : nativeOffsets[fixups[i].target];
+    patch32(code + fixups[i].hole,
+            (int32_t)((int64_t)target - (int64_t)(fixups[i].hole + 4)));
+  }
+
+  free(fixups);
+  free(nativeOffsets);
+
+  if (mprotect(code, capacity, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, capacity);
+    return reject("native code could not be made executable", 0);
+  }
+
+  jit->code = code;
+  jit->size = capacity;
+  jit->entry = (InterpreterResult(*)(void))(uintptr_t)code;
+
+  // The stencils' fast paths only know doubles, so integral constants are
+  // widened and native code never sees an int
+  for (int i = 0; i < chunk->constants.count; i++)
+    if (IS_INT(chunk->constants.values[i]))
+      chunk->constants.values[i] =
+          NUMBER_VAL(AS_NUMBER(chunk->constants.values[i]));
+
+  jitStats.chunksCompiled++;
+  jitStats.bytecodeBytes += chunk->count;
+  jitStats.nativeBytes += size;
+  if (jitVerbose)
+    fprintf(stderr,
+            "jit: chunk %d compiled, %d bytes of bytecode into %zu bytes of "
+            "x86-64\n",
+            jitStats.chunksCompiled + jitStats.chunksInterpreted,
+            chunk->count, size);
+  return true;
+}
+
+// jitFree releases the native code of a chunk
+void jitFree(JitCode *jit) {
+  munmap(jit->code, jit->size);
+  jit->code = NULL;
+  jit->size = 0;
+  jit->entry = NULL;
+}
+
+#else
+
+bool jitCompile(Chunk *chunk, JitCode *jit) {
+  (void)chunk;
+  (void)jit;
+#ifdef VM_NAN_BOXING
+  return reject("no native backend for NaN-boxed values", 0);
+#else
+  return reject("no native backend for this machine", 0);
+#endif
+}
+
+void jitFree(JitCode *jit) { (void)jit; }
+
+#endif
+
+// printJitStats writes the counters of every chunk offered to the JIT
+void printJitStats(FILE *out) {
+  fprintf(out, "jit: %d chunks compiled, %d ran in the interpreter\n",
+          jitStats.chunksCompiled, jitStats.chunksInterpreted);
+  fprintf(out, "jit: %zu bytes of bytecode into %zu bytes of native code\n",
+          jitStats.bytecodeBytes, jitStats.nativeBytes);
+}
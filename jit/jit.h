@@ -0,0 +1,33 @@
+#ifndef vm_jit_h
+#define vm_jit_h
+
+#include "../chunk/chunk.h"
+#include "../virtual_machine/vm.h"
+#include <stddef.h>
+
+// Native code for one chunk, entry runs it from the first instruction
+typedef struct {
+  uint8_t *code; // mmap'd region, executable once compiled
+  size_t size;
+  InterpreterResult (*entry)(void);
+} JitCode;
+
+// Counters over every chunk interpret() offered to the JIT
+typedef struct {
+  int chunksCompiled;
+  int chunksInterpreted; // Chunks that fell back to run()
+  size_t bytecodeBytes;  // Bytecode of the compiled chunks
+  size_t nativeBytes;    // Native code emitted for them
+} JitStats;
+
+// When true interpret() runs chunks the JIT supports as native code
+extern bool jitEnabled;
+// When true every chunk's outcome is reported on stderr
+extern bool jitVerbose;
+extern JitStats jitStats;
+
+bool jitCompile(Chunk *chunk, JitCode *jit);
+void jitFree(JitCode *jit);
+void printJitStats(FILE *out);
+
+#endif
@@ -4,7 +4,14 @@
 #include <string.h>
 
 #include "chunk/chunk.h"
+#include "compiler/compiler.h"
 #include "debug/debug.h"
+#include "jit/jit.h"
+#include "memory/memory.h"
+#include "object/object.h"
+#include "optimizer/optimizer.h"
+#include "superinstruction/superinstruction.h"
+#include "trace/trace.h"
 #include "virtual_machine/vm.h"
 
 // // The main function
@@ -82,7 +89,90 @@ static void runFile(const char *path) {
 int main(int argc, const char *argv[]) {
   initVM();
   const char *filePath = "./test.lang";
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--register") == 0)
+      compileMode = COMPILE_REGISTER;
+    else if (strcmp(argv[i], "--no-superinstructions") == 0)
+      superinstructionsEnabled = false;
+    else if (strcmp(argv[i], "--no-quickening") == 0)
+      quickeningEnabled = false;
+    else if (strcmp(argv[i], "--no-folding") == 0)
+      foldingEnabled = false;
+    else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 ||
+             strcmp(argv[i], "-O2") == 0)
+      optimizationLevel = argv[i][2] - '0';
+    else if (strcmp(argv[i], "--optimizer-stats") == 0)
+      optimizerVerbose = true;
+    else if (strcmp(argv[i], "--dump-ir") == 0)
+      dumpIr = true;
+    else if (strcmp(argv[i], "--no-ropes") == 0)
+      ropesEnabled = false;
+    else if (strcmp(argv[i], "--intern-threshold") == 0 && i + 1 < argc)
+      internThreshold = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--hash-seed") == 0 && i + 1 < argc)
+      // A fixed seed reproduces a run's hashes, nothing is hashed yet
+      vm.hashSeed = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "--stress-gc") == 0)
+      stressGC = true;
+    else if (strcmp(argv[i], "--no-nursery") == 0)
+      nurseryEnabled = false;
+#ifdef VM_CONCURRENT_GC
+    else if (strcmp(argv[i], "--concurrent-gc") == 0) {
+      // The collector thread only does full collections
+      concurrentGC = true;
+      nurseryEnabled = false;
+    }
+#endif
+    else if (strcmp(argv[i], "--gc-growth") == 0 && i + 1 < argc)
+      gcGrowthFactor = atof(argv[++i]);
+    else if (strcmp(argv[i], "--gc-stats") == 0)
+      gcVerbose = true;
+    else if (strcmp(argv[i], "--mem-stats") == 0)
+      memVerbose = true;
+    else if (strcmp(argv[i], "--print-quickened") == 0)
+      printQuickened = true;
+    else if (strcmp(argv[i], "--jit") == 0)
+      jitEnabled = true;
+    else if (strcmp(argv[i], "--jit-stats") == 0)
+      jitEnabled = jitVerbose = true;
+    else if (strcmp(argv[i], "--trace") == 0)
+      tracingEnabled = true;
+    else if (strcmp(argv[i], "--trace-stats") == 0)
+      tracingEnabled = traceVerbose = true;
+#ifdef VM_PROFILE_OPCODES
+    else if (strcmp(argv[i], "--opcode-profile") == 0 && i + 1 < argc) {
+      vm.profile = fopen(argv[++i], "a");
+      if (vm.profile == NULL) {
+        fprintf(stderr, "Could not open the profile at %s\n", argv[i]);
+        exit(74);
+      }
+    }
+#endif
+    else
+      filePath = argv[i];
+  }
   runFile(filePath);
 
+#ifdef VM_PROFILE_OPCODES
+  if (vm.profile != NULL)
+    fclose(vm.profile);
+#endif
+
+  if (optimizerVerbose)
+    printOptimizerStats(stderr);
+  if (jitVerbose)
+    printJitStats(stderr);
+  if (traceVerbose)
+    printTraceStats(stderr);
+  if (gcVerbose)
+    printGcStats(stderr);
+  if (memVerbose)
+    printMemStats(stderr);
+
+#ifdef VM_COUNT_INSTRUCTIONS
+  fprintf(stderr, "instructions: %llu\n",
+          (unsigned long long)vm.instructionCount);
+#endif
+
   return 0;
 }
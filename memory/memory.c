@@ -1,10 +1,55 @@
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "memory.h"
+#include "../table/table.h"
+#include "../virtual_machine/vm.h"
 
-// Reallocate function handles reallocation of
-// memory
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+#ifdef VM_CONCURRENT_GC
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+
+// The collector thread marks objects while the mutator runs, the mark
+// bits are read and set atomically. SET_MARK returns the bit it replaced
+#define LOAD_MARK(object) __atomic_load_n(&(object)->isMarked, __ATOMIC_RELAXED)
+#define STORE_MARK(object, value) \
+    __atomic_store_n(&(object)->isMarked, (value), __ATOMIC_RELAXED)
+#define SET_MARK(object) \
+    __atomic_exchange_n(&(object)->isMarked, true, __ATOMIC_RELAXED)
+
+static void concurrentStep();
+static void finishCycle();
+#else
+#define LOAD_MARK(object) ((object)->isMarked)
+#define STORE_MARK(object, value) ((object)->isMarked = (value))
+#define SET_MARK(object) \
+    ((object)->isMarked ? true : ((object)->isMarked = true, false))
+#endif
+
+bool stressGC = false;
+bool nurseryEnabled = true;
+double gcGrowthFactor = 2;
+bool gcVerbose = false;
+GcStats gcStats;
+bool memVerbose = false;
+MemStats memStats;
+
+// The intern table's slots are allocated by whichever thread interns,
+// outside reallocate(), so they are counted apart and atomically
+static struct {
+    atomic_size_t liveBytes;
+    atomic_size_t peakBytes;
+    atomic_uint_least64_t calls;
+    atomic_uint_least64_t allocations;
+    atomic_uint_least64_t frees;
+} internCounters;
+
+// systemReallocate hands the block to the C library, a failed
+// allocation ends the process
+static void* systemReallocate(void* pointer, size_t newSize) {
     // If the newsize is 0, we free the pointer
     if (newSize == 0) {
         free(pointer);
@@ -21,3 +66,856 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
 
     return result;
 }
+
+#ifdef VM_ARENA_ALLOCATOR
+
+// Blocks up to SMALL_MAX bytes are rounded up to a multiple of
+// SIZE_CLASS_STEP. Each size class keeps the blocks freed to it on a
+// list, a class with an empty list carves a new block from the current
+// slab page. Bigger blocks go to the C library
+#define SIZE_CLASS_STEP 16
+#define SIZE_CLASS_COUNT 16
+#define SMALL_MAX (SIZE_CLASS_STEP * SIZE_CLASS_COUNT)
+#define PAGE_SIZE (64 * 1024)
+// Arena blocks are at least this big, bigger requests get a block of
+// their own
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+#define ALIGN(size) \
+    (((size) + SIZE_CLASS_STEP - 1) & ~(size_t)(SIZE_CLASS_STEP - 1))
+#define SIZE_CLASS(size) (((size) - 1) / SIZE_CLASS_STEP)
+
+typedef struct FreeBlock {
+    struct FreeBlock* next;
+} FreeBlock;
+
+// A slab page, its blocks follow the header and are never returned to
+// the C library before freeHeap()
+typedef struct Page {
+    struct Page* next;
+    size_t padding; // Keeps the blocks 16 byte aligned
+} Page;
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    size_t padding;
+    char data[];
+} ArenaBlock;
+
+static FreeBlock* freeLists[SIZE_CLASS_COUNT];
+static Page* pages = NULL;
+static char* pageTop = NULL;
+static char* pageEnd = NULL;
+static ArenaBlock* arena = NULL;
+
+// allocateSmall pops a block of the size's class, or carves one
+static void* allocateSmall(size_t size) {
+    int sizeClass = SIZE_CLASS(size);
+    FreeBlock* block = freeLists[sizeClass];
+    if (block != NULL) {
+        freeLists[sizeClass] = block->next;
+        return block;
+    }
+
+    size_t blockSize = (size_t)(sizeClass + 1) * SIZE_CLASS_STEP;
+    if (pageTop == NULL || pageTop + blockSize > pageEnd) {
+        // What is left of the old page is given up, it is smaller than
+        // the biggest class
+        Page* page = (Page*)systemReallocate(NULL, sizeof(Page) + PAGE_SIZE);
+        page->next = pages;
+        pages = page;
+        pageTop = (char*)(page + 1);
+        pageEnd = pageTop + PAGE_SIZE;
+    }
+    void* result = pageTop;
+    pageTop += blockSize;
+    return result;
+}
+
+static void freeSmall(void* pointer, size_t size) {
+    FreeBlock* block = (FreeBlock*)pointer;
+    int sizeClass = SIZE_CLASS(size);
+    block->next = freeLists[sizeClass];
+    freeLists[sizeClass] = block;
+}
+
+// heapReallocate resizes a block of the collected heap. Callers pass the
+// size they allocated the block with, it picks the size class the block
+// came from
+static void* heapReallocate(void* pointer, size_t oldSize, size_t newSize) {
+    if (oldSize > SMALL_MAX && newSize > SMALL_MAX)
+        return systemReallocate(pointer, newSize);
+    if (oldSize > 0 && newSize > 0 && oldSize <= SMALL_MAX &&
+        newSize <= SMALL_MAX && SIZE_CLASS(oldSize) == SIZE_CLASS(newSize))
+        return pointer;
+
+    void* result = NULL;
+    if (newSize > SMALL_MAX)
+        result = systemReallocate(NULL, newSize);
+    else if (newSize > 0)
+        result = allocateSmall(newSize);
+
+    if (oldSize > 0) {
+        if (result != NULL)
+            memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+        if (oldSize > SMALL_MAX)
+            systemReallocate(pointer, 0);
+        else
+            freeSmall(pointer, oldSize);
+    }
+    return result;
+}
+
+// arenaResize bumps compile-time data out of the arena. The block on
+// top of the arena grows in place, others are copied and left behind
+// until releaseArena()
+static void* arenaResize(void* pointer, size_t oldSize, size_t newSize) {
+    if (newSize <= oldSize)
+        return newSize == 0 ? NULL : pointer;
+
+    size_t oldAligned = ALIGN(oldSize);
+    size_t newAligned = ALIGN(newSize);
+    if (pointer != NULL && arena != NULL &&
+        (char*)pointer + oldAligned == arena->data + arena->used &&
+        arena->used - oldAligned + newAligned <= arena->size) {
+        arena->used += newAligned - oldAligned;
+        return pointer;
+    }
+
+    if (arena == NULL || arena->used + newAligned > arena->size) {
+        size_t size = newAligned > ARENA_BLOCK_SIZE ? newAligned
+                                                    : ARENA_BLOCK_SIZE;
+        ArenaBlock* block =
+            (ArenaBlock*)systemReallocate(NULL, sizeof(ArenaBlock) + size);
+        block->next = arena;
+        block->size = size;
+        block->used = 0;
+        arena = block;
+    }
+
+    void* result = arena->data + arena->used;
+    arena->used += newAligned;
+    if (pointer != NULL)
+        memcpy(result, pointer, oldSize);
+    return result;
+}
+
+// releaseArena frees every compile-time allocation at once
+void releaseArena() {
+    while (arena != NULL) {
+        ArenaBlock* next = arena->next;
+        systemReallocate(arena, 0);
+        arena = next;
+    }
+}
+
+// freeHeap returns the slab pages once every small block is dead
+void freeHeap() {
+    while (pages != NULL) {
+        Page* next = pages->next;
+        systemReallocate(pages, 0);
+        pages = next;
+    }
+    memset(freeLists, 0, sizeof(freeLists));
+    pageTop = NULL;
+    pageEnd = NULL;
+}
+
+#else
+
+static void* heapReallocate(void* pointer, size_t oldSize, size_t newSize) {
+    (void)oldSize;
+    return systemReallocate(pointer, newSize);
+}
+
+// Compile-time data is not part of the collected heap
+static void* arenaResize(void* pointer, size_t oldSize, size_t newSize) {
+    (void)oldSize;
+    return systemReallocate(pointer, newSize);
+}
+
+void releaseArena() {}
+
+void freeHeap() {}
+
+#endif
+
+// countInto adds a resize of a block from oldSize to newSize bytes. It
+// runs on every allocation, so it only counts calls and the ends of a
+// block's life, printMemStats works the resizes out from them
+static inline void countInto(MemCounters* counters, size_t oldSize,
+                             size_t newSize) {
+    size_t live = counters->liveBytes + newSize - oldSize;
+    counters->liveBytes = live;
+    counters->peakBytes = live > counters->peakBytes ? live
+                                                     : counters->peakBytes;
+    counters->calls++;
+    counters->allocations += oldSize == 0;
+    counters->frees += newSize == 0;
+}
+
+static inline void countAllocation(MemCategory category, size_t oldSize,
+                                   size_t newSize) {
+    countInto(&memStats.categories[category], oldSize, newSize);
+    countInto(&memStats.total, oldSize, newSize);
+}
+
+// countInternAllocation counts a block of intern slots allocated or
+// freed on any thread, reported under MEM_INTERN
+void countInternAllocation(size_t oldSize, size_t newSize) {
+    size_t live = atomic_fetch_add_explicit(&internCounters.liveBytes,
+                                            newSize - oldSize,
+                                            memory_order_relaxed) +
+                  newSize - oldSize;
+    size_t peak = atomic_load_explicit(&internCounters.peakBytes,
+                                       memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(
+               &internCounters.peakBytes, &peak, live, memory_order_relaxed,
+               memory_order_relaxed))
+        ;
+    atomic_fetch_add_explicit(&internCounters.calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&internCounters.allocations, oldSize == 0,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&internCounters.frees, newSize == 0,
+                              memory_order_relaxed);
+}
+
+void* arenaReallocate(void* pointer, size_t oldSize, size_t newSize,
+                      MemCategory category) {
+    if (pointer == NULL)
+        oldSize = 0;
+    if (oldSize != 0 || newSize != 0)
+        countAllocation(category, oldSize, newSize);
+    return arenaResize(pointer, oldSize, newSize);
+}
+
+// maybeCollect runs the collection that is due before the heap grows:
+// the whole heap past vm.nextGC, the nursery once it holds NURSERY_SIZE
+// bytes
+static void maybeCollect() {
+#ifdef VM_CONCURRENT_GC
+    if (concurrentGC) {
+        concurrentStep();
+        return;
+    }
+#endif
+
+    // Only what survived into the old generation grows it towards the
+    // next full collection
+    if (vm.bytesAllocated - vm.nurseryBytes > vm.nextGC ||
+        (stressGC && !nurseryEnabled))
+        collectGarbage();
+    else if (nurseryEnabled && (stressGC || vm.nurseryBytes > NURSERY_SIZE))
+        collectNursery();
+}
+
+// Reallocate function handles reallocation of
+// memory. It keeps count of the bytes the heap holds and collects
+// garbage before growing it
+void* reallocate(void* pointer, size_t oldSize, size_t newSize,
+                 MemCategory category) {
+    if (pointer == NULL)
+        oldSize = 0;
+    if (oldSize != 0 || newSize != 0)
+        countAllocation(category, oldSize, newSize);
+
+    vm.bytesAllocated += newSize - oldSize;
+    if (newSize > oldSize)
+        maybeCollect();
+
+    return heapReallocate(pointer, oldSize, newSize);
+}
+
+static void freeObject(Obj* object) {
+    switch (object->type) {
+    case OBJ_STRING: {
+        ObjString* string = (ObjString*)object;
+        reallocate(object, STRING_SIZE(string->length), 0, MEM_STRING);
+        break;
+    }
+    case OBJ_ROPE:
+        FREE(ObjRope, object, MEM_ROPE);
+        break;
+    }
+}
+
+static void freeList(Obj* object) {
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+}
+
+// freeObjects frees the objects from memory
+void freeObjects() {
+#ifdef VM_CONCURRENT_GC
+    finishCycle();
+#endif
+    freeList(vm.objects);
+    freeList(vm.youngObjects);
+    vm.objects = NULL;
+    vm.youngObjects = NULL;
+    vm.nurseryBytes = 0;
+
+    free(vm.grayStack);
+    vm.grayStack = NULL;
+    vm.grayCapacity = 0;
+    free(vm.remembered);
+    vm.remembered = NULL;
+    vm.rememberedCount = 0;
+    vm.rememberedCapacity = 0;
+}
+
+// True while a nursery collection runs. It only marks young objects,
+// the old ones survive it whether they are reachable or not
+static bool collectingNursery = false;
+
+// objectReached tells whether the collection in progress keeps an object
+bool objectReached(Obj* object) {
+    return LOAD_MARK(object) || (collectingNursery && !object->isYoung);
+}
+
+// The gray stack lives outside the collected heap, growing it must not
+// start another collection
+static void pushGray(Obj* object) {
+    if (vm.grayCount + 1 > vm.grayCapacity) {
+        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
+        vm.grayStack = (Obj**)systemReallocate(
+            vm.grayStack, sizeof(Obj*) * vm.grayCapacity);
+    }
+    vm.grayStack[vm.grayCount++] = object;
+}
+
+// markObject marks an object reachable. Strings hold no references and
+// are done once marked, ropes wait on the gray stack to mark theirs
+void markObject(Obj* object) {
+    if (object == NULL || (collectingNursery && !object->isYoung) ||
+        SET_MARK(object))
+        return;
+    if (object->type != OBJ_STRING)
+        pushGray(object);
+}
+
+void markValue(Value value) {
+    if (IS_OBJ(value))
+        markObject(AS_OBJ(value));
+}
+
+// rememberObject records an old object that points at a young one, see
+// writeBarrier
+void rememberObject(Obj* object) {
+    if (object->isRemembered)
+        return;
+    object->isRemembered = true;
+
+    if (vm.rememberedCount + 1 > vm.rememberedCapacity) {
+        vm.rememberedCapacity = GROW_CAPACITY(vm.rememberedCapacity);
+        vm.remembered = (Obj**)systemReallocate(
+            vm.remembered, sizeof(Obj*) * vm.rememberedCapacity);
+    }
+    vm.remembered[vm.rememberedCount++] = object;
+}
+
+// markRoots marks what the running chunk can reach directly. Every stack
+// slot is a root, not only those below stackTop: register code and
+// traces keep values above it, and an instruction's popped operands stay
+// in their slots until it is done with them. The global slots are roots
+// too, storing to them needs no write barrier
+static void markRoots() {
+    for (Value* slot = vm.stack; slot < vm.stack + STACK_MAX; slot++)
+        markValue(*slot);
+
+    for (int i = 0; i < vm.globalCount; i++) {
+        markValue(vm.globalSlots[i].value);
+        markObject((Obj*)vm.globalSlots[i].name);
+    }
+    markTable(&vm.globals);
+
+    ValueArray* constants = &vm.chunk->constants;
+    for (int i = 0; i < constants->count; i++)
+        markValue(constants->values[i]);
+}
+
+static void blackenObject(Obj* object) {
+    switch (object->type) {
+    case OBJ_ROPE: {
+        ObjRope* rope = (ObjRope*)object;
+        markObject(LOAD_REFERENCE(rope->left));
+        markObject(LOAD_REFERENCE(rope->right));
+        markObject((Obj*)LOAD_REFERENCE(rope->flat));
+        break;
+    }
+    case OBJ_STRING:
+        break;
+    }
+}
+
+static void traceReferences() {
+    while (vm.grayCount > 0)
+        blackenObject(vm.grayStack[--vm.grayCount]);
+}
+
+// sweep frees every old object left unmarked. Objects not linked yet
+// are still being built and are never on vm.objects
+static void sweep() {
+    Obj* previous = NULL;
+    Obj* object = vm.objects;
+    while (object != NULL) {
+        if (object->isMarked) {
+            object->isMarked = false;
+            previous = object;
+            object = object->next;
+            continue;
+        }
+
+        Obj* unreached = object;
+        object = object->next;
+        if (previous != NULL)
+            previous->next = object;
+        else
+            vm.objects = object;
+        freeObject(unreached);
+    }
+}
+
+// sweepNursery frees the unmarked young objects and promotes the others
+// to the old generation. Afterwards no old object points at a young one
+static void sweepNursery() {
+    Obj* object = vm.youngObjects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        if (object->isMarked) {
+            object->isMarked = false;
+            object->isYoung = false;
+            object->next = vm.objects;
+            vm.objects = object;
+        } else {
+            freeObject(object);
+        }
+        object = next;
+    }
+    vm.youngObjects = NULL;
+    vm.nurseryBytes = 0;
+}
+
+// forgetRemembered empties the remembered set once marking is done, the
+// collection promotes every young object that survives it
+static void forgetRemembered() {
+    for (int i = 0; i < vm.rememberedCount; i++)
+        vm.remembered[i]->isRemembered = false;
+    vm.rememberedCount = 0;
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void recordPause(double start, size_t before) {
+    double pause = seconds() - start;
+    gcStats.bytesFreed += before - vm.bytesAllocated;
+    if (before > gcStats.peakBytes)
+        gcStats.peakBytes = before;
+    gcStats.totalPause += pause;
+    if (pause > gcStats.maxPause)
+        gcStats.maxPause = pause;
+
+    int bucket = 0;
+    while (bucket < GC_PAUSE_BUCKETS - 1 && pause * 1e6 >= (1u << bucket))
+        bucket++;
+    gcStats.pauses[bucket]++;
+}
+
+// collectGarbage frees every object the running chunk can no longer
+// reach. The interned strings are held weakly, vm.strings drops the
+// entries of strings that die
+void collectGarbage() {
+    // Objects made while compiling are only reachable from the chunk
+    // being built, collections wait until it runs
+    if (vm.chunk == NULL)
+        return;
+
+    double start = seconds();
+    size_t before = vm.bytesAllocated;
+
+    markRoots();
+    traceReferences();
+    forgetRemembered();
+    internRemoveWhite(&vm.strings);
+    sweep();
+    sweepNursery();
+
+    vm.nextGC = (size_t)(vm.bytesAllocated * gcGrowthFactor);
+    if (vm.nextGC < GC_HEAP_MIN)
+        vm.nextGC = GC_HEAP_MIN;
+
+    gcStats.collections++;
+    recordPause(start, before);
+}
+
+// collectNursery frees the young objects the running chunk can no
+// longer reach, without visiting the old ones. Old objects that point
+// at young ones were remembered by the write barrier and are roots
+void collectNursery() {
+    if (vm.chunk == NULL)
+        return;
+
+    double start = seconds();
+    size_t before = vm.bytesAllocated;
+
+    collectingNursery = true;
+    markRoots();
+    for (int i = 0; i < vm.rememberedCount; i++)
+        blackenObject(vm.remembered[i]);
+    traceReferences();
+    forgetRemembered();
+    internRemoveWhite(&vm.strings);
+    sweepNursery();
+    collectingNursery = false;
+
+    gcStats.nurseryCollections++;
+    recordPause(start, before);
+}
+
+#ifdef VM_CONCURRENT_GC
+
+bool concurrentGC = false;
+bool gcMarking = false;
+
+// Swept objects the mutator frees per allocation that grows the heap
+#define FREE_BATCH 64
+
+// Where the concurrent collection stands. The mutator starts each step
+// and finishes it in a short pause, the collector thread does the work
+// in between
+typedef enum {
+    CYCLE_IDLE,
+    CYCLE_MARKING,
+    CYCLE_SWEEPING,
+} CycleState;
+
+static pthread_t collectorThread;
+static bool collectorStarted = false;
+static pthread_mutex_t collectorLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t collectorWake = PTHREAD_COND_INITIALIZER;
+static CycleState cycleState = CYCLE_IDLE;
+static bool workReady = false; // Guarded by collectorLock
+static bool workDone = false;  // Published by the collector thread
+static double workTime;        // Seconds the last step took it
+
+// Objects the barrier shaded during the mark, guarded by collectorLock
+static Obj** shaded = NULL;
+static int shadedCount = 0;
+static int shadedCapacity = 0;
+
+// The sweep: the objects linked before the mark finished, split by the
+// collector thread into survivors and dead ones
+static Obj* sweepObjects = NULL;
+static Obj* survivors = NULL;
+static Obj* survivorsTail = NULL;
+static Obj* deadObjects = NULL;
+static Obj* deadTail = NULL;
+static size_t deadBytes = 0;
+
+// Dead objects the mutator has not freed yet, and their bytes
+static Obj* freeQueue = NULL;
+static size_t queuedBytes = 0;
+
+static size_t objectSize(Obj* object) {
+    return object->type == OBJ_STRING
+               ? STRING_SIZE(((ObjString*)object)->length)
+               : sizeof(ObjRope);
+}
+
+// shadeObject grays an object for the mark in progress, see
+// MARK_BARRIER. The collector thread picks it up from shaded
+void shadeObject(Obj* object) {
+    if (object == NULL || SET_MARK(object) || object->type == OBJ_STRING)
+        return;
+
+    pthread_mutex_lock(&collectorLock);
+    if (shadedCount + 1 > shadedCapacity) {
+        shadedCapacity = GROW_CAPACITY(shadedCapacity);
+        shaded = (Obj**)systemReallocate(shaded, sizeof(Obj*) * shadedCapacity);
+    }
+    shaded[shadedCount++] = object;
+    pthread_mutex_unlock(&collectorLock);
+}
+
+// takeShaded moves the shaded objects onto the gray stack, it returns
+// false when there were none
+static bool takeShaded() {
+    pthread_mutex_lock(&collectorLock);
+    bool any = shadedCount > 0;
+    for (int i = 0; i < shadedCount; i++)
+        pushGray(shaded[i]);
+    shadedCount = 0;
+    pthread_mutex_unlock(&collectorLock);
+    return any;
+}
+
+static void sweepConcurrently() {
+    survivors = survivorsTail = NULL;
+    deadObjects = deadTail = NULL;
+    deadBytes = 0;
+
+    Obj* object = sweepObjects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        if (LOAD_MARK(object)) {
+            STORE_MARK(object, false);
+            object->next = survivors;
+            if (survivors == NULL)
+                survivorsTail = object;
+            survivors = object;
+        } else {
+            deadBytes += objectSize(object);
+            object->next = deadObjects;
+            if (deadObjects == NULL)
+                deadTail = object;
+            deadObjects = object;
+        }
+        object = next;
+    }
+    sweepObjects = NULL;
+}
+
+// runCollector is the collector thread. It marks from the gray stack
+// until neither it nor the barrier has anything left, or sweeps
+static void* runCollector(void* unused) {
+    (void)unused;
+    pthread_mutex_lock(&collectorLock);
+    for (;;) {
+        while (!workReady)
+            pthread_cond_wait(&collectorWake, &collectorLock);
+        workReady = false;
+        CycleState step = cycleState;
+        pthread_mutex_unlock(&collectorLock);
+
+        double start = seconds();
+        if (step == CYCLE_MARKING) {
+            do {
+                traceReferences();
+            } while (takeShaded());
+        } else {
+            sweepConcurrently();
+        }
+        workTime = seconds() - start;
+
+        pthread_mutex_lock(&collectorLock);
+        __atomic_store_n(&workDone, true, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void handOff(CycleState step) {
+    if (!collectorStarted) {
+        if (pthread_create(&collectorThread, NULL, runCollector, NULL) != 0)
+            exit(1);
+        collectorStarted = true;
+    }
+
+    pthread_mutex_lock(&collectorLock);
+    cycleState = step;
+    __atomic_store_n(&workDone, false, __ATOMIC_RELAXED);
+    workReady = true;
+    pthread_cond_signal(&collectorWake);
+    pthread_mutex_unlock(&collectorLock);
+}
+
+// startCycle snapshots the roots and lets the collector thread mark.
+// Every object reachable now is marked by the end, the barrier keeps
+// what the mutator unlinks meanwhile and new objects start marked
+static void startCycle() {
+    if (vm.chunk == NULL)
+        return;
+
+    double start = seconds();
+    gcMarking = true;
+    markRoots();
+    handOff(CYCLE_MARKING);
+    recordPause(start, vm.bytesAllocated);
+}
+
+// finishMarking traces what the barrier shaded after the collector
+// thread last looked, drops the dead interned strings and hands the
+// objects linked so far over to be swept
+static void finishMarking() {
+    double start = seconds();
+    gcStats.concurrentTime += workTime;
+
+    takeShaded();
+    traceReferences();
+    gcMarking = false;
+    internRemoveWhite(&vm.strings);
+
+    sweepObjects = vm.objects;
+    vm.objects = NULL;
+    handOff(CYCLE_SWEEPING);
+    recordPause(start, vm.bytesAllocated);
+}
+
+// finishSweeping links the survivors back and queues the dead objects,
+// the mutator frees them a batch at a time
+static void finishSweeping() {
+    gcStats.concurrentTime += workTime;
+
+    if (survivors != NULL) {
+        survivorsTail->next = vm.objects;
+        vm.objects = survivors;
+    }
+    if (deadObjects != NULL) {
+        deadTail->next = freeQueue;
+        freeQueue = deadObjects;
+    }
+    queuedBytes += deadBytes;
+    gcStats.bytesFreed += deadBytes;
+    gcStats.collections++;
+
+    vm.nextGC = (size_t)((vm.bytesAllocated - queuedBytes) * gcGrowthFactor);
+    if (vm.nextGC < GC_HEAP_MIN)
+        vm.nextGC = GC_HEAP_MIN;
+
+    pthread_mutex_lock(&collectorLock);
+    cycleState = CYCLE_IDLE;
+    pthread_mutex_unlock(&collectorLock);
+}
+
+static void freeQueued(int count) {
+    while (freeQueue != NULL && count-- > 0) {
+        Obj* object = freeQueue;
+        freeQueue = object->next;
+        queuedBytes -= objectSize(object);
+        freeObject(object);
+    }
+}
+
+static void finishStep() {
+    if (cycleState == CYCLE_MARKING)
+        finishMarking();
+    else
+        finishSweeping();
+}
+
+// concurrentStep runs on every allocation that grows the heap. It frees
+// a batch of swept objects, finishes the collector thread's step once
+// it is done and starts a collection when the heap has grown enough
+static void concurrentStep() {
+    freeQueued(FREE_BATCH);
+
+    if (cycleState == CYCLE_IDLE) {
+        if (stressGC || vm.bytesAllocated - queuedBytes > vm.nextGC)
+            startCycle();
+    } else if (__atomic_load_n(&workDone, __ATOMIC_ACQUIRE)) {
+        finishStep();
+    }
+}
+
+// finishCycle waits for the collection in progress and frees everything
+// it found dead
+static void finishCycle() {
+    while (cycleState != CYCLE_IDLE) {
+        while (!__atomic_load_n(&workDone, __ATOMIC_ACQUIRE))
+            sched_yield();
+        finishStep();
+    }
+    freeQueued(INT_MAX);
+}
+
+#endif
+
+// pausePercentile returns the bound in microseconds under which the
+// given share of pauses fell
+static unsigned long pausePercentile(double share) {
+    uint64_t total = gcStats.collections + gcStats.nurseryCollections;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < GC_PAUSE_BUCKETS; bucket++) {
+        seen += gcStats.pauses[bucket];
+        if (seen > 0 && seen >= share * total)
+            return 1ul << bucket;
+    }
+    return 0;
+}
+
+void printGcStats(FILE* out) {
+    fprintf(out, "gc: %llu full and %llu nursery collections, "
+                 "%llu bytes freed, %zu bytes live\n",
+            (unsigned long long)gcStats.collections,
+            (unsigned long long)gcStats.nurseryCollections,
+            (unsigned long long)gcStats.bytesFreed, vm.bytesAllocated);
+    fprintf(out, "gc: %.3f ms paused, %.3f ms longest pause, "
+                 "%zu bytes peak heap\n",
+            gcStats.totalPause * 1e3, gcStats.maxPause * 1e3,
+            gcStats.peakBytes > vm.bytesAllocated ? gcStats.peakBytes
+                                                   : vm.bytesAllocated);
+    fprintf(out, "gc: half the pauses under %lu us, 99%% under %lu us\n",
+            pausePercentile(0.5), pausePercentile(0.99));
+#ifdef VM_CONCURRENT_GC
+    if (concurrentGC)
+        fprintf(out, "gc: %.3f ms marking and sweeping on the collector "
+                     "thread\n",
+                gcStats.concurrentTime * 1e3);
+#endif
+}
+
+const char* memCategoryName(MemCategory category) {
+    switch (category) {
+    case MEM_CHUNK_CODE: return "chunk code";
+    case MEM_CHUNK_LINES: return "chunk lines";
+    case MEM_VALUE_ARRAY: return "value arrays";
+    case MEM_TABLE: return "table entries";
+    case MEM_STRING: return "strings";
+    case MEM_ROPE: return "ropes";
+    case MEM_COMPILER: return "compiler passes";
+    case MEM_TRACE: return "traces";
+    case MEM_RUNTIME: return "runtime";
+    case MEM_INTERN: return "intern slots";
+    default: return "unknown";
+    }
+}
+
+static void printCounters(FILE* out, const char* name,
+                          MemCounters* counters) {
+    fprintf(out, "mem: %-16s %12zu %12zu %12llu %12llu %12llu\n", name,
+            counters->liveBytes, counters->peakBytes,
+            (unsigned long long)counters->allocations,
+            (unsigned long long)(counters->calls - counters->allocations -
+                                 counters->frees),
+            (unsigned long long)counters->frees);
+}
+
+// printMemStats prints one line per category that allocated anything.
+// The peak of the total is the most bytes live at once, not the sum of
+// the peaks. The intern slots are not in the total, their peak cannot
+// be lined up with the others'
+void printMemStats(FILE* out) {
+    memStats.categories[MEM_INTERN] = (MemCounters){
+        atomic_load(&internCounters.liveBytes),
+        atomic_load(&internCounters.peakBytes),
+        atomic_load(&internCounters.calls),
+        atomic_load(&internCounters.allocations),
+        atomic_load(&internCounters.frees)};
+
+    fprintf(out, "mem: %-16s %12s %12s %12s %12s %12s\n", "category",
+            "live bytes", "peak bytes", "allocations", "resizes", "frees");
+    for (int category = 0; category < MEM_CATEGORY_COUNT; category++) {
+        MemCounters* counters = &memStats.categories[category];
+        if (counters->allocations > 0)
+            printCounters(out, memCategoryName((MemCategory)category),
+                          counters);
+    }
+    printCounters(out, "total", &memStats.total);
+
+    TableStats strings;
+    internStats(&vm.strings, &strings);
+    fprintf(out, "mem: intern table holds %d strings and %d tombstones in "
+                 "%d entries, %.2f probes on average, %d at most, "
+                 "reseeded %d times\n",
+            strings.count, strings.tombstones, strings.capacity,
+            strings.averageProbe, strings.longestProbe, strings.reseeds);
+}
@@ -2,9 +2,39 @@
 #define vm_memory_h
 
 #include "../commons/common.h"
+#include "../object/object.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+// Collections never start before the heap holds this many bytes
+#define GC_HEAP_MIN (1024 * 1024)
+// New objects the nursery holds before it is collected on its own
+#define NURSERY_SIZE (256 * 1024)
+// Pause times are counted in buckets, bucket i holds the pauses under
+// 2^i microseconds
+#define GC_PAUSE_BUCKETS 24
+
+// What an allocation is for, each category keeps its own counters.
+// Objects are counted under the category of their ObjType
+typedef enum {
+    MEM_CHUNK_CODE,
+    MEM_CHUNK_LINES,
+    MEM_VALUE_ARRAY,
+    MEM_TABLE,
+    MEM_STRING, // In ObjType order
+    MEM_ROPE,
+    MEM_COMPILER, // Scratch arrays of the passes over a chunk
+    MEM_TRACE,
+    MEM_RUNTIME, // Execution counts and other interpreter scratch
+    MEM_INTERN,  // The intern table's slots, see countInternAllocation
+    MEM_CATEGORY_COUNT
+} MemCategory;
+
+#define MEM_OBJECT(type) ((MemCategory)(MEM_STRING + (type)))
+
+#define FREE(type, pointer, category) \
+    reallocate(pointer, sizeof(type), 0, category)
 
 // Macro to grow the capacity of an array
 #define GROW_CAPACITY(capacity) \
@@ -12,20 +42,128 @@
 
 
 // Macro to grow the size of an array
-#define GROW_ARRAY(type, pointer, oldCount, newCount) \
+#define GROW_ARRAY(type, pointer, oldCount, newCount, category) \
     (type*)reallocate(pointer, sizeof(type) * (oldCount), \
-        sizeof(type) * (newCount))
+        sizeof(type) * (newCount), category)
 
 
 // Macro to free the array
-#define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type) * (oldCount), 0)
+#define FREE_ARRAY(type, pointer, oldCount, category) \
+    reallocate(pointer, sizeof(type) * (oldCount), 0, category)
 
 // Allocate memory to the heap
-#define ALLOCATE(type, count) \
-    (type*)reallocate(NULL, 0, sizeof(type) * (count))
+#define ALLOCATE(type, count, category) \
+    (type*)reallocate(NULL, 0, sizeof(type) * (count), category)
+
+// Compile-time data, the chunk and the passes over it, lives until
+// interpret() finishes. With VM_ARENA_ALLOCATOR it is bump allocated and
+// released in bulk by releaseArena(), freeing it early is a no-op
+#define ARENA_ALLOCATE(type, count, category) \
+    (type*)arenaReallocate(NULL, 0, sizeof(type) * (count), category)
+
+#define ARENA_GROW_ARRAY(type, pointer, oldCount, newCount, category) \
+    (type*)arenaReallocate(pointer, sizeof(type) * (oldCount), \
+        sizeof(type) * (newCount), category)
+
+#define ARENA_FREE_ARRAY(type, pointer, oldCount, category) \
+    arenaReallocate(pointer, sizeof(type) * (oldCount), 0, category)
+
+// Counters of one category of allocations, or of all of them
+typedef struct {
+    size_t liveBytes;
+    size_t peakBytes;
+    uint64_t calls; // Allocations, resizes and frees
+    uint64_t allocations;
+    uint64_t frees;
+} MemCounters;
+
+// Counters over every allocation made through reallocate() and
+// arenaReallocate(), reported by --mem-stats. Blocks the arena drops in
+// bulk count as freed when their owner frees them. MEM_INTERN is filled
+// in from countInternAllocation's counters and left out of the total
+typedef struct {
+    MemCounters total;
+    MemCounters categories[MEM_CATEGORY_COUNT];
+} MemStats;
+
+// Counters over every collection, reported by --gc-stats
+typedef struct {
+    uint64_t collections; // Of the whole heap
+    uint64_t nurseryCollections;
+    uint64_t bytesFreed;
+    size_t peakBytes;  // Most bytes allocated when a collection started
+    double totalPause; // Seconds spent collecting
+    double maxPause;
+    uint64_t pauses[GC_PAUSE_BUCKETS];
+    double concurrentTime; // Seconds the collector thread worked
+} GcStats;
+
+// When true every allocation that grows the heap collects first
+extern bool stressGC;
+// When false every object goes straight to the old generation and each
+// collection is of the whole heap
+extern bool nurseryEnabled;
+// After a collection the next one starts once the heap is this many
+// times the size of what survived
+extern double gcGrowthFactor;
+// When true the collector counters are reported on stderr at exit
+extern bool gcVerbose;
+extern GcStats gcStats;
+// When true the allocation counters are reported on stderr at exit
+extern bool memVerbose;
+extern MemStats memStats;
 
 // The reallocate function
-void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* reallocate(void* pointer, size_t oldSize, size_t newSize,
+                 MemCategory category);
+void* arenaReallocate(void* pointer, size_t oldSize, size_t newSize,
+                      MemCategory category);
+void releaseArena();
+void freeHeap();
+
+void markObject(Obj* object);
+void markValue(Value value);
+bool objectReached(Obj* object);
+void rememberObject(Obj* object);
+void collectGarbage();
+void collectNursery();
+void freeObjects();
+void printGcStats(FILE* out);
+const char* memCategoryName(MemCategory category);
+void countInternAllocation(size_t oldSize, size_t newSize);
+void printMemStats(FILE* out);
+
+#ifdef VM_CONCURRENT_GC
+// When true full collections mark and sweep on a collector thread while
+// run() goes on, only their start and end stop it
+extern bool concurrentGC;
+// True while the collector thread marks
+extern bool gcMarking;
+
+void shadeObject(Obj* object);
+
+// MARK_BARRIER keeps alive what the mark in progress could miss: an
+// object whose reference is about to be overwritten, or a string the
+// weak vm.strings hands out again
+#define MARK_BARRIER(object) \
+    (gcMarking ? shadeObject((Obj*)(object)) : (void)0)
+
+// References the collector thread reads while the mutator writes them
+#define LOAD_REFERENCE(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define STORE_REFERENCE(field, value) \
+    __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+#else
+#define MARK_BARRIER(object) ((void)0)
+#define LOAD_REFERENCE(field) (field)
+#define STORE_REFERENCE(field, value) ((field) = (value))
+#endif
+
+// writeBarrier runs when a reference to value is stored in owner. An
+// old object that comes to point at a young one is remembered, the next
+// nursery collection treats it as a root
+static inline void writeBarrier(Obj* owner, Obj* value) {
+    if (!owner->isYoung && value != NULL && value->isYoung)
+        rememberObject(owner);
+}
 
 #endif
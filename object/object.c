@@ -7,42 +7,171 @@
 #include <stdlib.h>
 #include <string.h>
 
-// Write a hash function to store a hash
-// hashString uses the FNN-1a algorithm to hash
-// strings
-static uint32_t hashString(const char *key, int length) {
-  uint32_t hash = 2166136261u;
-  for (int i = 0; i < length; i++) {
-    hash ^= (uint8_t)key[i];
-    hash *= 16777619;
+bool ropesEnabled = true;
+int internThreshold = ROPE_MIN_LENGTH;
+
+// hashString follows wyhash: it reads the string 8 bytes at a time and
+// folds them in with 64x64 to 128 bit multiplies, three lanes at a time
+// on long strings. Every bit of the result depends on every input bit,
+// tables can take theirs from either end of it. vm.hashSeed starts it off,
+// so which keys collide differs from one VM to the next
+#define HASH_SECRET0 0xa0761d6478bd642full
+#define HASH_SECRET1 0xe7037ed1a0b428dbull
+#define HASH_SECRET2 0x8ebc6af09c88c6e3ull
+#define HASH_SECRET3 0x589965cc75374cc3ull
+
+// multiply replaces a and b with the low and high halves of a * b
+static inline void multiply(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t product = (__uint128_t)*a * *b;
+  *a = (uint64_t)product;
+  *b = (uint64_t)(product >> 64);
+#else
+  uint64_t aHigh = *a >> 32, aLow = (uint32_t)*a;
+  uint64_t bHigh = *b >> 32, bLow = (uint32_t)*b;
+  uint64_t high = aHigh * bHigh, middle0 = aHigh * bLow;
+  uint64_t middle1 = aLow * bHigh, low = aLow * bLow;
+  uint64_t t = low + (middle0 << 32);
+  uint64_t carry = t < low;
+  uint64_t productLow = t + (middle1 << 32);
+  carry += productLow < t;
+  *a = productLow;
+  *b = high + (middle0 >> 32) + (middle1 >> 32) + carry;
+#endif
+}
+
+// multiplyFold multiplies a and b into 128 bits, and xors the halves
+static inline uint64_t multiplyFold(uint64_t a, uint64_t b) {
+  multiply(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t read64(const uint8_t *bytes) {
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+static inline uint64_t read32(const uint8_t *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+uint32_t hashString(const char *key, int length) {
+  const uint8_t *bytes = (const uint8_t *)key;
+  size_t left = (size_t)length;
+  uint64_t seed = multiplyFold(vm.hashSeed ^ HASH_SECRET0, HASH_SECRET1);
+  uint64_t a, b;
+
+  if (left <= 16) {
+    // Strings of 4 to 16 bytes are read as up to four overlapping words
+    if (left >= 4) {
+      size_t middle = (left >> 3) << 2;
+      a = (read32(bytes) << 32) | read32(bytes + middle);
+      b = (read32(bytes + left - 4) << 32) |
+          read32(bytes + left - 4 - middle);
+    } else if (left > 0) {
+      a = ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[left >> 1] << 8) |
+          bytes[left - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    if (left > 48) {
+      uint64_t lane1 = seed, lane2 = seed;
+      do {
+        seed = multiplyFold(read64(bytes) ^ HASH_SECRET1,
+                            read64(bytes + 8) ^ seed);
+        lane1 = multiplyFold(read64(bytes + 16) ^ HASH_SECRET2,
+                             read64(bytes + 24) ^ lane1);
+        lane2 = multiplyFold(read64(bytes + 32) ^ HASH_SECRET3,
+                             read64(bytes + 40) ^ lane2);
+        bytes += 48;
+        left -= 48;
+      } while (left > 48);
+      seed ^= lane1 ^ lane2;
+    }
+    while (left > 16) {
+      seed = multiplyFold(read64(bytes) ^ HASH_SECRET1,
+                          read64(bytes + 8) ^ seed);
+      bytes += 16;
+      left -= 16;
+    }
+    // The last 16 bytes, overlapping what came before
+    a = read64(bytes + left - 16);
+    b = read64(bytes + left - 8);
   }
-  return hash;
+
+  a ^= HASH_SECRET1;
+  b ^= seed;
+  multiply(&a, &b);
+  uint64_t hash =
+      multiplyFold(a ^ HASH_SECRET0 ^ (uint64_t)length, b ^ HASH_SECRET1);
+  return (uint32_t)(hash ^ (hash >> 32));
 }
 
-// Used to allocate an object to the memory
+// Used to allocate an object to the memory. It joins vm.objects only
+// once linked, so a string can be filled in and dropped before that
 static Obj *allocateObj(size_t size, ObjType type) {
-  Obj *object = (Obj *)reallocate(NULL, 0, size);
+  Obj *object = (Obj *)reallocate(NULL, 0, size, MEM_OBJECT(type));
   object->type = type;
-  object->next = vm.objects;
-  vm.objects = object;
+  object->isMarked = false;
+  object->isYoung = false;
+  object->isRemembered = false;
+  object->next = NULL;
   return object;
 }
 
-// Used to allocate an object type to the memory
-#define ALLOCATE_OBJ(type, objectType)                                         \
-  (type *)allocateObj(sizeof(type), objectType)
+// linkObj hands an object over to the VM, which frees it once it is
+// unreachable. New objects start in the nursery
+static void linkObj(Obj *object) {
+#ifdef VM_CONCURRENT_GC
+  // The mark in progress cannot have seen an object before it is linked,
+  // even one allocated before it started, so it survives the mark
+  if (gcMarking)
+    object->isMarked = true;
+#endif
+
+  if (!nurseryEnabled) {
+    object->next = vm.objects;
+    vm.objects = object;
+    return;
+  }
+
+  object->isYoung = true;
+  object->next = vm.youngObjects;
+  vm.youngObjects = object;
+  vm.nurseryBytes += object->type == OBJ_STRING
+                         ? STRING_SIZE(((ObjString *)object)->length)
+                         : sizeof(ObjRope);
+}
 
-// Gets the allocated space as chars and allocates
-// it as an object string
-static ObjString *allocateString(char *chars, int length, uint32_t hash) {
-  ObjString *objectString = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-  objectString->length = length;
-  objectString->chars = chars;
-  objectString->hash = hash;
+// allocateString reserves a string of length chars in one block. The
+// caller writes the chars and passes the string on to takeString
+ObjString *allocateString(int length) {
+  ObjString *string =
+      (ObjString *)allocateObj(STRING_SIZE(length), OBJ_STRING);
+  string->length = length;
+  string->hashed = false;
+  string->interned = false;
+  string->chars[length] = '\0';
+  return string;
+}
 
-  // Set the value of the string in the table
-  tableSet(&vm.strings, objectString, NIL_VAL);
-  return objectString;
+// addInterned interns a new string and links it. If an equal string was
+// interned first, by another thread since the caller looked, the new one
+// is freed and that one returned
+static ObjString *addInterned(ObjString *string) {
+  ObjString *interned = internAdd(&vm.strings, string);
+  if (interned != string) {
+    reallocate(string, STRING_SIZE(string->length), 0, MEM_STRING);
+    MARK_BARRIER(interned);
+    return interned;
+  }
+  linkObj((Obj *)string);
+  return string;
 }
 
 // copyString copies the recieved chars into an object
@@ -52,17 +181,18 @@ ObjString *copyString(const char *chars, int length) {
   // Check if we are already storing the string
   // in our strings table, if yes, we just return
   // the intered string
-  ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
-  if (interned != NULL)
+  ObjString *interned = internFind(&vm.strings, chars, length, hash);
+  if (interned != NULL) {
+    MARK_BARRIER(interned);
     return interned;
-  // Allocate memory to the heap and add final characteer
-  char *heapChars = ALLOCATE(char, length + 1);
-  memcpy(heapChars, chars, length);
-  heapChars[length] = '\0';
+  }
 
-  // Return the string at the end after allocating
-  // it as on object
-  return allocateString(heapChars, length, hash);
+  ObjString *string = allocateString(length);
+  memcpy(string->chars, chars, length);
+  string->hash = hash;
+  string->hashed = true;
+  string->interned = true;
+  return addInterned(string);
 }
 
 // printObject handles the printing of an object
@@ -71,18 +201,115 @@ void printObject(Value value) {
   case OBJ_STRING:
     printf("%s \n", AS_CSTRING(value));
     break;
+  case OBJ_ROPE:
+    printf("%s \n", AS_FLAT_STRING(value)->chars);
+    break;
   default:
     break;
   }
 }
 
-// takeString allocates a string and returns it
-ObjString *takeString(char *chars, int length) {
-  uint32_t hash = hashString(chars, length);
-  ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+// takeString hands over a string filled in after allocateString. Short
+// strings are interned: if an equal one is already interned the new one
+// is freed and the interned one returned. Long ones are kept as they are
+// and never hashed unless a comparison needs it
+ObjString *takeString(ObjString *string) {
+  if (string->length >= internThreshold) {
+    linkObj((Obj *)string);
+    return string;
+  }
+
+  ObjString *interned = internFind(&vm.strings, string->chars,
+                                   string->length, stringHash(string));
   if (interned != NULL) {
-    FREE_ARRAY(char, chars, length + 1);
+    reallocate(string, STRING_SIZE(string->length), 0, MEM_STRING);
+    MARK_BARRIER(interned);
     return interned;
   }
-  return allocateString(chars, length, hash);
+  string->interned = true;
+  return addInterned(string);
+}
+
+// stringHash returns the hash of a string, computing it the first time
+uint32_t stringHash(ObjString *string) {
+  if (!string->hashed) {
+    string->hash = hashString(string->chars, string->length);
+    string->hashed = true;
+  }
+  return string->hash;
+}
+
+// stringsEqual compares two strings or ropes. Two interned strings are
+// equal only when they are the same object, otherwise differing lengths
+// or hashes settle it before the characters are compared
+bool stringsEqual(Obj *a, Obj *b) {
+  if (a == b)
+    return true;
+  if (stringLength(a) != stringLength(b))
+    return false;
+
+  ObjString *left = flatString(a);
+  ObjString *right = flatString(b);
+  if (left == right)
+    return true;
+  if ((left->interned && right->interned) ||
+      stringHash(left) != stringHash(right))
+    return false;
+  return memcmp(left->chars, right->chars, left->length) == 0;
+}
+
+// makeRope concatenates two strings or ropes in constant time
+ObjRope *makeRope(Obj *left, Obj *right, int length) {
+  ObjRope *rope = (ObjRope *)allocateObj(sizeof(ObjRope), OBJ_ROPE);
+  rope->length = length;
+  rope->left = left;
+  rope->right = right;
+  rope->flat = NULL;
+  linkObj((Obj *)rope);
+  return rope;
+}
+
+// flattenRope copies the pieces of a rope into one string. The
+// string is filled from its end, right pieces first, so a rope built by
+// appending only ever keeps a couple of nodes pending
+ObjString *flattenRope(ObjRope *rope) {
+  if (rope->flat != NULL)
+    return rope->flat;
+
+  ObjString *string = allocateString(rope->length);
+  char *end = string->chars + rope->length;
+
+  int capacity = 8;
+  int count = 0;
+  Obj **pending = GROW_ARRAY(Obj *, NULL, 0, capacity, MEM_RUNTIME);
+  pending[count++] = (Obj *)rope;
+
+  while (count > 0) {
+    Obj *node = pending[--count];
+    ObjString *piece = node->type == OBJ_STRING ? (ObjString *)node
+                                                : ((ObjRope *)node)->flat;
+    if (piece != NULL) {
+      end -= piece->length;
+      memcpy(end, piece->chars, piece->length);
+      continue;
+    }
+
+    if (count + 2 > capacity) {
+      int oldCapacity = capacity;
+      capacity = GROW_CAPACITY(oldCapacity);
+      pending = GROW_ARRAY(Obj *, pending, oldCapacity, capacity,
+                           MEM_RUNTIME);
+    }
+    pending[count++] = ((ObjRope *)node)->left;
+    pending[count++] = ((ObjRope *)node)->right;
+  }
+  FREE_ARRAY(Obj *, pending, capacity, MEM_RUNTIME);
+
+  STORE_REFERENCE(rope->flat, takeString(string));
+  writeBarrier((Obj *)rope, (Obj *)rope->flat);
+  MARK_BARRIER(rope->left);
+  MARK_BARRIER(rope->right);
+  STORE_REFERENCE(rope->left, NULL);
+  STORE_REFERENCE(rope->right, NULL);
+  return rope->flat;
 }
@@ -5,39 +5,100 @@
 #include "../value/value.h"
 #include <stdint.h>
 
-typedef enum ObjType { OBJ_STRING } ObjType;
+typedef enum ObjType { OBJ_STRING, OBJ_ROPE } ObjType;
 
 typedef struct Obj {
   ObjType type;
+  bool isMarked;     // Reached by the collection in progress
+  bool isYoung;      // In the nursery, not promoted by a collection yet
+  bool isRemembered; // Old and pointing at young objects
   Obj *next;
 } Obj;
 
+// The characters live inline after the header, a string is one block
 typedef struct ObjString {
   Obj obj;
   int length;
-  char *chars;
-  uint32_t hash;
+  uint32_t hash; // Valid once hashed, stringHash computes it on demand
+  bool hashed;
+  bool interned; // Whether this is the string vm.strings holds
+  char chars[];  // length chars and a terminating NUL
 } ObjString;
 
+// Bytes of the block holding a string of length chars
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
+// Concatenations at least this long become ropes, shorter ones are
+// copied right away
+#define ROPE_MIN_LENGTH 64
+
+// A concatenation whose characters are not built yet. Scripts see it as
+// a string, flattenRope copies the pieces into one string the first
+// time something reads them and keeps it in flat
+typedef struct ObjRope {
+  Obj obj;
+  int length;
+  Obj *left; // Strings or ropes, dropped once flattened
+  Obj *right;
+  ObjString *flat;
+} ObjRope;
+
+// When false concatenation always copies into a flat string
+extern bool ropesEnabled;
+// Strings built at run time at least this long are not interned, they
+// are hashed only when something asks for the hash. Literals and names
+// are always interned
+extern int internThreshold;
+
 // Because obj is of type Obj :: it is safe to cast ObjString*
 // to Obj* and then access its type. We can also similarly
 // cast Obj* to ObjString* after ensuring the rest of the fields
 // are present
 
 #define OBJ_TYPE (value)(AS_OBJ(value)->type)
-#define IS_STRING(value) isObjectType(value, OBJ_STRING)
+// Ropes are strings to scripts, IS_STRING accepts both
+#define IS_STRING(value) isString(value)
+#define IS_ROPE(value) isObjectType(value, OBJ_ROPE)
 
 // isObjectType returns if an object is of a particular type
 static inline bool isObjectType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
-// Macros to cast an object to a string
+static inline bool isString(Value value) {
+  return IS_OBJ(value) && (AS_OBJ(value)->type == OBJ_STRING ||
+                           AS_OBJ(value)->type == OBJ_ROPE);
+}
+
+// Macros to cast an object to a string. AS_STRING and AS_CSTRING expect
+// a flat string, AS_FLAT_STRING flattens a rope first
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define AS_ROPE(value) ((ObjRope *)AS_OBJ(value))
+#define AS_FLAT_STRING(value) flatString(AS_OBJ(value))
 
+ObjString *allocateString(int length);
 ObjString *copyString(const char *chars, int length);
 void printObject(Value value);
-ObjString *takeString(char *chars, int length);
+ObjString *takeString(ObjString *string);
+uint32_t hashString(const char *key, int length);
+uint32_t stringHash(ObjString *string);
+bool stringsEqual(Obj *a, Obj *b);
+ObjRope *makeRope(Obj *left, Obj *right, int length);
+ObjString *flattenRope(ObjRope *rope);
+
+// stringLength is the length of a string or rope without flattening it
+static inline int stringLength(Obj *string) {
+  if (string->type == OBJ_ROPE)
+    return ((ObjRope *)string)->length;
+  return ((ObjString *)string)->length;
+}
+
+// flatString returns a string object itself and a rope flattened
+static inline ObjString *flatString(Obj *string) {
+  if (string->type == OBJ_ROPE)
+    return flattenRope((ObjRope *)string);
+  return (ObjString *)string;
+}
 
 #endif
@@ -0,0 +1,791 @@
+#include "optimizer.h"
+#include "../ir/ir.h"
+#include "../memory/memory.h"
+#include "../verifier/verifier.h"
+#include "../virtual_machine/vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef DEBUG_PRINT_CODE
+#include "../debug/debug.h"
+#endif
+
+int optimizationLevel = 0;
+bool optimizerVerbose = false;
+bool dumpIr = false;
+OptimizerStats optimizerStats;
+
+// A pass returns how many rewrites it made
+typedef struct {
+  const char *name;
+  int level; // Lowest optimization level it runs at
+  int (*run)(Ir *ir);
+} Pass;
+
+static int propagateCopies(Ir *ir);
+static int eliminateCommonSubexpressions(Ir *ir);
+static int eliminateDeadCode(Ir *ir);
+
+// Dead code goes last, the other passes leave the operands they no
+// longer need behind for it
+static const Pass passes[OPTIMIZER_PASSES] = {
+    {"copy-propagation", 1, propagateCopies},
+    {"common-subexpressions", 2, eliminateCommonSubexpressions},
+    {"dead-code", 1, eliminateDeadCode},
+};
+
+static double milliseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+// countInstructions counts the instructions of a chunk, operands aside
+static int countInstructions(Chunk *chunk) {
+  int count = 0;
+  for (int offset = 0; offset < chunk->count; count++)
+    offset += instructionLength(chunk->code[offset]);
+  return count;
+}
+
+// -------------------- Copy propagation
+
+// A value as far as the lattice knows: not yet seen, one constant on
+// every path seen so far, or unknown
+typedef enum {
+  CELL_UNSEEN,
+  CELL_CONSTANT,
+  CELL_UNKNOWN,
+} CellState;
+
+typedef struct {
+  uint8_t state;
+  Value value;
+} Cell;
+
+// meet lowers a cell to what it and another agree on. Returns true if
+// the cell changed
+static bool meet(Cell *cell, Cell other) {
+  if (other.state == CELL_UNSEEN || cell->state == CELL_UNKNOWN)
+    return false;
+  if (cell->state == CELL_UNSEEN) {
+    *cell = other;
+    return true;
+  }
+  if (other.state == CELL_CONSTANT && irSameValue(cell->value, other.value))
+    return false;
+  cell->state = CELL_UNKNOWN;
+  return true;
+}
+
+// transfer works out the cell of an instruction from its operands and
+// the cells of the globals, which stores update
+static Cell transfer(IrInstruction *instruction, Cell *cells, Cell *globals) {
+  Cell unknown = {CELL_UNKNOWN, NIL_VAL};
+  switch (instruction->op) {
+  case IR_CONSTANT:
+    return (Cell){CELL_CONSTANT, instruction->value};
+  case IR_GET_LOCAL:
+    return cells[instruction->source];
+  case IR_SET_LOCAL:
+    return cells[instruction->a];
+  case IR_GET_GLOBAL:
+    return globals[instruction->slot];
+  case IR_SET_GLOBAL:
+    globals[instruction->slot] = cells[instruction->a];
+    return cells[instruction->a];
+  case IR_DEFINE_GLOBAL:
+    globals[instruction->slot] = cells[instruction->a];
+    return unknown;
+  case IR_PRINT:
+  case IR_POP:
+    return unknown;
+  default:
+    break;
+  }
+
+  Cell a = cells[instruction->a];
+  Cell b = {CELL_CONSTANT, NIL_VAL};
+  if (irOperandCount(instruction->op) == 2)
+    b = cells[instruction->b];
+  if (a.state == CELL_UNKNOWN || b.state == CELL_UNKNOWN)
+    return unknown;
+  if (a.state == CELL_UNSEEN || b.state == CELL_UNSEEN)
+    return (Cell){CELL_UNSEEN, NIL_VAL};
+
+  Cell result = {CELL_CONSTANT, NIL_VAL};
+  if (!foldInstruction(irOpcode(instruction->op), a.value, b.value,
+                       &result.value))
+    return unknown;
+  return result;
+}
+
+// flow passes the exit of a block to a successor: the values of its
+// stack to the successor's params and the cells of the globals. Returns
+// true if anything the successor sees changed
+static bool flow(Ir *ir, IrBlock *block, int successor, Cell *cells,
+                 Cell *globals, Cell *entries, bool *executable) {
+  IrBlock *to = &ir->blocks[successor];
+  bool changed = !executable[successor];
+  executable[successor] = true;
+
+  for (int slot = 0; slot < to->depth; slot++)
+    changed |= meet(&cells[to->start + slot], cells[block->exit[slot]]);
+  Cell *entry = &entries[successor * vm.globalCount];
+  for (int global = 0; global < vm.globalCount; global++)
+    changed |= meet(&entry[global], globals[global]);
+  return changed;
+}
+
+// forwardCopy returns the value a local read sees through the copies it
+// reads, setting slot to the slot that still holds it. A copy is a
+// local read or a store of one. stack holds the value in each slot at
+// the read, so a copy whose slot was stored to or popped since is not
+// followed
+static int forwardCopy(Ir *ir, int value, uint8_t *slot, int *stack,
+                       int depth) {
+  for (;;) {
+    IrInstruction *copy = &ir->instructions[value];
+    if (copy->op == IR_SET_LOCAL)
+      copy = &ir->instructions[copy->a];
+    if (copy->op != IR_GET_LOCAL || copy->slot >= depth ||
+        stack[copy->slot] != copy->source)
+      return value;
+    *slot = copy->slot;
+    value = copy->source;
+  }
+}
+
+// forwardCopies points every local read whose slot holds a copy of
+// another local at the slot it was copied from, while that slot is
+// unchanged, so chains of copies read the original. Slots only name
+// values within a block, params stand for them on entry
+static int forwardCopies(Ir *ir) {
+  int *stack = ARENA_ALLOCATE(int, ir->chunk->maxStackDepth + 1,
+                              MEM_COMPILER);
+  int rewrites = 0;
+
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable)
+      continue;
+
+    int depth = 0;
+    for (int j = block->start; j < block->end; j++) {
+      IrInstruction *instruction = &ir->instructions[j];
+      if (instruction->dead)
+        continue;
+
+      switch (instruction->op) {
+      case IR_GET_LOCAL: {
+        uint8_t slot = instruction->slot;
+        int source =
+            forwardCopy(ir, instruction->source, &slot, stack, depth);
+        if (source != instruction->source) {
+          instruction->slot = slot;
+          instruction->source = source;
+          rewrites++;
+        }
+        break;
+      }
+      case IR_SET_LOCAL:
+        stack[instruction->slot] = j;
+        stack[depth - 1] = j;
+        continue;
+      case IR_SET_GLOBAL:
+        stack[depth - 1] = j;
+        continue;
+      case IR_DEFINE_GLOBAL:
+      case IR_PRINT:
+      case IR_POP:
+        depth--;
+        continue;
+      default:
+        depth -= irOperandCount(instruction->op);
+        break;
+      }
+      stack[depth++] = j;
+    }
+  }
+
+  ARENA_FREE_ARRAY(int, stack, ir->chunk->maxStackDepth + 1, MEM_COMPILER);
+  return rewrites;
+}
+
+// propagateCopies finds the values that are one constant whatever path
+// the code takes, following them through local and global variables and
+// through params from every predecessor, and folds the operators on
+// them. Branches on a constant only pass values down the side they
+// take. Globals are unknown on entry, an earlier chunk may have set
+// them. Each such load or operator whose operands can go becomes the
+// constant. The local reads left then skip the copies between them and
+// the value they read
+static int propagateCopies(Ir *ir) {
+  int globalCount = vm.globalCount;
+  Cell *cells = ARENA_ALLOCATE(Cell, ir->count, MEM_COMPILER);
+  Cell *entries = ARENA_ALLOCATE(Cell, ir->blockCount * globalCount + 1,
+                                 MEM_COMPILER);
+  Cell *globals = ARENA_ALLOCATE(Cell, globalCount + 1, MEM_COMPILER);
+  bool *executable = ARENA_ALLOCATE(bool, ir->blockCount, MEM_COMPILER);
+
+  for (int i = 0; i < ir->count; i++)
+    cells[i] = (Cell){CELL_UNSEEN, NIL_VAL};
+  for (int i = 0; i < ir->blockCount * globalCount; i++)
+    entries[i] = (Cell){i < globalCount ? CELL_UNKNOWN : CELL_UNSEEN,
+                        NIL_VAL};
+  memset(executable, 0, sizeof(bool) * ir->blockCount);
+  executable[0] = true;
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = 0; i < ir->blockCount; i++) {
+      IrBlock *block = &ir->blocks[i];
+      if (!block->reachable || !executable[i])
+        continue;
+
+      memcpy(globals, &entries[i * globalCount], sizeof(Cell) * globalCount);
+      for (int j = block->start; j < block->end; j++) {
+        IrInstruction *instruction = &ir->instructions[j];
+        if (instruction->dead || instruction->op == IR_PARAM)
+          continue;
+        changed |= meet(&cells[j], transfer(instruction, cells, globals));
+      }
+
+      bool takesNext = block->next != -1, takesTarget = block->target != -1;
+      if (block->terminator == IR_BRANCH) {
+        Cell condition = cells[block->condition];
+        takesNext = condition.state == CELL_UNKNOWN ||
+                    (condition.state == CELL_CONSTANT &&
+                     !isFalsey(condition.value));
+        takesTarget = condition.state == CELL_UNKNOWN ||
+                      (condition.state == CELL_CONSTANT &&
+                       isFalsey(condition.value));
+      }
+      if (takesNext)
+        changed |= flow(ir, block, block->next, cells, globals, entries,
+                        executable);
+      if (takesTarget)
+        changed |= flow(ir, block, block->target, cells, globals, entries,
+                        executable);
+    }
+  }
+
+  bool *safe = ARENA_ALLOCATE(bool, ir->count, MEM_COMPILER);
+  for (int i = 0; i < ir->count; i++)
+    safe[i] = cells[i].state == CELL_CONSTANT;
+
+  int rewrites = 0;
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable || !executable[i])
+      continue;
+
+    for (int j = block->start; j < block->end; j++) {
+      IrInstruction *instruction = &ir->instructions[j];
+      if (instruction->dead || !safe[j] ||
+          (instruction->op != IR_GET_LOCAL &&
+           instruction->op != IR_GET_GLOBAL &&
+           !irIsOperator(instruction->op)) ||
+          !irRemovable(ir, j, safe))
+        continue;
+
+      if (instruction->a != -1)
+        irRemoveTree(ir, instruction->a);
+      if (instruction->b != -1)
+        irRemoveTree(ir, instruction->b);
+      instruction->op = IR_CONSTANT;
+      instruction->value = cells[j].value;
+      instruction->a = instruction->b = instruction->source = -1;
+      rewrites++;
+    }
+  }
+
+  ARENA_FREE_ARRAY(bool, safe, ir->count, MEM_COMPILER);
+  ARENA_FREE_ARRAY(bool, executable, ir->blockCount, MEM_COMPILER);
+  ARENA_FREE_ARRAY(Cell, globals, globalCount + 1, MEM_COMPILER);
+  ARENA_FREE_ARRAY(Cell, entries, ir->blockCount * globalCount + 1,
+                   MEM_COMPILER);
+  ARENA_FREE_ARRAY(Cell, cells, ir->count, MEM_COMPILER);
+  return rewrites + forwardCopies(ir);
+}
+
+// -------------------- Common subexpressions
+
+// A computation seen earlier in the block, operands by value number
+typedef struct {
+  uint8_t op;
+  int a, b;
+  Value value; // Of a constant
+  int number;
+} Expression;
+
+// Operators whose operands can swap without changing the result
+static bool commutes(uint8_t op) {
+  return op == IR_EQUAL || op == IR_MULTIPLY;
+}
+
+// The computations of the blocks numbered so far, indexed by a hash
+// table. Those before blockStart belong to earlier blocks and count as
+// empty slots, so the table is never cleared
+typedef struct {
+  Expression *expressions;
+  int count;
+  int blockStart;
+  int *slots; // Open addressed, -1 or an expression
+  int capacity;
+  int nextNumber;
+} Numbering;
+
+// hashExpression mixes the operation and its operands, or a constant's
+// bits
+static uint32_t hashExpression(Expression *expression) {
+  uint64_t key = (uint64_t)expression->op << 56;
+  if (expression->op == IR_CONSTANT) {
+    Value value = expression->value;
+    if (IS_BOOL(value))
+      key ^= AS_BOOL(value);
+    else if (IS_INT(value))
+      key ^= (uint32_t)AS_INT(value) + 0x100000000ull;
+    else if (IS_NUMBER(value)) {
+      double number = AS_NUMBER(value);
+      uint64_t bits;
+      memcpy(&bits, &number, sizeof(bits));
+      key ^= bits;
+    } else if (IS_OBJ(value))
+      key ^= (uintptr_t)AS_OBJ(value);
+  } else {
+    key ^= (uint64_t)(uint32_t)expression->a << 24 ^ (uint32_t)expression->b;
+  }
+  key *= 0x9e3779b97f4a7c15ull;
+  return (uint32_t)(key >> 32);
+}
+
+// numberExpression returns the value number of a computation, a new one
+// if the block has not computed it before. found says which
+static int numberExpression(Numbering *numbering, Expression expression,
+                            bool *found) {
+  uint32_t mask = (uint32_t)numbering->capacity - 1;
+  uint32_t index = hashExpression(&expression) & mask;
+  for (;; index = (index + 1) & mask) {
+    int slot = numbering->slots[index];
+    if (slot < numbering->blockStart)
+      break;
+
+    Expression *seen = &numbering->expressions[slot];
+    if (seen->op == expression.op && seen->a == expression.a &&
+        seen->b == expression.b &&
+        (expression.op != IR_CONSTANT ||
+         irSameValue(seen->value, expression.value))) {
+      *found = true;
+      return seen->number;
+    }
+  }
+
+  *found = false;
+  expression.number = numbering->nextNumber++;
+  numbering->slots[index] = numbering->count;
+  numbering->expressions[numbering->count++] = expression;
+  return expression.number;
+}
+
+// eliminateCommonSubexpressions numbers the values of each block, equal
+// numbers for values known equal: copies through locals, repeated
+// operators on equal operands, repeated loads of a global with no store
+// between. The VM has no instruction to duplicate a value, so a repeated
+// operator or global load is only replaced when its value already sits
+// in a stack slot below it, a local or a temporary of the enclosing
+// expression, and becomes a load of that slot
+static int eliminateCommonSubexpressions(Ir *ir) {
+  int globalCount = vm.globalCount;
+  int *numbers = ARENA_ALLOCATE(int, ir->count, MEM_COMPILER);
+  bool *safe = ARENA_ALLOCATE(bool, ir->count, MEM_COMPILER);
+  Numbering numbering = {.count = 0, .capacity = 8, .nextNumber = 0};
+  while (numbering.capacity < ir->count * 2)
+    numbering.capacity *= 2;
+  numbering.expressions = ARENA_ALLOCATE(Expression, ir->count, MEM_COMPILER);
+  numbering.slots = ARENA_ALLOCATE(int, numbering.capacity, MEM_COMPILER);
+  for (int i = 0; i < numbering.capacity; i++)
+    numbering.slots[i] = -1;
+  int *globals = ARENA_ALLOCATE(int, globalCount + 1, MEM_COMPILER);
+  int *stack = ARENA_ALLOCATE(int, ir->chunk->maxStackDepth + 1,
+                              MEM_COMPILER);
+  memset(safe, 0, sizeof(bool) * ir->count);
+  int rewrites = 0;
+
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable)
+      continue;
+
+    numbering.blockStart = numbering.count;
+    int depth = 0;
+    for (int global = 0; global < globalCount; global++)
+      globals[global] = -1;
+
+    for (int j = block->start; j < block->end; j++) {
+      IrInstruction *instruction = &ir->instructions[j];
+      if (instruction->dead)
+        continue;
+
+      bool found = false;
+      switch (instruction->op) {
+      case IR_PARAM:
+        numbers[j] = numbering.nextNumber++;
+        stack[depth++] = j;
+        continue;
+      case IR_CONSTANT:
+        numbers[j] = numberExpression(
+            &numbering,
+            (Expression){IR_CONSTANT, -1, -1, instruction->value, 0}, &found);
+        stack[depth++] = j;
+        continue;
+      case IR_GET_LOCAL:
+        numbers[j] = numbers[stack[instruction->slot]];
+        stack[depth++] = j;
+        continue;
+      case IR_SET_LOCAL:
+        numbers[j] = numbers[instruction->a];
+        stack[instruction->slot] = j;
+        stack[depth - 1] = j;
+        continue;
+      case IR_SET_GLOBAL:
+        numbers[j] = globals[instruction->slot] = numbers[instruction->a];
+        stack[depth - 1] = j;
+        continue;
+      case IR_DEFINE_GLOBAL:
+        globals[instruction->slot] = numbers[instruction->a];
+        depth--;
+        continue;
+      case IR_PRINT:
+      case IR_POP:
+        depth--;
+        continue;
+      case IR_GET_GLOBAL:
+        // A global read or stored earlier in the block is defined
+        found = globals[instruction->slot] != -1;
+        if (!found)
+          globals[instruction->slot] = numbering.nextNumber++;
+        numbers[j] = globals[instruction->slot];
+        break;
+      default: {
+        int operands = irOperandCount(instruction->op);
+        depth -= operands;
+        int a = numbers[instruction->a];
+        int b = operands == 2 ? numbers[instruction->b] : -1;
+        if (commutes(instruction->op) && b < a) {
+          int swap = a;
+          a = b;
+          b = swap;
+        }
+        numbers[j] = numberExpression(
+            &numbering, (Expression){instruction->op, a, b, NIL_VAL, 0},
+            &found);
+        break;
+      }
+      }
+
+      // An operator equal to one that ran before cannot fail either.
+      // depth is where the tree of the value starts on the stack
+      safe[j] = found;
+      int home = depth - 1;
+      while (home >= 0 && numbers[stack[home]] != numbers[j])
+        home--;
+      if (found && home >= 0 && irRemovable(ir, j, safe)) {
+        if (instruction->a != -1)
+          irRemoveTree(ir, instruction->a);
+        if (instruction->b != -1)
+          irRemoveTree(ir, instruction->b);
+        instruction->op = IR_GET_LOCAL;
+        instruction->slot = (uint8_t)home;
+        instruction->source = stack[home];
+        instruction->a = instruction->b = -1;
+        rewrites++;
+      }
+      stack[depth++] = j;
+    }
+  }
+
+  ARENA_FREE_ARRAY(int, stack, ir->chunk->maxStackDepth + 1, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, globals, globalCount + 1, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, numbering.slots, numbering.capacity, MEM_COMPILER);
+  ARENA_FREE_ARRAY(Expression, numbering.expressions, ir->count,
+                   MEM_COMPILER);
+  ARENA_FREE_ARRAY(bool, safe, ir->count, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, numbers, ir->count, MEM_COMPILER);
+  return rewrites;
+}
+
+// -------------------- Dead code
+
+// markReachable marks the blocks a path from the first one reaches
+static void markReachable(Ir *ir) {
+  int *worklist = ARENA_ALLOCATE(int, ir->blockCount, MEM_COMPILER);
+  int worklistCount = 0;
+  for (int i = 0; i < ir->blockCount; i++)
+    ir->blocks[i].reachable = false;
+  ir->blocks[0].reachable = true;
+  worklist[worklistCount++] = 0;
+
+  while (worklistCount > 0) {
+    IrBlock *block = &ir->blocks[worklist[--worklistCount]];
+    int successors[] = {block->next, block->target};
+    for (int i = 0; i < 2; i++) {
+      if (successors[i] != -1 && !ir->blocks[successors[i]].reachable) {
+        ir->blocks[successors[i]].reachable = true;
+        worklist[worklistCount++] = successors[i];
+      }
+    }
+  }
+  ARENA_FREE_ARRAY(int, worklist, ir->blockCount, MEM_COMPILER);
+}
+
+// lastLive returns the last live instruction of a range, or -1
+static int lastLive(Ir *ir, int start, int end) {
+  for (int i = end - 1; i >= start; i--)
+    if (!ir->instructions[i].dead)
+      return i;
+  return -1;
+}
+
+// firstLive returns the first live instruction of a block after its
+// params, or -1
+static int firstLive(Ir *ir, IrBlock *block) {
+  for (int i = block->start + block->depth; i < block->end; i++)
+    if (!ir->instructions[i].dead)
+      return i;
+  return -1;
+}
+
+// isLocalRead checks if an instruction reads or writes a local's slot,
+// rather than a global's
+static bool isLocalRead(IrInstruction *instruction) {
+  return instruction->op == IR_GET_LOCAL || instruction->op == IR_SET_LOCAL;
+}
+
+// removeUnreadLocals drops the locals of a block no instruction reads
+// between their definition and the pop that ends their scope, copies
+// the reads were forwarded past among them. The slots above one move
+// down, so the reads of those are renumbered
+static int removeUnreadLocals(Ir *ir, IrBlock *block, int *slots) {
+  int rewrites = 0;
+  int depth = 0;
+  for (int j = block->start; j < block->end; j++) {
+    IrInstruction *instruction = &ir->instructions[j];
+    if (instruction->dead)
+      continue;
+
+    switch (instruction->op) {
+    case IR_SET_LOCAL:
+    case IR_SET_GLOBAL:
+      slots[j] = depth - 1;
+      continue;
+    case IR_DEFINE_GLOBAL:
+    case IR_PRINT:
+      depth--;
+      continue;
+    case IR_POP:
+      depth--;
+      break;
+    default:
+      depth -= irOperandCount(instruction->op);
+      slots[j] = depth++;
+      continue;
+    }
+
+    int local = instruction->a;
+    if (local < block->start + block->depth ||
+        !irRemovable(ir, local, NULL))
+      continue;
+    bool read = false;
+    for (int k = local + 1; k < j && !read; k++)
+      read = !ir->instructions[k].dead &&
+             isLocalRead(&ir->instructions[k]) &&
+             ir->instructions[k].source == local;
+    if (read)
+      continue;
+
+    for (int k = local + 1; k < j; k++) {
+      IrInstruction *above = &ir->instructions[k];
+      if (above->dead || slots[k] <= slots[local])
+        continue;
+      slots[k]--;
+      if (isLocalRead(above) && above->slot > slots[local])
+        above->slot--;
+    }
+    irRemoveTree(ir, local);
+    instruction->dead = true;
+    rewrites++;
+  }
+  return rewrites;
+}
+
+// eliminateDeadCode turns branches on a constant into jumps and drops
+// the blocks no path reaches any longer. A value a block leaves on the
+// stack only for its one successor to pop first thing goes with the
+// pop, the way the condition of a folded branch does, and so does every
+// statement popping a value that has no effect and cannot fail, and
+// every local nothing reads
+static int eliminateDeadCode(Ir *ir) {
+  int rewrites = 0;
+
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable || block->terminator != IR_BRANCH ||
+        ir->instructions[block->condition].op != IR_CONSTANT)
+      continue;
+
+    bool falsey = isFalsey(ir->instructions[block->condition].value);
+    block->terminator = IR_JUMP;
+    block->target = falsey ? block->target : block->next;
+    block->next = -1;
+    rewrites++;
+  }
+  markReachable(ir);
+
+  int *predecessors = ARENA_ALLOCATE(int, ir->blockCount, MEM_COMPILER);
+  memset(predecessors, 0, sizeof(int) * ir->blockCount);
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable)
+      continue;
+    if (block->next != -1)
+      predecessors[block->next]++;
+    if (block->target != -1)
+      predecessors[block->target]++;
+  }
+
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable || block->terminator == IR_BRANCH ||
+        block->terminator == IR_RETURN || block->exitDepth == 0)
+      continue;
+
+    int successor = block->terminator == IR_JUMP ? block->target
+                                                 : block->next;
+    IrBlock *to = &ir->blocks[successor];
+    int top = block->exit[block->exitDepth - 1];
+    int pop = firstLive(ir, to);
+    if (predecessors[successor] != 1 || pop == -1 ||
+        ir->instructions[pop].op != IR_POP ||
+        ir->instructions[pop].a != to->start + to->depth - 1 ||
+        lastLive(ir, block->start, block->end) != top ||
+        !irRemovable(ir, top, NULL))
+      continue;
+
+    irRemoveTree(ir, top);
+    ir->instructions[pop].dead = true;
+    ir->instructions[to->start + to->depth - 1].dead = true;
+    block->exitDepth--;
+    to->depth--;
+    rewrites++;
+  }
+
+  for (int i = 0; i < ir->blockCount; i++) {
+    IrBlock *block = &ir->blocks[i];
+    if (!block->reachable)
+      continue;
+
+    for (bool removed = true; removed;) {
+      removed = false;
+      for (int j = block->start; j < block->end; j++) {
+        IrInstruction *instruction = &ir->instructions[j];
+        if (instruction->dead || instruction->op != IR_POP ||
+            lastLive(ir, block->start, j) != instruction->a ||
+            !irRemovable(ir, instruction->a, NULL))
+          continue;
+
+        irRemoveTree(ir, instruction->a);
+        instruction->dead = true;
+        removed = true;
+        rewrites++;
+      }
+    }
+  }
+
+  int *slots = ARENA_ALLOCATE(int, ir->count, MEM_COMPILER);
+  for (int i = 0; i < ir->blockCount; i++)
+    if (ir->blocks[i].reachable)
+      rewrites += removeUnreadLocals(ir, &ir->blocks[i], slots);
+
+  ARENA_FREE_ARRAY(int, slots, ir->count, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, predecessors, ir->blockCount, MEM_COMPILER);
+  return rewrites;
+}
+
+// -------------------- Pass manager
+
+// optimizeChunk runs the passes of optimizationLevel over the IR of a
+// verified chunk and lowers it back. Chunks the IR cannot represent or
+// lower are left as they were. Returns false if the lowered chunk fails
+// verification
+bool optimizeChunk(Chunk *chunk) {
+  if (optimizationLevel == 0)
+    return true;
+
+  double start = milliseconds();
+  Ir ir;
+  if (!buildIr(&ir, chunk)) {
+    optimizerStats.chunksSkipped++;
+    return true;
+  }
+  optimizerStats.buildMilliseconds += milliseconds() - start;
+  if (dumpIr)
+    printIr(&ir, "built", stderr);
+
+  for (int i = 0; i < OPTIMIZER_PASSES; i++) {
+    if (passes[i].level > optimizationLevel)
+      continue;
+
+    PassStats *stats = &optimizerStats.passes[i];
+    start = milliseconds();
+    stats->rewrites += passes[i].run(&ir);
+    stats->milliseconds += milliseconds() - start;
+    if (dumpIr)
+      printIr(&ir, passes[i].name, stderr);
+  }
+
+  int before = countInstructions(chunk);
+  start = milliseconds();
+  bool lowered = lowerIr(&ir);
+  optimizerStats.lowerMilliseconds += milliseconds() - start;
+  freeIr(&ir);
+  if (!lowered) {
+    optimizerStats.chunksSkipped++;
+    return true;
+  }
+
+  optimizerStats.chunksOptimized++;
+  optimizerStats.instructionsBefore += before;
+  optimizerStats.instructionsAfter += countInstructions(chunk);
+
+#ifdef DEBUG_PRINT_CODE
+  dissassembleChunk(chunk, "optimized");
+#endif
+
+  return verifyChunk(chunk);
+}
+
+// printOptimizerStats writes the time each pass took and what it changed
+// over every chunk
+void printOptimizerStats(FILE *out) {
+  fprintf(out, "optimizer: -O%d, %d chunks optimized, %d left as compiled\n",
+          optimizationLevel, optimizerStats.chunksOptimized,
+          optimizerStats.chunksSkipped);
+  fprintf(out, "optimizer: %-22s %8.3f ms\n", "build",
+          optimizerStats.buildMilliseconds);
+  for (int i = 0; i < OPTIMIZER_PASSES; i++) {
+    if (passes[i].level > optimizationLevel)
+      continue;
+    fprintf(out, "optimizer: %-22s %8.3f ms %6d rewrites\n", passes[i].name,
+            optimizerStats.passes[i].milliseconds,
+            optimizerStats.passes[i].rewrites);
+  }
+  fprintf(out, "optimizer: %-22s %8.3f ms\n", "lower",
+          optimizerStats.lowerMilliseconds);
+  fprintf(out, "optimizer: %d instructions into %d\n",
+          optimizerStats.instructionsBefore, optimizerStats.instructionsAfter);
+}
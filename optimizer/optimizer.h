@@ -0,0 +1,42 @@
+#ifndef vm_optimizer_h
+#define vm_optimizer_h
+
+#include "../chunk/chunk.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// Passes the pass manager knows, in the order they run
+#define OPTIMIZER_PASSES 3
+
+// Counters of one pass over every chunk it ran on
+typedef struct {
+  double milliseconds;
+  int rewrites; // Instructions, branches or blocks it changed
+} PassStats;
+
+// Counters over every chunk offered to the optimizer
+typedef struct {
+  int chunksOptimized;
+  int chunksSkipped; // Chunks the IR cannot represent or lower
+  // Bytecode instructions of the optimized chunks before and after
+  int instructionsBefore;
+  int instructionsAfter;
+  double buildMilliseconds;
+  double lowerMilliseconds;
+  PassStats passes[OPTIMIZER_PASSES];
+} OptimizerStats;
+
+// 0 leaves the chunk as compiled. 1 propagates constants through
+// variables and removes dead code, 2 also reuses repeated expressions
+extern int optimizationLevel;
+// When true the passes' counters are reported on stderr at exit
+extern bool optimizerVerbose;
+// When true the IR is written to stderr after it is built and after
+// every pass
+extern bool dumpIr;
+extern OptimizerStats optimizerStats;
+
+bool optimizeChunk(Chunk *chunk);
+void printOptimizerStats(FILE *out);
+
+#endif
@@ -3,8 +3,9 @@
 # Navigate to the vm directory
 cd "$(dirname "$0")"
 
-# Find all .c files in the current directory and subdirectories
-C_FILES=$(find . -name "*.c")
+# Find all .c files in the current directory and subdirectories, the
+# benchmarks in bench have mains of their own
+C_FILES=$(find . -name "*.c" -not -path "./bench/*")
 
 # Create a string of all .c files for compilation
 C_FILES_STRING=$(echo $C_FILES | tr '\n' ' ')
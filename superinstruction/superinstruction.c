@@ -0,0 +1,237 @@
+#include "superinstruction.h"
+#include "../memory/memory.h"
+#include "../verifier/verifier.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DEBUG_PRINT_CODE
+#include "../debug/debug.h"
+#endif
+
+// A superinstruction replaces a straight line opcode sequence. Its
+// operands are the operands of the sequence in order, a jump operand is
+// relative to the end of the superinstruction
+typedef struct Superinstruction {
+  uint8_t sequence[SUPERINSTRUCTION_MAX];
+  int length;
+  uint8_t fused;
+} Superinstruction;
+
+// The fused set, longest sequences first. Candidates are ranked from
+// profiles of real scripts by tools/superinstructions.py
+static const Superinstruction superinstructions[] = {
+    {{OP_GET_LOCAL, OP_CONSTANT, OP_LESS, OP_JUMP_IF_FALSE, OP_POP},
+     5,
+     OP_LESS_LOCAL_CONSTANT_JUMP},
+    {{OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP},
+     5,
+     OP_ADD_LOCAL_CONSTANT},
+    {{OP_LESS_RK, OP_JUMP_IF_FALSE, OP_POP}, 3, OP_LESS_RK_JUMP},
+    {{OP_EQUAL, OP_NOT}, 2, OP_NOT_EQUAL},
+    {{OP_LESS, OP_NOT}, 2, OP_NOT_LESS},
+    {{OP_GREATOR, OP_NOT}, 2, OP_NOT_GREATOR},
+    {{OP_SET_GLOBAL_SLOT, OP_POP}, 2, OP_SET_GLOBAL_SLOT_POP},
+    {{OP_SET_LOCAL, OP_POP}, 2, OP_SET_LOCAL_POP},
+};
+
+bool superinstructionsEnabled = true;
+
+// Jump patched in the fused code once every new offset is known
+typedef struct Fixup {
+  int operand;        // new offset of the two byte jump operand
+  int instructionEnd; // new offset the jump is relative to
+  int target;         // old offset of the jump target
+  int sign;           // 1 for forward jumps, -1 for loops
+} Fixup;
+
+// jumpSign returns the direction of a jump instruction or 0
+static int jumpSign(uint8_t instruction) {
+  switch (instruction) {
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+    return 1;
+  case OP_LOOP:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+// jumpTarget returns the offset a plain jump at offset lands on
+static int jumpTarget(Chunk *chunk, int offset) {
+  uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) |
+                             chunk->code[offset + 2]);
+  return offset + 3 + jumpSign(chunk->code[offset]) * jump;
+}
+
+// endsBlock checks if execution never falls through an instruction
+static bool endsBlock(uint8_t instruction) {
+  return instruction == OP_JUMP || instruction == OP_LOOP ||
+         instruction == OP_RETURN;
+}
+
+// findJumpTargets marks every offset a jump lands on
+static bool *findJumpTargets(Chunk *chunk) {
+  bool *targets = ARENA_ALLOCATE(bool, chunk->count + 1, MEM_COMPILER);
+  memset(targets, 0, sizeof(bool) * (chunk->count + 1));
+
+  for (int offset = 0; offset < chunk->count;) {
+    if (jumpSign(chunk->code[offset]) != 0)
+      targets[jumpTarget(chunk, offset)] = true;
+    offset += instructionLength(chunk->code[offset]);
+  }
+
+  return targets;
+}
+
+// matchSuperinstruction returns the superinstruction starting at offset
+// or NULL, no jump may land inside the replaced sequence
+static const Superinstruction *matchSuperinstruction(Chunk *chunk, int offset,
+                                                     bool *targets) {
+  int count = sizeof(superinstructions) / sizeof(superinstructions[0]);
+
+  for (int i = 0; i < count; i++) {
+    const Superinstruction *candidate = &superinstructions[i];
+    int position = offset;
+    int matched = 0;
+
+    while (matched < candidate->length && position < chunk->count &&
+           chunk->code[position] == candidate->sequence[matched] &&
+           (matched == 0 || !targets[position])) {
+      position += instructionLength(chunk->code[position]);
+      matched++;
+    }
+
+    if (matched == candidate->length)
+      return candidate;
+  }
+
+  return NULL;
+}
+
+// fuseSuperinstructions rewrites the finished chunk replacing every
+// fusable sequence by its superinstruction and relocating jumps, the
+// result is verified again. Returns false if it fails verification
+bool fuseSuperinstructions(Chunk *chunk) {
+  bool *targets = findJumpTargets(chunk);
+  int *newOffsets = ARENA_ALLOCATE(int, chunk->count + 1, MEM_COMPILER);
+  Fixup *fixups = ARENA_ALLOCATE(Fixup, chunk->count, MEM_COMPILER);
+  uint8_t *code = ARENA_ALLOCATE(uint8_t, chunk->capacity, MEM_CHUNK_CODE);
+  int *lines = ARENA_ALLOCATE(int, chunk->capacity, MEM_CHUNK_LINES);
+  int fixupCount = 0;
+  int fusedCount = 0;
+  int count = 0;
+
+  for (int offset = 0; offset < chunk->count;) {
+    const Superinstruction *fused =
+        matchSuperinstruction(chunk, offset, targets);
+    int components = fused != NULL ? fused->length : 1;
+    int start = count;
+    int firstFixup = fixupCount;
+
+    if (fused != NULL) {
+      code[count] = fused->fused;
+      lines[count++] = chunk->lines[offset];
+      fusedCount++;
+    }
+
+    // Copy each instruction, or only its operands when fusing
+    for (int i = 0; i < components; i++) {
+      uint8_t instruction = chunk->code[offset];
+      int length = instructionLength(instruction);
+      newOffsets[offset] = start;
+
+      if (fused == NULL) {
+        code[count] = instruction;
+        lines[count++] = chunk->lines[offset];
+      }
+
+      if (jumpSign(instruction) != 0)
+        fixups[fixupCount++] = (Fixup){count, 0, jumpTarget(chunk, offset),
+                                       jumpSign(instruction)};
+      else
+        memcpy(&code[count], &chunk->code[offset + 1], length - 1);
+      // runtimeError() reads the line of an instruction's last byte
+      for (int byte = 1; byte < length; byte++)
+        lines[count++] = chunk->lines[offset + byte];
+      offset += length;
+    }
+
+    for (int i = firstFixup; i < fixupCount; i++)
+      fixups[i].instructionEnd = count;
+  }
+  newOffsets[chunk->count] = count;
+
+  for (int i = 0; i < fixupCount; i++) {
+    Fixup *fixup = &fixups[i];
+    int jump = fixup->sign * (newOffsets[fixup->target] - fixup->instructionEnd);
+    code[fixup->operand] = (jump >> 8) & 0xff;
+    code[fixup->operand + 1] = jump & 0xff;
+  }
+
+  ARENA_FREE_ARRAY(bool, targets, chunk->count + 1, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, newOffsets, chunk->count + 1, MEM_COMPILER);
+  ARENA_FREE_ARRAY(Fixup, fixups, chunk->count, MEM_COMPILER);
+  ARENA_FREE_ARRAY(uint8_t, chunk->code, chunk->capacity, MEM_CHUNK_CODE);
+  ARENA_FREE_ARRAY(int, chunk->lines, chunk->capacity, MEM_CHUNK_LINES);
+  chunk->code = code;
+  chunk->lines = lines;
+  chunk->count = count;
+
+#ifdef DEBUG_PRINT_CODE
+  if (fusedCount > 0)
+    dissassembleChunk(chunk, "fused");
+#endif
+
+  return fusedCount == 0 || verifyChunk(chunk);
+}
+
+// writeOpcodeProfile writes every static opcode sequence of up to
+// SUPERINSTRUCTION_MAX instructions that a superinstruction could
+// replace, weighted by how often it ran. Lines are
+// `ngram <runs> <start> <end> <opcode>...` with the byte range of the
+// sequence and are aggregated over a corpus by tools/superinstructions.py.
+// Quickened instructions are written as the generic ones the compiler
+// emitted, the fusion pass only ever sees those
+void writeOpcodeProfile(Chunk *chunk, const uint64_t *executions, FILE *out) {
+  bool *targets = findJumpTargets(chunk);
+  uint64_t total = 0;
+
+  for (int offset = 0; offset < chunk->count;
+       offset += instructionLength(chunk->code[offset]))
+    total += executions[offset];
+  fprintf(out, "total %llu\n", (unsigned long long)total);
+
+  for (int offset = 0; offset < chunk->count;
+       offset += instructionLength(chunk->code[offset])) {
+    uint64_t runs = executions[offset];
+    int position = offset;
+
+    for (int length = 1; runs > 0 && length <= SUPERINSTRUCTION_MAX;
+         length++) {
+      uint8_t instruction = chunk->code[position];
+      if (executions[position] < runs)
+        runs = executions[position];
+
+      position += instructionLength(instruction);
+
+      if (length > 1) {
+        fprintf(out, "ngram %llu %d %d", (unsigned long long)runs, offset,
+                position);
+        for (int op = offset; op < position;
+             op += instructionLength(chunk->code[op]))
+          fprintf(out, " %d", genericInstruction(chunk->code[op]));
+        fprintf(out, "\n");
+      }
+
+      if (endsBlock(instruction) || position >= chunk->count ||
+          targets[position])
+        break;
+    }
+  }
+
+  ARENA_FREE_ARRAY(bool, targets, chunk->count + 1, MEM_COMPILER);
+}
@@ -0,0 +1,17 @@
+#ifndef vm_superinstruction_h
+#define vm_superinstruction_h
+
+#include "../chunk/chunk.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Longest opcode sequence a superinstruction replaces
+#define SUPERINSTRUCTION_MAX 5
+
+// When false interpret() runs the chunk exactly as compiled
+extern bool superinstructionsEnabled;
+
+bool fuseSuperinstructions(Chunk *chunk);
+void writeOpcodeProfile(Chunk *chunk, const uint64_t *executions, FILE *out);
+
+#endif
@@ -7,115 +7,218 @@
 
 #include "../memory/memory.h"
 #include "../object/object.h"
+#include "../virtual_machine/vm.h"
 #include "table.h"
 
-#define TABLE_MAX_LOAD 0.75
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Each control byte tells what its entry holds: nothing, a tombstone,
+// or a key with the low 7 bits of its hash. Lookups compare a group of
+// 16 control bytes at once and only look at the entries that match
+#define GROUP_SIZE 16
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+#define IS_FULL(control) ((control) < 0x80)
+
+// Keys and tombstones fill at most this share of a table
+#define TABLE_MAX_LOAD 0.875
+#define TABLE_MIN_CAPACITY GROUP_SIZE
+// Random keys filling two million entries to the highest load probe 14
+// to 18 groups at most. An insert that probes past this many is taken
+// for keys made to collide, and the table picks a new seed
+#ifndef TABLE_PROBE_LIMIT
+#define TABLE_PROBE_LIMIT 32
+#endif
+
+// The low 7 bits of a key's hash go to its control byte, the rest pick
+// the group its probe starts at
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash)&0x7f))
+
+// The entries and their control bytes share one block
+#define TABLE_BYTES(capacity) ((size_t)(capacity) * (sizeof(Entry) + 1))
+
+// GroupMask has bit i set for the entries of a group matched at i
+typedef uint32_t GroupMask;
+
+#ifdef __SSE2__
+// matchByte compares the 16 control bytes of a group at once
+static inline GroupMask matchByte(const uint8_t *group, uint8_t byte) {
+  __m128i control = _mm_loadu_si128((const __m128i *)group);
+  return (GroupMask)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+}
+
+// matchFree finds the empty and deleted entries, the only control bytes
+// with the high bit set
+static inline GroupMask matchFree(const uint8_t *group) {
+  return (GroupMask)_mm_movemask_epi8(
+      _mm_loadu_si128((const __m128i *)group));
+}
+#else
+static inline GroupMask matchByte(const uint8_t *group, uint8_t byte) {
+  GroupMask mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++)
+    mask |= (GroupMask)(group[i] == byte) << i;
+  return mask;
+}
+
+static inline GroupMask matchFree(const uint8_t *group) {
+  GroupMask mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++)
+    mask |= (GroupMask)(group[i] >> 7) << i;
+  return mask;
+}
+#endif
+
+// Probes visit groups 0, 1, 3, 6... after the first one. With a power of
+// two group count that reaches every group
+#define FIRST_GROUP(table, hash) \
+  (H1(hash) & ((uint32_t)(table)->capacity / GROUP_SIZE - 1))
+#define NEXT_GROUP(table, group, step) \
+  (((group) + (step)) & ((uint32_t)(table)->capacity / GROUP_SIZE - 1))
 
 // initTable initializes the empty hash table
 void initTable(Table *tb) {
   tb->count = 0;
+  tb->tombstones = 0;
   tb->capacity = 0;
+  tb->reseeds = 0;
+  tb->reseededAt = 0;
+  tb->seed = 0;
   tb->entries = NULL;
+  tb->control = NULL;
 }
 
 // freeTable frees the current hash table
 void freeTable(Table *tb) {
-  FREE_ARRAY(Entry, tb->entries, tb->count);
+  FREE_ARRAY(uint8_t, tb->entries, TABLE_BYTES(tb->capacity), MEM_TABLE);
   initTable(tb);
 }
 
-// findEntry function finds a value in the hash table
-static Entry *findEntry(Entry *entries, int capacity, ObjString *key) {
-  uint32_t index = key->hash % capacity;
-
-  Entry *tombstone = NULL;
-
-  for (;;) {
-    Entry *entry = &entries[index];
-    if (entry->key == NULL) {
-      // Check if it is a tombstone
-      if (IS_NIL(entry->value)) {
-        // Enpty value
-        return tombstone != NULL ? tombstone : entry;
-      } else {
-        // Found a tombstone
-        if (tombstone == NULL)
-          tombstone = entry;
-      }
-    }
-    if (entry->key == key) {
-      return entry;
+// findKey returns the index of key's entry, or -1. The probe ends at the
+// first group with an empty entry, key would have gone there
+static int findKey(Table *table, ObjString *key) {
+  uint32_t hash = TABLE_HASH(table, key->hash);
+  uint32_t group = FIRST_GROUP(table, hash);
+  for (uint32_t step = 1;; step++) {
+    uint8_t *control = &table->control[group * GROUP_SIZE];
+    for (GroupMask match = matchByte(control, H2(hash)); match != 0;
+         match &= match - 1) {
+      int index = group * GROUP_SIZE + __builtin_ctz(match);
+      if (table->entries[index].key == key)
+        return index;
     }
-    // Did not find it
-    index = (index + 1) % capacity;
+    if (matchByte(control, CTRL_EMPTY) != 0)
+      return -1;
+    group = NEXT_GROUP(table, group, step);
   }
 }
 
-// adjustCapacity dynamically grows a hashmap
-static void adjustCapacity(Table *table, int capacity) {
-  Entry *entries = ALLOCATE(Entry, capacity);
-
-  for (int i = 0; i < capacity; i++) {
-    entries[i].key = NULL;
-    entries[i].value = NIL_VAL;
+// findFree returns the first empty or deleted entry of hash's probe, and
+// sets probe to the groups it looked at
+static int findFree(Table *table, uint32_t hash, int *probe) {
+  uint32_t group = FIRST_GROUP(table, hash);
+  for (uint32_t step = 1;; step++) {
+    GroupMask free = matchFree(&table->control[group * GROUP_SIZE]);
+    if (free != 0) {
+      *probe = (int)step;
+      return group * GROUP_SIZE + __builtin_ctz(free);
+    }
+    group = NEXT_GROUP(table, group, step);
   }
+}
 
-  table->count = 0;
-  for (int i = 0; i < table->capacity; i++) {
-    Entry *entry = &table->entries[i];
-
-    if (entry == NULL) {
-      printf("Reaching here: NULL Pointer reference\n");
-    }
+// adjustCapacity rebuilds a table at capacity entries, without its
+// tombstones
+static void adjustCapacity(Table *table, int capacity) {
+  Entry *oldEntries = table->entries;
+  uint8_t *oldControl = table->control;
+  int oldCapacity = table->capacity;
 
-    printf("Outside the if for %d\n", i);
+  table->entries =
+      (Entry *)ALLOCATE(uint8_t, TABLE_BYTES(capacity), MEM_TABLE);
+  table->control = (uint8_t *)(table->entries + capacity);
+  table->capacity = capacity;
+  memset(table->control, CTRL_EMPTY, capacity);
 
-    if (entry->key == NULL) {
-      printf("%d\n", i);
+  table->tombstones = 0;
+  int probe;
+  for (int i = 0; i < oldCapacity; i++) {
+    if (!IS_FULL(oldControl[i]))
       continue;
-    }
 
-    Entry *dest = findEntry(entries, capacity, entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
-    table->count++;
+    Entry *entry = &oldEntries[i];
+    uint32_t hash = TABLE_HASH(table, entry->key->hash);
+    int index = findFree(table, hash, &probe);
+    table->control[index] = H2(hash);
+    table->entries[index] = *entry;
   }
 
-  FREE_ARRAY(Entry, table->entries, table->capacity);
-  table->entries = entries;
-  table->capacity = capacity;
+  FREE_ARRAY(uint8_t, oldEntries, TABLE_BYTES(oldCapacity), MEM_TABLE);
+}
+
+// capacityFor picks the smallest capacity count keys fill at most half
+// of, so a rebuilt table takes as many inserts again before the next one
+static int capacityFor(int count) {
+  int capacity = TABLE_MIN_CAPACITY;
+  while (count > capacity / 2)
+    capacity = GROW_CAPACITY(capacity);
+  return capacity;
+}
+
+// reseed rebuilds a table with a new seed, one the keys placed so far
+// were not chosen against
+static void reseed(Table *table) {
+  table->seed = randomSeed();
+  table->reseeds++;
+  table->reseededAt = table->capacity;
+  adjustCapacity(table, table->capacity);
 }
 
 // tableSet sets a value on a table
 // returns true if it is a new declaration, else returns
 // false
 bool tableSet(Table *table, ObjString *key, Value value) {
-  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-    int capacity = GROW_CAPACITY(table->capacity);
-    // Adjust capacity here
-    adjustCapacity(table, capacity);
+  // Tombstones lengthen probes like keys do. Once they and the keys
+  // fill the table it is rebuilt without them, at the size the keys need
+  if (table->count + table->tombstones + 1 >
+      table->capacity * TABLE_MAX_LOAD)
+    adjustCapacity(table, capacityFor(table->count + 1));
+
+  int index = findKey(table, key);
+  if (index >= 0) {
+    table->entries[index].value = value;
+    return false;
   }
 
-  Entry *entry = findEntry(table->entries, table->capacity, key);
-
-  bool isNewKey = entry->key == NULL;
-
-  if (isNewKey && IS_NIL(entry->value))
-    table->count++;
-
-  entry->key = key;
-  entry->value = value;
-  return isNewKey;
+  uint32_t hash = TABLE_HASH(table, key->hash);
+  int probe;
+  index = findFree(table, hash, &probe);
+  if (table->control[index] == CTRL_DELETED)
+    table->tombstones--;
+  table->control[index] = H2(hash);
+  table->entries[index].key = key;
+  table->entries[index].value = value;
+  table->count++;
+
+  // Keys that still crowd one probe under a new seed share their whole
+  // hash, another seed would not part them either. Waiting for the next
+  // capacity keeps such keys from rebuilding the table on every insert
+  if (probe > TABLE_PROBE_LIMIT && table->reseededAt != table->capacity)
+    reseed(table);
+  return true;
 }
 
 // function to copy one hash table into another
 void tableAddAll(Table *from, Table *to) {
   for (int i = 0; i < from->capacity; i++) {
-    Entry *entry = &from->entries[i];
-
-    if (entry->key == NULL)
+    if (!IS_FULL(from->control[i]))
       continue;
 
+    Entry *entry = &from->entries[i];
     tableSet(to, entry->key, entry->value);
   }
 }
@@ -126,50 +229,79 @@ bool tableGet(Table *tb, ObjString *key, Value *value) {
   if (tb->count == 0)
     return false;
 
-  Entry *entry = findEntry(tb->entries, tb->capacity, key);
-  if (entry->key == NULL)
+  int index = findKey(tb, key);
+  if (index < 0)
     return false;
 
-  *value = entry->value;
+  *value = tb->entries[index].value;
 
   return true;
 }
 
-// tableDelete deletes a key from the table by adding
-// a special tombstone
+// deleteEntry empties the entry at index. A probe only goes past a
+// group with no empty entry, and a group gets one back only when the
+// table is rebuilt. So if this group has one no probe ever went past
+// it, and the entry can be empty too rather than a tombstone
+static void deleteEntry(Table *tb, int index) {
+  uint8_t *group = &tb->control[index & ~(GROUP_SIZE - 1)];
+  if (matchByte(group, CTRL_EMPTY) != 0) {
+    tb->control[index] = CTRL_EMPTY;
+  } else {
+    tb->control[index] = CTRL_DELETED;
+    tb->tombstones++;
+  }
+  tb->entries[index].key = NULL;
+  tb->count--;
+}
+
+// tableDelete deletes a key from the table
 bool tableDelete(Table *tb, ObjString *key) {
   if (tb->count == 0)
     return false;
 
-  Entry *entry = findEntry(tb->entries, tb->capacity, key);
-  if (entry->key == NULL)
+  int index = findKey(tb, key);
+  if (index < 0)
     return false;
 
-  // Delete here
-  entry->key = NULL;
-  entry->value = BOOL_VAL(true);
-
+  deleteEntry(tb, index);
   return true;
 }
 
-ObjString *tableFindString(Table *table, const char *chars, int length,
-                           uint32_t hash) {
-  if (table->count == 0)
-    return NULL;
-
-  uint32_t index = hash % table->capacity;
-  for (;;) {
-    Entry *entry = &table->entries[index];
-    if (entry->key == NULL) {
-      // Stop if we find an empty non-tombstone entry.
-      if (IS_NIL(entry->value))
-        return NULL;
-    } else if (entry->key->length == length && entry->key->hash == hash &&
-               memcmp(entry->key->chars, chars, length) == 0) {
-      // We found it.
-      return entry->key;
-    }
+// markTable marks every key and value of a table reachable
+void markTable(Table *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    if (!IS_FULL(table->control[i]))
+      continue;
+
+    Entry *entry = &table->entries[i];
+    markObject((Obj *)entry->key);
+    markValue(entry->value);
+  }
+}
+
+// tableStats counts the groups a lookup of every live key visits
+void tableStats(Table *table, TableStats *stats) {
+  stats->count = table->count;
+  stats->tombstones = table->tombstones;
+  stats->capacity = table->capacity;
+  stats->averageProbe = 0;
+  stats->longestProbe = 0;
+  stats->reseeds = table->reseeds;
+
+  long probes = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    if (!IS_FULL(table->control[i]))
+      continue;
 
-    index = (index + 1) % table->capacity;
+    uint32_t group =
+        FIRST_GROUP(table, TABLE_HASH(table, table->entries[i].key->hash));
+    int probe = 1;
+    while (group != (uint32_t)i / GROUP_SIZE)
+      group = NEXT_GROUP(table, group, probe++);
+    probes += probe;
+    if (probe > stats->longestProbe)
+      stats->longestProbe = probe;
   }
+  if (table->count > 0)
+    stats->averageProbe = (double)probes / table->count;
 }
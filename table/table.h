@@ -8,17 +8,40 @@ typedef struct Entry {
 } Entry;
 
 typedef struct Table {
+  int count;        // Live keys
+  int tombstones;   // Deleted entries probes still walk past
+  int capacity;     // A power of two, at least a group of 16 entries
+  int reseeds;      // Times a long probe had the table pick a new seed
+  int reseededAt;   // Capacity of the last reseed, one per capacity
+  uint64_t seed;    // Mixed into key hashes to place the keys
+  Entry *entries;   // Array of entries
+  uint8_t *control; // One byte per entry, after the entries
+} Table;
+
+// TABLE_HASH is the hash a table places a key by: the key's own hash
+// mixed with the table's seed, so a new seed scatters keys that crowded
+// one probe, even if their hashes agree in every bit the table used
+#define TABLE_HASH(table, hash)                                          \
+  ((uint32_t)((((uint64_t)(hash) ^ (table)->seed) * 0x9e3779b97f4a7c15ull) \
+              >> 32))
+
+// What tableStats reports on how full a table is and how long its
+// lookups probe
+typedef struct {
   int count;
+  int tombstones;
   int capacity;
-  Entry *entries; // Array of entries
-} Table;
+  double averageProbe; // Groups a lookup of a live key looks at
+  int longestProbe;
+  int reseeds;
+} TableStats;
 
 void initTable(Table *tb);
 void freeTable(Table *tb);
 bool tableSet(Table *table, ObjString *key, Value value);
 bool tableGet(Table *tb, ObjString *key, Value *value);
 bool tableDelete(Table *tb, ObjString *key);
-ObjString *tableFindString(Table *table, const char *chars, int length,
-                           uint32_t hash);
+void markTable(Table *table);
+void tableStats(Table *table, TableStats *stats);
 
 #endif
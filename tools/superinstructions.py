@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Rank superinstruction candidates from opcode profiles.
+
+Build the vm with -DVM_PROFILE_OPCODES and run the corpus with
+`--opcode-profile FILE`, every run appends the weighted opcode sequences
+of its chunk to FILE. This tool aggregates one or more such files and
+ranks the sequences by the dispatches a superinstruction would save.
+
+    tools/superinstructions.py profile.txt [--top N] [--select N]
+
+The selected set is printed as rows for the superinstructions table in
+superinstruction/superinstruction.c. Handlers for new rows still have to
+be written in run() and debug/debug.c.
+"""
+
+import argparse
+import os
+import re
+import sys
+from collections import defaultdict
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def opcode_names():
+    """Maps opcode numbers to names by reading the OpCode enum."""
+    with open(os.path.join(ROOT, "chunk", "chunk.h")) as header:
+        source = header.read()
+    body = re.search(r"typedef enum \{(.*?)\} OpCode;", source, re.S).group(1)
+    body = re.sub(r"//[^\n]*", "", body)
+    return [name.strip() for name in body.split(",") if name.strip()]
+
+
+def read_profiles(paths):
+    """Returns the occurrences of every sequence and the dispatch total.
+
+    An occurrence is (chunk, start, end, runs), every `total` line starts
+    the profile of a new chunk.
+    """
+    occurrences = defaultdict(list)
+    total = 0
+    chunk = 0
+    for path in paths:
+        with open(path) as profile:
+            for line in profile:
+                fields = line.split()
+                if not fields:
+                    continue
+                if fields[0] == "total":
+                    total += int(fields[1])
+                    chunk += 1
+                elif fields[0] == "ngram":
+                    runs, start, end = (int(field) for field in fields[1:4])
+                    sequence = tuple(int(op) for op in fields[4:])
+                    occurrences[sequence].append((chunk, start, end, runs))
+    return occurrences, total
+
+
+def saving(sequence, occurrences):
+    """A superinstruction of n opcodes saves n - 1 dispatches per run."""
+    return sum(runs for _, _, _, runs in occurrences) * (len(sequence) - 1)
+
+
+def select(occurrences, count):
+    """Greedily picks the best candidate, then rescores the rest without
+    the occurrences overlapping code it already covers."""
+    covered = defaultdict(list)
+    chosen = []
+
+    def free(occurrence):
+        chunk, start, end, _ = occurrence
+        return all(end <= low or start >= high for low, high in covered[chunk])
+
+    remaining = dict(occurrences)
+    while remaining and len(chosen) < count:
+        scored = {
+            sequence: [occ for occ in occs if free(occ)]
+            for sequence, occs in remaining.items()
+        }
+        best = max(scored, key=lambda sequence: saving(sequence, scored[sequence]))
+        saved = saving(best, scored[best])
+        if saved == 0:
+            break
+        chosen.append((best, saved))
+        for chunk, start, end, _ in scored[best]:
+            covered[chunk].append((start, end))
+        del remaining[best]
+
+    # The fusing pass tries longer sequences first
+    return sorted(chosen, key=lambda pick: -len(pick[0]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("profiles", nargs="+")
+    parser.add_argument("--top", type=int, default=20,
+                        help="candidates to list (default 20)")
+    parser.add_argument("--select", type=int, default=8,
+                        help="superinstructions to propose (default 8)")
+    args = parser.parse_args()
+
+    names = opcode_names()
+    occurrences, total = read_profiles(args.profiles)
+    if total == 0:
+        sys.exit("no dispatches recorded in the profiles")
+
+    ranked = sorted(occurrences,
+                    key=lambda sequence: -saving(sequence, occurrences[sequence]))
+
+    print("%d dispatches profiled\n" % total)
+    print("%12s %7s  sequence" % ("saved", "share"))
+    for sequence in ranked[: args.top]:
+        saved = saving(sequence, occurrences[sequence])
+        print("%12d %6.2f%%  %s" % (saved, 100.0 * saved / total,
+                                    " ".join(names[op] for op in sequence)))
+
+    print("\nProposed superinstructions table:\n")
+    for sequence, saved in select(occurrences, args.select):
+        ops = ", ".join(names[op] for op in sequence)
+        fused = "OP_" + "_".join(names[op][3:] for op in sequence)
+        print("    {{%s},\n     %d,\n     %s}, // saves %.2f%%"
+              % (ops, len(sequence), fused, 100.0 * saved / total))
+
+
+if __name__ == "__main__":
+    main()
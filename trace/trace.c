@@ -0,0 +1,857 @@
+#include "trace.h"
+#include "../memory/memory.h"
+#include "../virtual_machine/vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool tracingEnabled = false;
+bool traceVerbose = false;
+bool traceRecording = false;
+TraceStats traceStats;
+
+// Trace instructions read and write values through pointers resolved
+// while recording: local slots, global slots, constants and the stack
+// slots temporaries live in. Arithmetic and comparisons run unchecked,
+// the guards in front of them proved their operands are numbers
+typedef enum {
+  TRACE_MOVE,
+  TRACE_ADD,
+  TRACE_SUBSTRACT,
+  TRACE_MULTIPLY,
+  TRACE_DIVIDE,
+  TRACE_NEGATE,
+  TRACE_GREATOR,
+  TRACE_LESS,
+  TRACE_NOT_GREATOR,
+  TRACE_NOT_LESS,
+  TRACE_EQUAL,
+  TRACE_NOT_EQUAL,
+  TRACE_NOT,
+  TRACE_PRINT,
+  // Guards exit to run() when their operand is not a number, not as
+  // truthy as recorded, or when a comparison a branch was fused with
+  // comes out the other way. The comparison guards keep the order of
+  // the comparisons above, and xor 2 negates one
+  TRACE_GUARD_NUMBER,
+  TRACE_GUARD_TRUTHY,
+  TRACE_GUARD_FALSEY,
+  TRACE_GUARD_GREATOR,
+  TRACE_GUARD_LESS,
+  TRACE_GUARD_NOT_GREATOR,
+  TRACE_GUARD_NOT_LESS,
+  // Closes the iteration and starts the next one at loopStart
+  TRACE_LOOP,
+} TraceOpCode;
+
+typedef struct {
+  uint8_t op;
+  Value *dst;
+  Value *a;
+  Value *b;
+  int exit;      // Offset run() resumes at when the guard fails
+  int exitDepth; // Stack depth run() resumes with
+} TraceInstruction;
+
+typedef struct {
+  TraceInstruction *code;
+  int count;
+  int capacity;
+  int loopStart;      // Instruction the next iteration starts at
+  int bytecodeLength; // Bytecode instructions one iteration stands in for
+} Trace;
+
+// What the recorder knows about a value
+typedef enum {
+  TYPE_UNKNOWN,
+  TYPE_NUMBER,
+  TYPE_BOOL,
+} TraceType;
+
+// Where a lazy entry's value comes from
+typedef enum {
+  SOURCE_NONE,
+  SOURCE_CONSTANT,
+  SOURCE_LOCAL,
+  SOURCE_GLOBAL,
+} TraceSource;
+
+// What the recorder knows about one stack slot. A lazy entry was pushed
+// by an instruction without side effects that the trace never ran:
+// value points at what it would have pushed, and a guard failing while
+// the entry is on the stack resumes run() at exit to push it after all.
+// Every side effect materializes the lazy entries first, so only pure
+// instructions are ever run twice
+typedef struct {
+  Value *value;
+  uint8_t type;
+  uint8_t source;
+  int index; // Slot of the local or global a lazy entry reads
+  bool lazy;
+  // A lazy branch condition whose comparison became a guard. The value
+  // is known, but only the instruction right after the branch may use
+  // it before it is written to its slot
+  bool condition;
+  int producer; // Instruction that computed a temporary, or -1
+  int exit;
+  int exitDepth;
+} TraceSlot;
+
+// Tracing state of the loop whose header is at an offset
+typedef struct {
+  int hotness; // Back-edges taken since the last recording
+  int aborts;
+  Trace *trace;
+} Loop;
+
+// The recording in progress. Local slots are stack slots, so stack
+// describes both the locals and the temporaries above them. Type guards
+// on variables the iteration has not written yet go to the prologue,
+// which later iterations skip if the variables keep their types
+typedef struct {
+  Trace *trace;
+  Trace *prologue;
+  int header;
+  int backEdge;
+  int start; // First offset of the loop seen so far
+  int base;  // Stack depth at the loop header
+  int depth;
+  int offset;     // Instruction being recorded
+  int startDepth; // Stack depth before it
+  TraceSlot stack[STACK_MAX];
+  uint8_t globalTypes[GLOBALS_MAX];
+  bool localWritten[STACK_MAX];
+  bool globalWritten[GLOBALS_MAX];
+  bool localHoisted[STACK_MAX];
+  bool globalHoisted[GLOBALS_MAX];
+} Recorder;
+
+static Chunk *tracedChunk = NULL;
+static Loop *loops = NULL;
+static Recorder recorder;
+// nil, true and false for the literals traces push
+static Value literals[3];
+
+// initTraces prepares a chunk for tracing, one Loop per offset
+void initTraces(Chunk *chunk) {
+  tracedChunk = chunk;
+  loops = ALLOCATE(Loop, chunk->count, MEM_TRACE);
+  memset(loops, 0, sizeof(Loop) * chunk->count);
+  recorder.trace = NULL;
+  recorder.prologue = NULL;
+  traceRecording = false;
+
+  literals[0] = NIL_VAL;
+  literals[1] = BOOL_VAL(true);
+  literals[2] = BOOL_VAL(false);
+}
+
+static Trace *newTrace() {
+  Trace *trace = ALLOCATE(Trace, 1, MEM_TRACE);
+  trace->code = NULL;
+  trace->count = 0;
+  trace->capacity = 0;
+  trace->loopStart = 0;
+  trace->bytecodeLength = 0;
+  return trace;
+}
+
+static void freeTrace(Trace *trace) {
+  FREE_ARRAY(TraceInstruction, trace->code, trace->capacity, MEM_TRACE);
+  FREE(Trace, trace, MEM_TRACE);
+}
+
+static void stopRecording() {
+  if (recorder.trace != NULL)
+    freeTrace(recorder.trace);
+  if (recorder.prologue != NULL)
+    freeTrace(recorder.prologue);
+  recorder.trace = NULL;
+  recorder.prologue = NULL;
+  traceRecording = false;
+}
+
+// freeTraces drops every trace of the chunk and any recording left
+// unfinished by a runtime error
+void freeTraces() {
+  if (loops == NULL)
+    return;
+
+  for (int offset = 0; offset < tracedChunk->count; offset++)
+    if (loops[offset].trace != NULL)
+      freeTrace(loops[offset].trace);
+  stopRecording();
+
+  FREE_ARRAY(Loop, loops, tracedChunk->count, MEM_TRACE);
+  loops = NULL;
+  tracedChunk = NULL;
+}
+
+// -------------------- Recording
+
+static TraceType typeOf(Value value) {
+  if (IS_NUMBER(value))
+    return TYPE_NUMBER;
+  if (IS_BOOL(value))
+    return TYPE_BOOL;
+  return TYPE_UNKNOWN;
+}
+
+static TraceInstruction *emitTo(Trace *trace, uint8_t op, Value *dst,
+                                Value *a, Value *b) {
+  if (trace->count + 1 > trace->capacity) {
+    int oldCapacity = trace->capacity;
+    trace->capacity = GROW_CAPACITY(oldCapacity);
+    trace->code = GROW_ARRAY(TraceInstruction, trace->code, oldCapacity,
+                             trace->capacity, MEM_TRACE);
+  }
+
+  TraceInstruction *instruction = &trace->code[trace->count++];
+  instruction->op = op;
+  instruction->dst = dst;
+  instruction->a = a;
+  instruction->b = b;
+  instruction->exit = 0;
+  instruction->exitDepth = 0;
+  return instruction;
+}
+
+static TraceInstruction *emit(uint8_t op, Value *dst, Value *a, Value *b) {
+  return emitTo(recorder.trace, op, dst, a, b);
+}
+
+static TraceSlot *top() { return &recorder.stack[recorder.depth - 1]; }
+
+// lastInstruction is the instruction emitted last, if it computed entry
+static TraceInstruction *lastInstruction(TraceSlot *entry) {
+  Trace *trace = recorder.trace;
+  if (trace->count == 0 || entry->producer != trace->count - 1)
+    return NULL;
+  return &trace->code[trace->count - 1];
+}
+
+// currentExit is where run() has to resume to redo everything the trace
+// did not materialize: the oldest lazy entry, or the instruction being
+// recorded when there is none
+static void currentExit(int *exit, int *exitDepth) {
+  for (int i = recorder.base; i < recorder.depth; i++) {
+    if (recorder.stack[i].lazy) {
+      *exit = recorder.stack[i].exit;
+      *exitDepth = recorder.stack[i].exitDepth;
+      return;
+    }
+  }
+  *exit = recorder.offset;
+  *exitDepth = recorder.startDepth;
+}
+
+static void emitGuard(uint8_t op, Value *a) {
+  TraceInstruction *guard = emit(op, NULL, a, NULL);
+  currentExit(&guard->exit, &guard->exitDepth);
+}
+
+static void pushLazy(Value *value, uint8_t type, uint8_t source, int index) {
+  TraceSlot *entry = &recorder.stack[recorder.depth++];
+  entry->value = value;
+  entry->type = type;
+  entry->source = source;
+  entry->index = index;
+  entry->lazy = true;
+  entry->condition = false;
+  entry->producer = -1;
+  entry->exit = recorder.offset;
+  entry->exitDepth = recorder.startDepth;
+}
+
+static void pushConstant(Value *value) {
+  pushLazy(value, typeOf(*value), SOURCE_CONSTANT, 0);
+}
+
+static void pushLocal(int slot) {
+  TraceSlot *local = &recorder.stack[slot];
+  if (local->lazy)
+    pushLazy(local->value, local->type, local->source, local->index);
+  else
+    pushLazy(&vm.stack[slot], local->type, SOURCE_LOCAL, slot);
+}
+
+// materialize writes a lazy entry to its own stack slot
+static void materialize(int index) {
+  TraceSlot *entry = &recorder.stack[index];
+  if (!entry->lazy)
+    return;
+
+  emit(TRACE_MOVE, &vm.stack[index], entry->value, NULL);
+  entry->value = &vm.stack[index];
+  entry->source = SOURCE_NONE;
+  entry->lazy = false;
+  entry->condition = false;
+  entry->producer = -1;
+}
+
+static void materializeBelow(int depth) {
+  for (int i = recorder.base; i < depth; i++)
+    materialize(i);
+}
+
+// setType records that every copy of a variable holds a type
+static void setType(uint8_t source, int index, uint8_t type) {
+  if (source != SOURCE_LOCAL && source != SOURCE_GLOBAL)
+    return;
+  if (source == SOURCE_LOCAL)
+    recorder.stack[index].type = type;
+  else if (source == SOURCE_GLOBAL)
+    recorder.globalTypes[index] = type;
+
+  for (int i = recorder.base; i < recorder.depth; i++) {
+    TraceSlot *entry = &recorder.stack[i];
+    if (entry->lazy && entry->source == source && entry->index == index)
+      entry->type = type;
+  }
+}
+
+// guardNumber guards an entry unless it is already known to be a number.
+// A variable the iteration has not written yet is guarded once in the
+// prologue instead of at every use
+static void guardNumber(TraceSlot *entry) {
+  if (entry->type == TYPE_NUMBER)
+    return;
+
+  bool local = entry->lazy && entry->source == SOURCE_LOCAL &&
+               entry->index < recorder.base &&
+               !recorder.localWritten[entry->index];
+  bool global = entry->lazy && entry->source == SOURCE_GLOBAL &&
+                !recorder.globalWritten[entry->index];
+
+  if (local || global) {
+    TraceInstruction *guard = emitTo(recorder.prologue, TRACE_GUARD_NUMBER,
+                                     NULL, entry->value, NULL);
+    guard->exit = recorder.header;
+    guard->exitDepth = recorder.base;
+    if (local)
+      recorder.localHoisted[entry->index] = true;
+    else
+      recorder.globalHoisted[entry->index] = true;
+  } else {
+    emitGuard(TRACE_GUARD_NUMBER, entry->value);
+  }
+
+  entry->type = TYPE_NUMBER;
+  if (entry->lazy)
+    setType(entry->source, entry->index, TYPE_NUMBER);
+}
+
+// recordOperation replaces the operands on top of the stack with the
+// temporary an instruction computes from them. The temporary remembers
+// where run() resumes to compute it again, for recordCondition
+static void recordOperation(uint8_t op, int operands, uint8_t type) {
+  int slot = recorder.depth - operands;
+  TraceSlot *a = &recorder.stack[slot];
+  TraceSlot *b = operands == 2 ? top() : NULL;
+
+  int exit, exitDepth;
+  currentExit(&exit, &exitDepth);
+  emit(op, &vm.stack[slot], a->value, b == NULL ? NULL : b->value);
+
+  recorder.depth = slot + 1;
+  a->value = &vm.stack[slot];
+  a->type = type;
+  a->source = SOURCE_NONE;
+  a->lazy = false;
+  a->condition = false;
+  a->producer = recorder.trace->count - 1;
+  a->exit = exit;
+  a->exitDepth = exitDepth;
+}
+
+static void recordNumberOperation(uint8_t op, int operands, uint8_t type) {
+  for (int i = recorder.depth - operands; i < recorder.depth; i++)
+    guardNumber(&recorder.stack[i]);
+  recordOperation(op, operands, type);
+}
+
+// recordStore writes the top of the stack to a variable, popping it when
+// pop is set. A temporary computed right before is computed into the
+// variable instead
+static void recordStore(Value *variable, bool pop) {
+  materializeBelow(pop ? recorder.depth - 1 : recorder.depth);
+
+  TraceSlot *value = top();
+  TraceInstruction *last = lastInstruction(value);
+  if (pop && last != NULL && last->dst == value->value)
+    last->dst = variable;
+  else if (value->value != variable)
+    emit(TRACE_MOVE, variable, value->value, NULL);
+
+  if (pop)
+    recorder.depth--;
+}
+
+// recordCondition guards a branch on the truthiness run() observed. A
+// comparison computed right before becomes the guard itself
+static void recordCondition(bool truthy) {
+  TraceSlot *condition = top();
+  if (condition->lazy && condition->source == SOURCE_CONSTANT)
+    return;
+
+  TraceInstruction *last = lastInstruction(condition);
+  if (last != NULL && last->op >= TRACE_GREATOR &&
+      last->op <= TRACE_NOT_LESS) {
+    last->op = TRACE_GUARD_GREATOR +
+               ((last->op - TRACE_GREATOR) ^ (truthy ? 0 : 2));
+    last->dst = NULL;
+    last->exit = condition->exit;
+    last->exitDepth = condition->exitDepth;
+    condition->value = &literals[truthy ? 1 : 2];
+    condition->lazy = true;
+    condition->condition = true;
+    condition->producer = -1;
+    return;
+  }
+
+  emitGuard(truthy ? TRACE_GUARD_TRUTHY : TRACE_GUARD_FALSEY,
+            condition->value);
+}
+
+// Trace instruction of each generic binary number instruction
+static const uint8_t numberOps[] = {
+    [OP_ADD] = TRACE_ADD,
+    [OP_SUBSTRACT] = TRACE_SUBSTRACT,
+    [OP_MULTIPLY] = TRACE_MULTIPLY,
+    [OP_DIVIDE] = TRACE_DIVIDE,
+    [OP_GREATOR] = TRACE_GREATOR,
+    [OP_LESS] = TRACE_LESS,
+    [OP_NOT_GREATOR] = TRACE_NOT_GREATOR,
+    [OP_NOT_LESS] = TRACE_NOT_LESS,
+};
+
+// recordOne appends the trace of the instruction about to run. Returns
+// why recording has to stop, or NULL
+static const char *recordOne(uint8_t *ip) {
+  Chunk *chunk = tracedChunk;
+  uint8_t instruction = genericInstruction(ip[0]);
+
+  // A branch condition only survives until the POP after the branch
+  if (recorder.depth > recorder.base && top()->condition &&
+      instruction != OP_POP)
+    materialize(recorder.depth - 1);
+
+  switch (instruction) {
+  case OP_CONSTANT:
+    pushConstant(&chunk->constants.values[ip[1]]);
+    break;
+  case OP_NIL:
+    pushConstant(&literals[0]);
+    break;
+  case OP_TRUE:
+    pushConstant(&literals[1]);
+    break;
+  case OP_FALSE:
+    pushConstant(&literals[2]);
+    break;
+  case OP_POP:
+    recorder.depth--;
+    break;
+  case OP_GET_LOCAL:
+    pushLocal(ip[1]);
+    break;
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_POP: {
+    uint8_t slot = ip[1];
+    uint8_t type = top()->type;
+    recordStore(&vm.stack[slot], instruction == OP_SET_LOCAL_POP);
+    recorder.stack[slot].type = type;
+    recorder.localWritten[slot] = true;
+    break;
+  }
+  case OP_GET_GLOBAL_SLOT: {
+    // A defined global stays defined, the trace needs no guard for it
+    uint8_t slot = ip[1];
+    if (!vm.globalSlots[slot].defined)
+      return "undefined global";
+    pushLazy(&vm.globalSlots[slot].value, recorder.globalTypes[slot],
+             SOURCE_GLOBAL, slot);
+    break;
+  }
+  case OP_SET_GLOBAL_SLOT:
+  case OP_SET_GLOBAL_SLOT_POP: {
+    uint8_t slot = ip[1];
+    if (!vm.globalSlots[slot].defined)
+      return "undefined global";
+    uint8_t type = top()->type;
+    recordStore(&vm.globalSlots[slot].value,
+                instruction == OP_SET_GLOBAL_SLOT_POP);
+    setType(SOURCE_GLOBAL, slot, type);
+    recorder.globalWritten[slot] = true;
+    break;
+  }
+  case OP_ADD:
+  case OP_SUBSTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_GREATOR:
+  case OP_LESS:
+  case OP_NOT_GREATOR:
+  case OP_NOT_LESS:
+    if (!IS_NUMBER(vm.stackTop[-1]) || !IS_NUMBER(vm.stackTop[-2]))
+      return "operands are not numbers";
+    recordNumberOperation(numberOps[instruction], 2,
+                          numberOps[instruction] <= TRACE_DIVIDE ? TYPE_NUMBER
+                                                                 : TYPE_BOOL);
+    break;
+  case OP_NEGATE:
+    if (!IS_NUMBER(vm.stackTop[-1]))
+      return "operand is not a number";
+    recordNumberOperation(TRACE_NEGATE, 1, TYPE_NUMBER);
+    break;
+  case OP_EQUAL:
+    recordOperation(TRACE_EQUAL, 2, TYPE_BOOL);
+    break;
+  case OP_NOT_EQUAL:
+    recordOperation(TRACE_NOT_EQUAL, 2, TYPE_BOOL);
+    break;
+  case OP_NOT:
+    recordOperation(TRACE_NOT, 1, TYPE_BOOL);
+    break;
+  case OP_PRINT:
+    materializeBelow(recorder.depth - 1);
+    emit(TRACE_PRINT, NULL, top()->value, NULL);
+    recorder.depth--;
+    break;
+  case OP_JUMP:
+    // The trace is straight line code, the jump already happened
+    break;
+  case OP_JUMP_IF_FALSE:
+    recordCondition(!isFalsey(vm.stackTop[-1]));
+    break;
+  case OP_LESS_LOCAL_CONSTANT_JUMP: {
+    // Recorded as the instructions it was fused from, all of which
+    // resume run() at the fused instruction
+    Value a = vm.stack[ip[1]];
+    Value b = chunk->constants.values[ip[2]];
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+      return "operands are not numbers";
+
+    bool less = AS_NUMBER(a) < AS_NUMBER(b);
+    pushLocal(ip[1]);
+    pushConstant(&chunk->constants.values[ip[2]]);
+    recordNumberOperation(TRACE_LESS, 2, TYPE_BOOL);
+    recordCondition(less);
+    // A taken jump leaves the false condition on the stack
+    if (less)
+      recorder.depth--;
+    break;
+  }
+  case OP_ADD_LOCAL_CONSTANT: {
+    Value a = vm.stack[ip[1]];
+    Value b = chunk->constants.values[ip[2]];
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+      return "operands are not numbers";
+
+    pushLocal(ip[1]);
+    pushConstant(&chunk->constants.values[ip[2]]);
+    recordNumberOperation(TRACE_ADD, 2, TYPE_NUMBER);
+    recordStore(&vm.stack[ip[3]], true);
+    recorder.stack[ip[3]].type = TYPE_NUMBER;
+    recorder.localWritten[ip[3]] = true;
+    break;
+  }
+  default:
+    return "unsupported instruction";
+  }
+
+  return NULL;
+}
+
+// recordLoop follows an OP_LOOP inside the loop that is not its
+// back-edge. A for loop's increment jumps back to the condition above
+// the header, which is part of the loop; anything else is an inner loop
+static const char *recordLoop(uint8_t *ip) {
+  int target = recorder.offset + 3 - (ip[1] << 8 | ip[2]);
+  if (target >= recorder.start)
+    return "inner loop";
+  recorder.start = target;
+  return NULL;
+}
+
+static void abortRecording(const char *reason) {
+  Loop *loop = &loops[recorder.header];
+  if (traceVerbose)
+    fprintf(stderr, "trace: loop at %d aborted, %s at offset %d\n",
+            recorder.header, reason, recorder.offset);
+
+  stopRecording();
+  traceStats.aborted++;
+  loop->aborts++;
+  loop->hotness = 0;
+}
+
+// finishRecording installs the prologue followed by the iteration. Later
+// iterations skip the prologue when every variable it guards is still a
+// number at the end of this one
+static void finishRecording() {
+  Trace *trace = newTrace();
+  Trace *prologue = recorder.prologue;
+  Trace *body = recorder.trace;
+  bool stable = true;
+
+  for (int i = 0; i < recorder.base; i++)
+    if (recorder.localHoisted[i] && recorder.stack[i].type != TYPE_NUMBER)
+      stable = false;
+  for (int i = 0; i < GLOBALS_MAX; i++)
+    if (recorder.globalHoisted[i] && recorder.globalTypes[i] != TYPE_NUMBER)
+      stable = false;
+
+  for (int i = 0; i < prologue->count; i++)
+    *emitTo(trace, TRACE_LOOP, NULL, NULL, NULL) = prologue->code[i];
+  for (int i = 0; i < body->count; i++)
+    *emitTo(trace, TRACE_LOOP, NULL, NULL, NULL) = body->code[i];
+  emitTo(trace, TRACE_LOOP, NULL, NULL, NULL);
+  trace->loopStart = stable ? prologue->count : 0;
+  trace->bytecodeLength = body->bytecodeLength;
+
+  loops[recorder.header].trace = trace;
+  traceStats.recorded++;
+  if (traceVerbose)
+    fprintf(stderr,
+            "trace: loop at %d recorded, %d bytecode instructions into %d "
+            "trace instructions, %d of them in the prologue\n",
+            recorder.header, trace->bytecodeLength, trace->count,
+            prologue->count);
+  stopRecording();
+}
+
+static void startRecording(int header, int backEdge) {
+  recorder.trace = newTrace();
+  recorder.prologue = newTrace();
+  recorder.header = header;
+  recorder.backEdge = backEdge;
+  recorder.start = header;
+  recorder.base = (int)(vm.stackTop - vm.stack);
+  recorder.depth = recorder.base;
+
+  for (int i = 0; i < recorder.base; i++) {
+    TraceSlot *entry = &recorder.stack[i];
+    entry->value = &vm.stack[i];
+    entry->type = TYPE_UNKNOWN;
+    entry->source = SOURCE_NONE;
+    entry->index = 0;
+    entry->lazy = false;
+    entry->condition = false;
+    entry->producer = -1;
+    recorder.localWritten[i] = false;
+    recorder.localHoisted[i] = false;
+  }
+  for (int i = 0; i < GLOBALS_MAX; i++) {
+    recorder.globalTypes[i] = TYPE_UNKNOWN;
+    recorder.globalWritten[i] = false;
+    recorder.globalHoisted[i] = false;
+  }
+  traceRecording = true;
+}
+
+// recordInstruction is called by run() before every instruction while
+// traceRecording is set. The recording ends when the iteration reaches
+// the back-edge it started from, or anything the trace cannot express
+void recordInstruction(uint8_t *ip) {
+  const char *failure = NULL;
+  recorder.offset = (int)(ip - tracedChunk->code);
+  recorder.startDepth = recorder.depth;
+
+  if (recorder.offset == recorder.backEdge) {
+    finishRecording();
+    return;
+  }
+
+  if (recorder.offset < recorder.start || recorder.offset > recorder.backEdge)
+    failure = "left the loop";
+  else if (recorder.trace->count + recorder.prologue->count + 4 >
+           TRACE_MAX_LENGTH)
+    failure = "trace too long";
+  else if (ip[0] == OP_LOOP)
+    failure = recordLoop(ip);
+  else
+    failure = recordOne(ip);
+
+  if (failure != NULL)
+    abortRecording(failure);
+  else
+    recorder.trace->bytecodeLength++;
+}
+
+// -------------------- Execution
+
+// runTrace runs iterations of a loop from its trace until a guard fails,
+// then returns where run() continues
+static uint8_t *runTrace(Trace *trace) {
+  register TraceInstruction *pc = trace->code;
+  uint64_t iterations = 0;
+
+#ifdef VM_COMPUTED_GOTO
+  static void *dispatchTable[] = {
+      [TRACE_MOVE] = &&trace_TRACE_MOVE,
+      [TRACE_ADD] = &&trace_TRACE_ADD,
+      [TRACE_SUBSTRACT] = &&trace_TRACE_SUBSTRACT,
+      [TRACE_MULTIPLY] = &&trace_TRACE_MULTIPLY,
+      [TRACE_DIVIDE] = &&trace_TRACE_DIVIDE,
+      [TRACE_NEGATE] = &&trace_TRACE_NEGATE,
+      [TRACE_GREATOR] = &&trace_TRACE_GREATOR,
+      [TRACE_LESS] = &&trace_TRACE_LESS,
+      [TRACE_NOT_GREATOR] = &&trace_TRACE_NOT_GREATOR,
+      [TRACE_NOT_LESS] = &&trace_TRACE_NOT_LESS,
+      [TRACE_EQUAL] = &&trace_TRACE_EQUAL,
+      [TRACE_NOT_EQUAL] = &&trace_TRACE_NOT_EQUAL,
+      [TRACE_NOT] = &&trace_TRACE_NOT,
+      [TRACE_PRINT] = &&trace_TRACE_PRINT,
+      [TRACE_GUARD_NUMBER] = &&trace_TRACE_GUARD_NUMBER,
+      [TRACE_GUARD_TRUTHY] = &&trace_TRACE_GUARD_TRUTHY,
+      [TRACE_GUARD_FALSEY] = &&trace_TRACE_GUARD_FALSEY,
+      [TRACE_GUARD_GREATOR] = &&trace_TRACE_GUARD_GREATOR,
+      [TRACE_GUARD_LESS] = &&trace_TRACE_GUARD_LESS,
+      [TRACE_GUARD_NOT_GREATOR] = &&trace_TRACE_GUARD_NOT_GREATOR,
+      [TRACE_GUARD_NOT_LESS] = &&trace_TRACE_GUARD_NOT_LESS,
+      [TRACE_LOOP] = &&trace_TRACE_LOOP,
+  };
+
+#define CASE(op) trace_##op:
+#define DISPATCH() goto *dispatchTable[pc->op]
+#define NEXT()                                                                 \
+  do {                                                                         \
+    pc++;                                                                      \
+    DISPATCH();                                                                \
+  } while (false)
+
+  DISPATCH();
+#else
+#define CASE(op) case op:
+#define DISPATCH() continue
+#define NEXT()                                                                 \
+  {                                                                            \
+    pc++;                                                                      \
+    continue;                                                                  \
+  }
+
+  for (;;)
+    switch (pc->op) {
+#endif
+
+#define NUMBER_OP(valueType, op)                                               \
+  *pc->dst = valueType(AS_NUMBER(*pc->a) op AS_NUMBER(*pc->b));                \
+  NEXT()
+#define NOT_NUMBER_OP(op)                                                      \
+  *pc->dst = BOOL_VAL(!(AS_NUMBER(*pc->a) op AS_NUMBER(*pc->b)));              \
+  NEXT()
+#define GUARD(condition)                                                       \
+  if (!(condition))                                                            \
+    goto exit;                                                                 \
+  NEXT()
+
+  CASE(TRACE_MOVE) {
+    *pc->dst = *pc->a;
+    NEXT();
+  }
+  CASE(TRACE_ADD) { NUMBER_OP(NUMBER_VAL, +); }
+  CASE(TRACE_SUBSTRACT) { NUMBER_OP(NUMBER_VAL, -); }
+  CASE(TRACE_MULTIPLY) { NUMBER_OP(NUMBER_VAL, *); }
+  CASE(TRACE_DIVIDE) { NUMBER_OP(NUMBER_VAL, /); }
+  CASE(TRACE_NEGATE) {
+    *pc->dst = NUMBER_VAL(-AS_NUMBER(*pc->a));
+    NEXT();
+  }
+  CASE(TRACE_GREATOR) { NUMBER_OP(BOOL_VAL, >); }
+  CASE(TRACE_LESS) { NUMBER_OP(BOOL_VAL, <); }
+  CASE(TRACE_NOT_GREATOR) { NOT_NUMBER_OP(>); }
+  CASE(TRACE_NOT_LESS) { NOT_NUMBER_OP(<); }
+  CASE(TRACE_EQUAL) {
+    *pc->dst = BOOL_VAL(valueEquals(*pc->a, *pc->b));
+    NEXT();
+  }
+  CASE(TRACE_NOT_EQUAL) {
+    *pc->dst = BOOL_VAL(!valueEquals(*pc->a, *pc->b));
+    NEXT();
+  }
+  CASE(TRACE_NOT) {
+    *pc->dst = BOOL_VAL(isFalsey(*pc->a));
+    NEXT();
+  }
+  CASE(TRACE_PRINT) {
+    printValue(*pc->a);
+    NEXT();
+  }
+  CASE(TRACE_GUARD_NUMBER) { GUARD(IS_NUMBER(*pc->a)); }
+  CASE(TRACE_GUARD_TRUTHY) { GUARD(!isFalsey(*pc->a)); }
+  CASE(TRACE_GUARD_FALSEY) { GUARD(isFalsey(*pc->a)); }
+  CASE(TRACE_GUARD_GREATOR) { GUARD(AS_NUMBER(*pc->a) > AS_NUMBER(*pc->b)); }
+  CASE(TRACE_GUARD_LESS) { GUARD(AS_NUMBER(*pc->a) < AS_NUMBER(*pc->b)); }
+  CASE(TRACE_GUARD_NOT_GREATOR) {
+    GUARD(!(AS_NUMBER(*pc->a) > AS_NUMBER(*pc->b)));
+  }
+  CASE(TRACE_GUARD_NOT_LESS) {
+    GUARD(!(AS_NUMBER(*pc->a) < AS_NUMBER(*pc->b)));
+  }
+  CASE(TRACE_LOOP) {
+    iterations++;
+    pc = trace->code + trace->loopStart;
+    DISPATCH();
+  }
+
+#ifndef VM_COMPUTED_GOTO
+    }
+#endif
+
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef NUMBER_OP
+#undef NOT_NUMBER_OP
+#undef GUARD
+
+exit:
+  traceStats.exits++;
+  traceStats.tracedIterations += iterations;
+  traceStats.tracedInstructions += iterations * trace->bytecodeLength;
+  vm.stackTop = vm.stack + pc->exitDepth;
+  return tracedChunk->code + pc->exit;
+}
+
+// traceLoop is called by run() on every back-edge with the loop header
+// it jumps to and the OP_LOOP it came from. It runs the loop's trace if
+// there is one, or starts recording once the loop is hot, and returns
+// where run() continues
+uint8_t *traceLoop(uint8_t *header, uint8_t *backEdge) {
+  Loop *loop = &loops[header - tracedChunk->code];
+
+  if (loop->trace != NULL) {
+    traceStats.entries++;
+    return runTrace(loop->trace);
+  }
+
+  traceStats.interpretedBackEdges++;
+  if (!traceRecording && loop->aborts < TRACE_MAX_ABORTS &&
+      ++loop->hotness == TRACE_HOT_LOOP)
+    startRecording((int)(header - tracedChunk->code),
+                   (int)(backEdge - tracedChunk->code));
+  return header;
+}
+
+// printTraceStats writes how much of the loops ran from traces
+void printTraceStats(FILE *out) {
+  uint64_t iterations =
+      traceStats.tracedIterations + traceStats.interpretedBackEdges;
+  fprintf(out, "trace: %llu loops recorded, %llu recordings aborted\n",
+          (unsigned long long)traceStats.recorded,
+          (unsigned long long)traceStats.aborted);
+  fprintf(out, "trace: %llu entries, %llu exits\n",
+          (unsigned long long)traceStats.entries,
+          (unsigned long long)traceStats.exits);
+  fprintf(out,
+          "trace: %llu of %llu loop iterations ran in traces (%.1f%%), "
+          "%llu bytecode instructions\n",
+          (unsigned long long)traceStats.tracedIterations,
+          (unsigned long long)iterations,
+          iterations == 0 ? 0.0
+                          : 100.0 * traceStats.tracedIterations / iterations,
+          (unsigned long long)traceStats.tracedInstructions);
+}
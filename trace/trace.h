@@ -0,0 +1,43 @@
+#ifndef vm_trace_h
+#define vm_trace_h
+
+#include "../chunk/chunk.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Back-edges a loop takes before one of its iterations is recorded
+#define TRACE_HOT_LOOP 50
+// Longest trace recorded, longer iterations are given up on
+#define TRACE_MAX_LENGTH 512
+// Failed recordings before a loop is left to the interpreter for good
+#define TRACE_MAX_ABORTS 2
+
+// Counters over every loop of the chunks run with tracing on
+typedef struct {
+  uint64_t recorded; // Traces installed
+  uint64_t aborted;  // Recordings given up on
+  uint64_t entries;  // Back-edges that entered a trace
+  uint64_t exits;    // Guards that failed and resumed run()
+  // Loop iterations completed inside traces, and the back-edges run()
+  // took itself. Their ratio is the share of iterations traces cover
+  uint64_t tracedIterations;
+  uint64_t interpretedBackEdges;
+  // Bytecode instructions the completed trace iterations stood in for
+  uint64_t tracedInstructions;
+} TraceStats;
+
+// When true run() records hot loops and runs them from traces
+extern bool tracingEnabled;
+// When true every recorded or aborted trace is reported on stderr
+extern bool traceVerbose;
+// True while run() must call recordInstruction() before every instruction
+extern bool traceRecording;
+extern TraceStats traceStats;
+
+void initTraces(Chunk *chunk);
+void freeTraces();
+uint8_t *traceLoop(uint8_t *header, uint8_t *backEdge);
+void recordInstruction(uint8_t *ip);
+void printTraceStats(FILE *out);
+
+#endif
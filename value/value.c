@@ -14,7 +14,9 @@ void writeValueArray(ValueArray *va, Value v) {
   if (va->count + 1 > va->capacity) {
     int oldCapacity = va->capacity;
     va->capacity = GROW_CAPACITY(oldCapacity);
-    va->values = GROW_ARRAY(Value, va->values, oldCapacity, va->capacity);
+    va->values =
+        ARENA_GROW_ARRAY(Value, va->values, oldCapacity, va->capacity,
+                         MEM_VALUE_ARRAY);
   }
 
   va->values[va->count] = v;
@@ -22,25 +24,17 @@ void writeValueArray(ValueArray *va, Value v) {
 }
 
 void freeValueArray(ValueArray *va) {
-  FREE_ARRAY(Value, va->values, va->capacity);
+  ARENA_FREE_ARRAY(Value, va->values, va->capacity, MEM_VALUE_ARRAY);
   initValueArray(va);
 }
 
 void printValue(Value value) {
-  switch (value.type) {
-  case (VAL_NIL):
+  if (IS_NIL(value))
     printf("nil\n");
-    break;
-  case (VAL_BOOL):
+  else if (IS_BOOL(value))
     printf(AS_BOOL(value) ? "true\n" : "false\n");
-    break;
-  case (VAL_NUMBER):
+  else if (IS_NUMBER(value))
     printf("%g\n", AS_NUMBER(value));
-    break;
-  case (VAL_OBJ):
+  else if (IS_OBJ(value))
     printObject(value);
-    break;
-  default: // Unreachable
-    return;
-  }
 }
@@ -6,23 +6,83 @@
 // // Represents a constant value
 // typedef double Value;
 
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+
+#ifdef VM_NAN_BOXING
+
+#include <string.h>
+
+// A value is one 64 bit word. Doubles are stored as themselves, every
+// other value hides in the payload of a quiet NaN the FPU never produces:
+// objects set the sign bit and keep their pointer in the low 48 bits,
+// ints set INT_TAG and keep their 32 bits in the low word, nil, true and
+// false are the tags 1, 2 and 3
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+#define INT_TAG ((uint64_t)0x0001000000000000)
+
+#define TAG_NIL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+
+// Macros to check if the value is of a particular type
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_DOUBLE(value) (((value) & QNAN) != QNAN)
+#define IS_INT(value) (((value) & ~(uint64_t)UINT32_MAX) == (QNAN | INT_TAG))
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+// Uncasting macros
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_DOUBLE(value) valueToDouble(value)
+#define AS_INT(value) ((int32_t)(uint32_t)(value))
+#define AS_OBJ(value) ((Obj *)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+// Casting definitions
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define BOOL_VAL(value) ((value) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(value) doubleToValue(value)
+#define INT_VAL(value) ((Value)(QNAN | INT_TAG | (uint32_t)(int32_t)(value)))
+#define OBJ_VAL(object) ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object)))
+
+// memcpy is the defined way to reinterpret the bits, compilers turn it
+// into a register move
+static inline double valueToDouble(Value value) {
+  double number;
+  memcpy(&number, &value, sizeof(Value));
+  return number;
+}
+
+static inline Value doubleToValue(double number) {
+  Value value;
+  memcpy(&value, &number, sizeof(double));
+  return value;
+}
+
+#else
+
 // ValueType stores the type of the value
 typedef enum ValueType {
   VAL_BOOL,
   VAL_NIL,
   VAL_NUMBER,
+  VAL_INT, // Next to VAL_NUMBER so IS_NUMBER is one range check
   VAL_OBJ,
 } ValueType;
 
-typedef struct Obj Obj;
-typedef struct ObjString ObjString;
-
 // New representation of value
 typedef struct Value {
   ValueType type;
   union {
     bool boolean;
     double number;
+    int64_t integer; // Only ever holds int32_t, written whole so the
+                     // 8 byte loads of the payload forward from the store
     Obj *obj;
   } as;
 } Value;
@@ -30,20 +90,35 @@ typedef struct Value {
 // Macros to check if the value is of a particular type
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
-#define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_DOUBLE(value) ((value).type == VAL_NUMBER)
+#define IS_INT(value) ((value).type == VAL_INT)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
 // Uncasting macros
 #define AS_BOOL(value) ((value).as.boolean)
-#define AS_NUMBER(value) ((value).as.number)
+#define AS_DOUBLE(value) ((value).as.number)
+#define AS_INT(value) ((int32_t)(value).as.integer)
 #define AS_OBJ(value) ((value).as.obj)
 
 // Casting definitions
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = (int32_t)(value)}})
 #define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj *)object}})
 
+#endif
+
+// Scripts see one number type. Integral results that fit 32 bits are
+// kept as ints so counters stay off the FPU, IS_NUMBER accepts both and
+// AS_NUMBER widens ints, NUMBER_VAL always makes a double
+#define IS_NUMBER(value) (IS_DOUBLE(value) || IS_INT(value))
+#define AS_NUMBER(value) valueToNumber(value)
+
+static inline double valueToNumber(Value value) {
+  return IS_INT(value) ? (double)AS_INT(value) : AS_DOUBLE(value);
+}
+
 // Represents an array of value
 typedef struct ValueArray {
   int capacity;
@@ -0,0 +1,311 @@
+#include "verifier.h"
+#include "../memory/memory.h"
+#include "../virtual_machine/vm.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// StackEffect describes how an instruction moves the value stack when
+// it falls through. peak is how far above the entry depth the stack
+// grows while the instruction runs
+typedef struct StackEffect {
+  int pops;
+  int pushes;
+  int peak;
+} StackEffect;
+
+static const StackEffect stackEffects[] = {
+    [OP_CONSTANT] = {0, 1, 1},
+    [OP_NEGATE] = {1, 1, 0},
+    [OP_RETURN] = {0, 0, 0},
+    [OP_PRINT] = {1, 0, 0},
+    [OP_JUMP_IF_FALSE] = {1, 1, 0},
+    [OP_JUMP] = {0, 0, 0},
+    [OP_LOOP] = {0, 0, 0},
+    [OP_NIL] = {0, 1, 1},
+    [OP_TRUE] = {0, 1, 1},
+    [OP_FALSE] = {0, 1, 1},
+    [OP_POP] = {1, 0, 0},
+    [OP_GET_GLOBAL] = {0, 1, 1},
+    [OP_SET_GLOBAL] = {1, 1, 0},
+    [OP_DEFINE_GLOBAL] = {1, 0, 0},
+    [OP_GET_GLOBAL_SLOT] = {0, 1, 1},
+    [OP_SET_GLOBAL_SLOT] = {1, 1, 0},
+    [OP_DEFINE_GLOBAL_SLOT] = {1, 0, 0},
+    [OP_GET_LOCAL] = {0, 1, 1},
+    [OP_SET_LOCAL] = {1, 1, 0},
+    [OP_EQUAL] = {2, 1, 0},
+    [OP_GREATOR] = {2, 1, 0},
+    [OP_LESS] = {2, 1, 0},
+    [OP_ADD] = {2, 1, 0},
+    [OP_SUBSTRACT] = {2, 1, 0},
+    [OP_MULTIPLY] = {2, 1, 0},
+    [OP_DIVIDE] = {2, 1, 0},
+    [OP_NOT] = {1, 1, 0},
+    // String concatenation pushes both register operands first
+    [OP_ADD_RK] = {0, 1, 2},
+    [OP_SUBSTRACT_RK] = {0, 1, 1},
+    [OP_MULTIPLY_RK] = {0, 1, 1},
+    [OP_DIVIDE_RK] = {0, 1, 1},
+    [OP_EQUAL_RK] = {0, 1, 1},
+    [OP_GREATOR_RK] = {0, 1, 1},
+    [OP_LESS_RK] = {0, 1, 1},
+    [OP_ADD_SET] = {0, 0, 2},
+    [OP_SUBSTRACT_SET] = {0, 0, 0},
+    [OP_MULTIPLY_SET] = {0, 0, 0},
+    [OP_DIVIDE_SET] = {0, 0, 0},
+    [OP_MOVE] = {0, 0, 0},
+    // Fused conditional jumps push the condition only when they jump
+    [OP_LESS_LOCAL_CONSTANT_JUMP] = {0, 0, 1},
+    [OP_ADD_LOCAL_CONSTANT] = {0, 0, 2},
+    [OP_LESS_RK_JUMP] = {0, 0, 1},
+    [OP_NOT_EQUAL] = {2, 1, 0},
+    [OP_NOT_LESS] = {2, 1, 0},
+    [OP_NOT_GREATOR] = {2, 1, 0},
+    [OP_SET_GLOBAL_SLOT_POP] = {1, 0, 0},
+    [OP_SET_LOCAL_POP] = {1, 0, 0},
+    [OP_ADD_NUM] = {2, 1, 0},
+    [OP_ADD_STR] = {2, 1, 0},
+    [OP_SUBSTRACT_NUM] = {2, 1, 0},
+    [OP_MULTIPLY_NUM] = {2, 1, 0},
+    [OP_DIVIDE_NUM] = {2, 1, 0},
+    [OP_GREATOR_NUM] = {2, 1, 0},
+    [OP_LESS_NUM] = {2, 1, 0},
+    [OP_ADD_INT] = {2, 1, 0},
+    [OP_SUBSTRACT_INT] = {2, 1, 0},
+    [OP_MULTIPLY_INT] = {2, 1, 0},
+    [OP_GREATOR_INT] = {2, 1, 0},
+    [OP_LESS_INT] = {2, 1, 0},
+};
+
+// Verifier state for one chunk
+typedef struct Verifier {
+  Chunk *chunk;
+  int *depths;   // stack depth on entry of each offset, -1 if unseen
+  bool *starts;  // offsets where an instruction starts
+  int *worklist; // offsets whose successors are still to be checked
+  int worklistCount;
+} Verifier;
+
+// verifyError reports why the chunk was rejected
+static bool verifyError(Verifier *verifier, int offset, const char *format,
+                        ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "[line %d] Verifier error at offset %d: ",
+          verifier->chunk->lines[offset], offset);
+  vfprintf(stderr, format, args);
+  fputs("\n", stderr);
+  va_end(args);
+  return false;
+}
+
+// flowTo records the stack depth control reaches target with, every
+// path into an offset has to agree on it
+static bool flowTo(Verifier *verifier, int from, int target, int depth) {
+  if (target < 0 || target >= verifier->chunk->count ||
+      !verifier->starts[target])
+    return verifyError(verifier, from,
+                       "control reaches offset %d which is not an instruction",
+                       target);
+
+  if (verifier->depths[target] == -1) {
+    verifier->depths[target] = depth;
+    verifier->worklist[verifier->worklistCount++] = target;
+    return true;
+  }
+
+  if (verifier->depths[target] != depth)
+    return verifyError(verifier, from,
+                       "stack depth %d does not match %d at offset %d", depth,
+                       verifier->depths[target], target);
+  return true;
+}
+
+// checkLocal checks a local slot lies below the stack top
+static bool checkLocal(Verifier *verifier, int offset, int slot, int depth) {
+  if (slot >= depth)
+    return verifyError(verifier, offset, "local slot %d above stack depth %d",
+                       slot, depth);
+  return true;
+}
+
+// checkConstant checks a constant index is inside the constant pool
+static bool checkConstant(Verifier *verifier, int offset, int constant) {
+  if (constant >= verifier->chunk->constants.count)
+    return verifyError(verifier, offset, "constant %d out of range", constant);
+  return true;
+}
+
+// checkGlobal checks a global slot was handed out by globalSlot()
+static bool checkGlobal(Verifier *verifier, int offset, int slot) {
+  if (slot >= vm.globalCount)
+    return verifyError(verifier, offset, "global slot %d out of range", slot);
+  return true;
+}
+
+// checkRegister checks a register operand addresses a valid local slot
+// or constant
+static bool checkRegister(Verifier *verifier, int offset, uint8_t rk,
+                          int depth) {
+  if (rk & RK_CONSTANT)
+    return checkConstant(verifier, offset, rk & RK_MAX);
+  return checkLocal(verifier, offset, rk, depth);
+}
+
+// checkOperands checks the local slots and constants an instruction
+// reads are in range for the stack depth it runs at
+static bool checkOperands(Verifier *verifier, int offset, int depth) {
+  uint8_t *code = &verifier->chunk->code[offset];
+
+  switch (code[0]) {
+  case OP_CONSTANT:
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+    return checkConstant(verifier, offset, code[1]);
+  case OP_GET_GLOBAL_SLOT:
+  case OP_SET_GLOBAL_SLOT:
+  case OP_DEFINE_GLOBAL_SLOT:
+  case OP_SET_GLOBAL_SLOT_POP:
+    return checkGlobal(verifier, offset, code[1]);
+  case OP_GET_LOCAL:
+    return checkLocal(verifier, offset, code[1], depth);
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_POP:
+    // The slot is written after the value is taken off the top
+    return checkLocal(verifier, offset, code[1], depth - 1);
+  case OP_ADD_RK:
+  case OP_SUBSTRACT_RK:
+  case OP_MULTIPLY_RK:
+  case OP_DIVIDE_RK:
+  case OP_EQUAL_RK:
+  case OP_GREATOR_RK:
+  case OP_LESS_RK:
+  case OP_LESS_RK_JUMP:
+    return checkRegister(verifier, offset, code[1], depth) &&
+           checkRegister(verifier, offset, code[2], depth);
+  case OP_ADD_SET:
+  case OP_SUBSTRACT_SET:
+  case OP_MULTIPLY_SET:
+  case OP_DIVIDE_SET:
+    return checkLocal(verifier, offset, code[1], depth) &&
+           checkRegister(verifier, offset, code[2], depth) &&
+           checkRegister(verifier, offset, code[3], depth);
+  case OP_MOVE:
+    return checkLocal(verifier, offset, code[1], depth) &&
+           checkRegister(verifier, offset, code[2], depth);
+  case OP_LESS_LOCAL_CONSTANT_JUMP:
+    return checkLocal(verifier, offset, code[1], depth) &&
+           checkConstant(verifier, offset, code[2]);
+  case OP_ADD_LOCAL_CONSTANT:
+    return checkLocal(verifier, offset, code[1], depth) &&
+           checkConstant(verifier, offset, code[2]) &&
+           checkLocal(verifier, offset, code[3], depth);
+  default:
+    return true;
+  }
+}
+
+// readJump reads the two byte jump operand ending an instruction
+static int readJump(Chunk *chunk, int offset, int length) {
+  return (chunk->code[offset + length - 2] << 8) |
+         chunk->code[offset + length - 1];
+}
+
+// verifyInstruction checks one reachable instruction and passes its
+// exit depth on to every successor
+static bool verifyInstruction(Verifier *verifier, int offset) {
+  Chunk *chunk = verifier->chunk;
+  uint8_t instruction = chunk->code[offset];
+  int length = instructionLength(instruction);
+  int depth = verifier->depths[offset];
+  StackEffect effect = stackEffects[instruction];
+
+  if (depth < effect.pops)
+    return verifyError(verifier, offset, "pops %d values from a stack of %d",
+                       effect.pops, depth);
+  if (!checkOperands(verifier, offset, depth))
+    return false;
+
+  int peak = depth + effect.peak;
+  int exitDepth = depth - effect.pops + effect.pushes;
+  if (peak > chunk->maxStackDepth)
+    chunk->maxStackDepth = peak;
+
+  int next = offset + length;
+  switch (instruction) {
+  case OP_RETURN:
+    return true;
+  case OP_JUMP:
+    return flowTo(verifier, offset,
+                  next + readJump(chunk, offset, length), exitDepth);
+  case OP_LOOP:
+    return flowTo(verifier, offset,
+                  next - readJump(chunk, offset, length), exitDepth);
+  case OP_JUMP_IF_FALSE:
+    return flowTo(verifier, offset,
+                  next + readJump(chunk, offset, length), exitDepth) &&
+           flowTo(verifier, offset, next, exitDepth);
+  case OP_LESS_LOCAL_CONSTANT_JUMP:
+  case OP_LESS_RK_JUMP:
+    return flowTo(verifier, offset,
+                  next + readJump(chunk, offset, length), exitDepth + 1) &&
+           flowTo(verifier, offset, next, exitDepth);
+  default:
+    return flowTo(verifier, offset, next, exitDepth);
+  }
+}
+
+// verifyChunk proves the chunk is stack safe before it runs: every
+// instruction is complete and known, every jump lands on an instruction,
+// all paths reach an offset with the same stack depth, nothing pops an
+// empty stack and every local slot and constant read exists. The
+// largest depth reached is stored in chunk->maxStackDepth
+bool verifyChunk(Chunk *chunk) {
+  Verifier verifier;
+  verifier.chunk = chunk;
+  verifier.depths = ARENA_ALLOCATE(int, chunk->count, MEM_COMPILER);
+  verifier.starts = ARENA_ALLOCATE(bool, chunk->count, MEM_COMPILER);
+  verifier.worklist = ARENA_ALLOCATE(int, chunk->count, MEM_COMPILER);
+  verifier.worklistCount = 0;
+  memset(verifier.starts, 0, sizeof(bool) * chunk->count);
+  chunk->maxStackDepth = 0;
+
+  bool valid = chunk->count > 0;
+  int offset = 0;
+  while (valid && offset < chunk->count) {
+    uint8_t instruction = chunk->code[offset];
+    int length = instruction < sizeof(stackEffects) / sizeof(stackEffects[0])
+                     ? instructionLength(instruction)
+                     : 0;
+
+    if (length == 0) {
+      valid = verifyError(&verifier, offset, "unknown opcode %d", instruction);
+    } else if (offset + length > chunk->count) {
+      valid = verifyError(&verifier, offset, "truncated instruction");
+    } else {
+      verifier.starts[offset] = true;
+      verifier.depths[offset] = -1;
+      offset += length;
+    }
+  }
+
+  if (valid) {
+    verifier.depths[0] = 0;
+    verifier.worklist[verifier.worklistCount++] = 0;
+  }
+
+  while (valid && verifier.worklistCount > 0) {
+    int next = verifier.worklist[--verifier.worklistCount];
+    valid = verifyInstruction(&verifier, next);
+  }
+
+  ARENA_FREE_ARRAY(int, verifier.depths, chunk->count, MEM_COMPILER);
+  ARENA_FREE_ARRAY(bool, verifier.starts, chunk->count, MEM_COMPILER);
+  ARENA_FREE_ARRAY(int, verifier.worklist, chunk->count, MEM_COMPILER);
+  return valid;
+}
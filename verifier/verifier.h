@@ -0,0 +1,8 @@
+#ifndef vm_verifier_h
+#define vm_verifier_h
+
+#include "../chunk/chunk.h"
+
+bool verifyChunk(Chunk *chunk);
+
+#endif
@@ -3,56 +3,103 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "../compiler/compiler.h"
 #include "../debug/debug.h"
+#include "../jit/jit.h"
 #include "../memory/memory.h"
 #include "../object/object.h"
+#include "../superinstruction/superinstruction.h"
+#include "../trace/trace.h"
 #include "vm.h"
 
-bool valueEquals(Value a, Value b);
-
 VM vm;
+bool quickeningEnabled = true;
+bool printQuickened = false;
 
 static void resetStack() { vm.stackTop = vm.stack; }
 
+// randomSeed reads 8 bytes from the system's random source. Without one
+// it falls back to the clock and the address the VM was loaded at
+uint64_t randomSeed() {
+  uint64_t seed = 0;
+  FILE *random = fopen("/dev/urandom", "rb");
+  if (random != NULL) {
+    if (fread(&seed, sizeof(seed), 1, random) != 1)
+      seed = 0;
+    fclose(random);
+  }
+  if (seed == 0) {
+    seed = ((uint64_t)time(NULL) << 32) ^ (uint64_t)clock() ^
+           (uint64_t)(uintptr_t)&vm;
+    seed *= 0x9e3779b97f4a7c15ull;
+  }
+  return seed;
+}
+
 void initVM() {
   resetStack();
   vm.stackTop = vm.stack;
+  vm.chunk = NULL;
   vm.objects = NULL;
-  initTable(&vm.strings);
+  vm.youngObjects = NULL;
+  vm.nurseryBytes = 0;
+  vm.rememberedCount = 0;
+  vm.rememberedCapacity = 0;
+  vm.remembered = NULL;
+  vm.bytesAllocated = 0;
+  vm.nextGC = GC_HEAP_MIN;
+  vm.grayCount = 0;
+  vm.grayCapacity = 0;
+  vm.grayStack = NULL;
+  vm.hashSeed = randomSeed();
+  initInternTable(&vm.strings);
   initTable(&vm.globals);
+  vm.globalCount = 0;
+#ifdef VM_COUNT_INSTRUCTIONS
+  vm.instructionCount = 0;
+#endif
+#ifdef VM_PROFILE_OPCODES
+  vm.profile = NULL;
+#endif
 }
 
-static void freeObject(Obj *object) {
-  switch (object->type) {
-  case OBJ_STRING: {
-    ObjString *string = (ObjString *)object;
-    FREE_ARRAY(char, string->chars, string->length + 1);
-    FREE(ObjString, object);
-    break;
-  }
-  }
+void freeVM() {
+  freeInternTable(&vm.strings);
+  freeObjects();
+  freeHeap();
 }
 
-// freeObjects frees the objects from memory
-static void freeObjects() {
-  Obj *object = vm.objects;
-
-  while (object != NULL) {
-    Obj *next = object->next;
-    freeObject(object);
-    object = next;
-  }
+// globalSlot returns the slot index of a global variable, handing out
+// the next free slot the first time a name is seen. Returns -1 when all
+// GLOBALS_MAX slots are taken
+int globalSlot(ObjString *name) {
+  Value slot;
+  if (tableGet(&vm.globals, name, &slot))
+    return (int)AS_NUMBER(slot);
+  if (vm.globalCount == GLOBALS_MAX)
+    return -1;
+
+  GlobalSlot *global = &vm.globalSlots[vm.globalCount];
+  global->value = NIL_VAL;
+  global->name = name;
+  global->defined = false;
+  tableSet(&vm.globals, name, NUMBER_VAL(vm.globalCount));
+  return vm.globalCount++;
 }
 
-void freeVM() {
-  freeTable(&vm.strings);
-  freeObjects();
+// findGlobal returns the defined global a name refers to, or NULL
+static GlobalSlot *findGlobal(ObjString *name) {
+  Value slot;
+  if (!tableGet(&vm.globals, name, &slot) ||
+      !vm.globalSlots[(int)AS_NUMBER(slot)].defined)
+    return NULL;
+  return &vm.globalSlots[(int)AS_NUMBER(slot)];
 }
 
 // runtimeError handles a runtime error in the script
-static void runtimeError(const char *format, ...) {
+void runtimeError(const char *format, ...) {
   va_list args;
   va_start(args, format);
   vfprintf(stderr, format, args);
@@ -69,7 +116,7 @@ static void runtimeError(const char *format, ...) {
 static Value peek(int distance) { return vm.stackTop[-1 - distance]; }
 
 // isFalsey checks if a value is falsey or not
-static bool isFalsey(Value value) {
+bool isFalsey(Value value) {
   if (IS_NIL(value))
     return false;
 
@@ -81,14 +128,22 @@ static bool isFalsey(Value value) {
 
 // valueEquals checks if two values are equal
 bool valueEquals(Value a, Value b) {
+  // An int and a double holding the same number are equal
+  if (IS_NUMBER(a) && IS_NUMBER(b))
+    return AS_NUMBER(a) == AS_NUMBER(b);
+  // Not every string is interned, strings compare their characters
+  if (IS_STRING(a) && IS_STRING(b))
+    return stringsEqual(AS_OBJ(a), AS_OBJ(b));
+
+#ifdef VM_NAN_BOXING
+  return a == b;
+#else
   if (a.type != b.type)
     return false;
 
   switch (a.type) {
   case VAL_NIL:
     return true;
-  case VAL_NUMBER:
-    return (AS_NUMBER(a) == AS_NUMBER(b));
   case VAL_BOOL:
     return (AS_BOOL(a) == AS_BOOL(b));
   case VAL_OBJ:
@@ -96,40 +151,182 @@ bool valueEquals(Value a, Value b) {
   default:
     return false;
   }
+#endif
 }
 
-static void concatnate() {
-  ObjString *b = AS_STRING(pop());
-  ObjString *a = AS_STRING(pop());
+// concatnate replaces the two strings on top of the stack with
+// their concatenation
+void concatnate() {
+  Obj *b = AS_OBJ(pop());
+  Obj *a = AS_OBJ(pop());
+
+  // Long results are ropes, their characters are only copied once
+  // something reads them
+  int length = stringLength(a) + stringLength(b);
+  if (ropesEnabled && length >= ROPE_MIN_LENGTH) {
+    push(OBJ_VAL(makeRope(a, b, length)));
+    return;
+  }
+
+  // Build the result inside its final object
+  ObjString *left = flatString(a);
+  ObjString *right = flatString(b);
+  ObjString *result = allocateString(length);
+  memcpy(result->chars, left->chars, left->length);
+  memcpy(result->chars + left->length, right->chars, right->length);
+
+  push(OBJ_VAL(takeString(result)));
+}
 
-  // Allocate memory
-  int length = a->length + b->length;
-  char *chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
+// foldInstruction computes an operator instruction on constants the way
+// run() would, the unary ones ignore b. Returns false if run() fails on
+// the operands, so the error stays in the code. Concatenated constants
+// are always flat
+bool foldInstruction(uint8_t instruction, Value a, Value b, Value *result) {
+  switch (instruction) {
+  case OP_NOT:
+    *result = BOOL_VAL(isFalsey(a));
+    return true;
+  case OP_NEGATE:
+    if (!IS_NUMBER(a))
+      return false;
+    negateNumber(result, a);
+    return true;
+  case OP_EQUAL:
+    *result = BOOL_VAL(valueEquals(a, b));
+    return true;
+  case OP_ADD:
+    if (IS_STRING(a) && IS_STRING(b)) {
+      ObjString *left = flatString(AS_OBJ(a));
+      ObjString *right = flatString(AS_OBJ(b));
+      ObjString *string = allocateString(left->length + right->length);
+      memcpy(string->chars, left->chars, left->length);
+      memcpy(string->chars + left->length, right->chars, right->length);
+      *result = OBJ_VAL(takeString(string));
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
 
-  chars[length] = '\0';
+  if (!IS_NUMBER(a) || !IS_NUMBER(b))
+    return false;
 
-  ObjString *result = takeString(chars, length);
-  push(OBJ_VAL(result));
+  switch (instruction) {
+  case OP_ADD:
+    addNumbers(result, a, b);
+    return true;
+  case OP_SUBSTRACT:
+    subtractNumbers(result, a, b);
+    return true;
+  case OP_MULTIPLY:
+    multiplyNumbers(result, a, b);
+    return true;
+  case OP_DIVIDE:
+    *result = NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b));
+    return true;
+  case OP_GREATOR:
+    greaterNumbers(result, a, b);
+    return true;
+  case OP_LESS:
+    lessNumbers(result, a, b);
+    return true;
+  default:
+    return false;
+  }
 }
 
 // Run function actually handles the interpretation
 static InterpreterResult run() {
-#define READ_BYTE() (*vm.ip++)
+  // Keep the instruction pointer in a local so it can live in a
+  // register, vm.ip is only written back when an error needs it
+  register uint8_t *ip = vm.ip;
+
+#define READ_BYTE() (*ip++)
 #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
-#define READ_SHORT() (vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | vm.ip[-1]))
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_RK()                                                              \
+  (ip++, (ip[-1] & RK_CONSTANT)                                                \
+             ? vm.chunk->constants.values[ip[-1] & RK_MAX]                     \
+             : vm.stack[ip[-1]])
+#define RUNTIME_ERROR(...)                                                     \
+  do {                                                                         \
+    vm.ip = ip;                                                                \
+    runtimeError(__VA_ARGS__);                                                 \
+    return INTERPRET_RUNTIME_ERROR;                                            \
+  } while (false)
 #define BINARY_OP(valueType, op)                                               \
   do {                                                                         \
-    if (!IS_NUMBER(peek(0)) && !IS_NUMBER(peek(1))) {                          \
-      runtimeError("Operands must be numbers for binary operations");          \
-      return INTERPRET_RUNTIME_ERROR;                                          \
-    }                                                                          \
+    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1)))                            \
+      RUNTIME_ERROR("Operands must be numbers for binary operations");         \
     double b = AS_NUMBER(pop());                                               \
     double a = AS_NUMBER(pop());                                               \
     push(valueType(a op b));                                                   \
   } while (false)
+#define REGISTER_OP(a, b, valueType, op)                                       \
+  do {                                                                         \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))                                        \
+      RUNTIME_ERROR("Operands must be numbers for binary operations");         \
+    push(valueType(AS_NUMBER(a) op AS_NUMBER(b)));                             \
+  } while (false)
+#define STORE_OP(valueType, op)                                                \
+  do {                                                                         \
+    uint8_t slot = READ_BYTE();                                                \
+    Value a = READ_RK();                                                       \
+    Value b = READ_RK();                                                       \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))                                        \
+      RUNTIME_ERROR("Operands must be numbers for binary operations");         \
+    vm.stack[slot] = valueType(AS_NUMBER(a) op AS_NUMBER(b));                  \
+  } while (false)
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+// Quickening rewrites the one byte instruction that is running in place,
+// dequickening also steps back so the generic form runs next
+#define QUICKEN(instruction)                                                   \
+  (quickeningEnabled ? (void)(ip[-1] = (instruction)) : (void)0)
+#define DEQUICKEN(instruction) (ip[-1] = (instruction), ip--)
+// Quickens to the int form when both operands are ints, any other pair of
+// numbers is computed on doubles by the double form
+#define QUICKEN_NUMBERS(a, b, intForm, doubleForm)                             \
+  do {                                                                         \
+    if (IS_INT(a) && IS_INT(b))                                                \
+      QUICKEN(intForm);                                                        \
+    else                                                                       \
+      QUICKEN(doubleForm);                                                     \
+  } while (false)
+#define ARITHMETIC_OP(compute, intForm, doubleForm)                            \
+  do {                                                                         \
+    Value b = peek(0);                                                         \
+    Value a = peek(1);                                                         \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))                                        \
+      RUNTIME_ERROR("Operands must be numbers for binary operations");         \
+    QUICKEN_NUMBERS(a, b, intForm, doubleForm);                                \
+    compute(&vm.stackTop[-2], a, b);                                           \
+    vm.stackTop--;                                                             \
+  } while (false)
+#define NUMBER_OP(valueType, op)                                               \
+  do {                                                                         \
+    vm.stackTop[-2] =                                                          \
+        valueType(AS_NUMBER(vm.stackTop[-2]) op AS_NUMBER(vm.stackTop[-1]));   \
+    vm.stackTop--;                                                             \
+  } while (false)
+#define INT_OP(compute)                                                        \
+  do {                                                                         \
+    compute(&vm.stackTop[-2], vm.stackTop[-2], vm.stackTop[-1]);               \
+    vm.stackTop--;                                                             \
+  } while (false)
+
+#if defined(VM_COUNT_INSTRUCTIONS) && defined(VM_PROFILE_OPCODES)
+#define COUNT_INSTRUCTION()                                                    \
+  (vm.instructionCount++, vm.executionCounts[ip - vm.chunk->code]++)
+#elif defined(VM_COUNT_INSTRUCTIONS)
+#define COUNT_INSTRUCTION() (vm.instructionCount++)
+#elif defined(VM_PROFILE_OPCODES)
+#define COUNT_INSTRUCTION() (vm.executionCounts[ip - vm.chunk->code]++)
+#else
+#define COUNT_INSTRUCTION() ((void)0)
+#endif
 
 #ifdef DEBUG_TRACE_EXECUTION
   printf("          ");
@@ -139,151 +336,542 @@ static InterpreterResult run() {
     printf(" ]");
   }
   printf("\n");
-  dissassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+  dissassembleInstruction(vm.chunk, (int)(ip - vm.chunk->code));
 #endif
 
+#ifdef VM_COMPUTED_GOTO
+  // One label per opcode, every handler ends with its own indirect
+  // jump so the branch predictor can learn each opcode's successor
+  static void *dispatchTable[] = {
+      [OP_CONSTANT] = &&op_OP_CONSTANT,
+      [OP_NEGATE] = &&op_OP_NEGATE,
+      [OP_RETURN] = &&op_OP_RETURN,
+      [OP_PRINT] = &&op_OP_PRINT,
+      [OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE,
+      [OP_JUMP] = &&op_OP_JUMP,
+      [OP_LOOP] = &&op_OP_LOOP,
+      [OP_NIL] = &&op_OP_NIL,
+      [OP_TRUE] = &&op_OP_TRUE,
+      [OP_FALSE] = &&op_OP_FALSE,
+      [OP_POP] = &&op_OP_POP,
+      [OP_GET_GLOBAL] = &&op_OP_GET_GLOBAL,
+      [OP_SET_GLOBAL] = &&op_OP_SET_GLOBAL,
+      [OP_DEFINE_GLOBAL] = &&op_OP_DEFINE_GLOBAL,
+      [OP_GET_GLOBAL_SLOT] = &&op_OP_GET_GLOBAL_SLOT,
+      [OP_SET_GLOBAL_SLOT] = &&op_OP_SET_GLOBAL_SLOT,
+      [OP_DEFINE_GLOBAL_SLOT] = &&op_OP_DEFINE_GLOBAL_SLOT,
+      [OP_GET_LOCAL] = &&op_OP_GET_LOCAL,
+      [OP_SET_LOCAL] = &&op_OP_SET_LOCAL,
+      [OP_EQUAL] = &&op_OP_EQUAL,
+      [OP_GREATOR] = &&op_OP_GREATOR,
+      [OP_LESS] = &&op_OP_LESS,
+      [OP_ADD] = &&op_OP_ADD,
+      [OP_SUBSTRACT] = &&op_OP_SUBSTRACT,
+      [OP_MULTIPLY] = &&op_OP_MULTIPLY,
+      [OP_DIVIDE] = &&op_OP_DIVIDE,
+      [OP_NOT] = &&op_OP_NOT,
+      [OP_ADD_RK] = &&op_OP_ADD_RK,
+      [OP_SUBSTRACT_RK] = &&op_OP_SUBSTRACT_RK,
+      [OP_MULTIPLY_RK] = &&op_OP_MULTIPLY_RK,
+      [OP_DIVIDE_RK] = &&op_OP_DIVIDE_RK,
+      [OP_EQUAL_RK] = &&op_OP_EQUAL_RK,
+      [OP_GREATOR_RK] = &&op_OP_GREATOR_RK,
+      [OP_LESS_RK] = &&op_OP_LESS_RK,
+      [OP_ADD_SET] = &&op_OP_ADD_SET,
+      [OP_SUBSTRACT_SET] = &&op_OP_SUBSTRACT_SET,
+      [OP_MULTIPLY_SET] = &&op_OP_MULTIPLY_SET,
+      [OP_DIVIDE_SET] = &&op_OP_DIVIDE_SET,
+      [OP_MOVE] = &&op_OP_MOVE,
+      [OP_LESS_LOCAL_CONSTANT_JUMP] = &&op_OP_LESS_LOCAL_CONSTANT_JUMP,
+      [OP_ADD_LOCAL_CONSTANT] = &&op_OP_ADD_LOCAL_CONSTANT,
+      [OP_LESS_RK_JUMP] = &&op_OP_LESS_RK_JUMP,
+      [OP_NOT_EQUAL] = &&op_OP_NOT_EQUAL,
+      [OP_NOT_LESS] = &&op_OP_NOT_LESS,
+      [OP_NOT_GREATOR] = &&op_OP_NOT_GREATOR,
+      [OP_SET_GLOBAL_SLOT_POP] = &&op_OP_SET_GLOBAL_SLOT_POP,
+      [OP_SET_LOCAL_POP] = &&op_OP_SET_LOCAL_POP,
+      [OP_ADD_NUM] = &&op_OP_ADD_NUM,
+      [OP_ADD_STR] = &&op_OP_ADD_STR,
+      [OP_SUBSTRACT_NUM] = &&op_OP_SUBSTRACT_NUM,
+      [OP_MULTIPLY_NUM] = &&op_OP_MULTIPLY_NUM,
+      [OP_DIVIDE_NUM] = &&op_OP_DIVIDE_NUM,
+      [OP_GREATOR_NUM] = &&op_OP_GREATOR_NUM,
+      [OP_LESS_NUM] = &&op_OP_LESS_NUM,
+      [OP_ADD_INT] = &&op_OP_ADD_INT,
+      [OP_SUBSTRACT_INT] = &&op_OP_SUBSTRACT_INT,
+      [OP_MULTIPLY_INT] = &&op_OP_MULTIPLY_INT,
+      [OP_GREATOR_INT] = &&op_OP_GREATOR_INT,
+      [OP_LESS_INT] = &&op_OP_LESS_INT,
+  };
+  // While a trace is recorded every opcode goes through the recorder
+  // first, so dispatch costs nothing extra the rest of the time
+  static void *recordTable[] = {[0 ... UINT8_MAX] = &&trace_record};
+  void **dispatch = dispatchTable;
+
+#define CASE(opcode) op_##opcode:
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    COUNT_INSTRUCTION();                                                       \
+    goto *dispatch[READ_BYTE()];                                               \
+  } while (false)
+#define SELECT_DISPATCH()                                                      \
+  (dispatch = traceRecording ? recordTable : dispatchTable)
+
+  DISPATCH();
+
+trace_record:
+  recordInstruction(ip - 1);
+  SELECT_DISPATCH();
+  goto *dispatchTable[ip[-1]];
+#else
+#define CASE(opcode) case opcode:
+#define DISPATCH() break
+#define SELECT_DISPATCH() ((void)0)
+
   for (;;) {
+    COUNT_INSTRUCTION();
+    if (traceRecording)
+      recordInstruction(ip);
     uint8_t instruction = READ_BYTE();
     switch (instruction) {
-    case OP_RETURN: {
-      // printValue(pop());
-      // Exit interpreter
-      return INTERPRET_OK;
-    }
-    case OP_CONSTANT: {
-      Value constant = READ_CONSTANT();
-      // printf("Got constant: %.0f \n", (double)constant);
-      push(constant);
-      break;
-    }
-    case OP_POP:
-      pop();
-      break;
-    case OP_NEGATE: {
-      Value value = pop();
-      if (!IS_NUMBER(value)) {
-        runtimeError("Operand must be a number for negation");
-        return INTERPRET_RUNTIME_ERROR;
-      }
-
-      push(NUMBER_VAL(-AS_NUMBER(value)));
-      break;
-    }
-    case OP_ADD: {
-      if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-        concatnate();
-      } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-        BINARY_OP(NUMBER_VAL, +);
-      } else {
-        runtimeError("Operands must be numbers or two strings");
-        return INTERPRET_RUNTIME_ERROR;
-      }
-      break;
-    }
+#endif
+  CASE(OP_RETURN) {
+    // printValue(pop());
+    // Exit interpreter
+    return INTERPRET_OK;
+  }
+  CASE(OP_CONSTANT) {
+    Value constant = READ_CONSTANT();
+    // printf("Got constant: %.0f \n", (double)constant);
+    push(constant);
+    DISPATCH();
+  }
+  CASE(OP_POP) {
+    pop();
+    DISPATCH();
+  }
+  CASE(OP_NEGATE) {
+    Value value = pop();
+    if (!IS_NUMBER(value))
+      RUNTIME_ERROR("Operand must be a number for negation");
 
-    case OP_SUBSTRACT:
-      BINARY_OP(NUMBER_VAL, -);
-      break;
-    case OP_MULTIPLY:
-      BINARY_OP(NUMBER_VAL, *);
-      break;
-    case OP_DIVIDE:
-      BINARY_OP(NUMBER_VAL, /);
-      break;
-    case OP_NIL:
-      push(NIL_VAL);
-      break;
-    case OP_TRUE:
-      push(BOOL_VAL(true));
-      break;
-    case OP_FALSE:
-      push(BOOL_VAL(false));
-      break;
-    case OP_EQUAL: {
-      Value b = pop();
-      Value a = pop();
-      push(BOOL_VAL(valueEquals(a, b)));
-      break;
-    }
-    case OP_GREATOR:
-      BINARY_OP(BOOL_VAL, >);
-      break;
-    case OP_LESS:
-      BINARY_OP(BOOL_VAL, <);
-      break;
-    case OP_NOT:
-      push(BOOL_VAL(isFalsey(pop())));
-      break;
-    case OP_PRINT:
-      printValue(pop());
-      break;
-    case OP_DEFINE_GLOBAL: {
-      ObjString *variableName = READ_STRING();
-      // Add the variableName to the table
-      tableSet(&vm.globals, variableName, peek(0));
-      pop();
-      break;
+    negateNumber(vm.stackTop++, value);
+    DISPATCH();
+  }
+  CASE(OP_ADD) {
+    if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+      QUICKEN(OP_ADD_STR);
+      concatnate();
+    } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+      ARITHMETIC_OP(addNumbers, OP_ADD_INT, OP_ADD_NUM);
+    } else {
+      RUNTIME_ERROR("Operands must be numbers or two strings");
     }
-    case OP_GET_GLOBAL: {
-      ObjString *name = READ_STRING();
-      Value value;
+    DISPATCH();
+  }
 
-      if (!tableGet(&vm.globals, name, &value)) {
-        runtimeError("Undefined variable %s \n", name->chars);
-        return INTERPRET_RUNTIME_ERROR;
-      }
+  CASE(OP_SUBSTRACT) {
+    ARITHMETIC_OP(subtractNumbers, OP_SUBSTRACT_INT, OP_SUBSTRACT_NUM);
+    DISPATCH();
+  }
+  CASE(OP_MULTIPLY) {
+    ARITHMETIC_OP(multiplyNumbers, OP_MULTIPLY_INT, OP_MULTIPLY_NUM);
+    DISPATCH();
+  }
+  CASE(OP_DIVIDE) {
+    BINARY_OP(NUMBER_VAL, /);
+    QUICKEN(OP_DIVIDE_NUM);
+    DISPATCH();
+  }
+  CASE(OP_NIL) {
+    push(NIL_VAL);
+    DISPATCH();
+  }
+  CASE(OP_TRUE) {
+    push(BOOL_VAL(true));
+    DISPATCH();
+  }
+  CASE(OP_FALSE) {
+    push(BOOL_VAL(false));
+    DISPATCH();
+  }
+  CASE(OP_EQUAL) {
+    Value b = pop();
+    Value a = pop();
+    push(BOOL_VAL(valueEquals(a, b)));
+    DISPATCH();
+  }
+  CASE(OP_GREATOR) {
+    ARITHMETIC_OP(greaterNumbers, OP_GREATOR_INT, OP_GREATOR_NUM);
+    DISPATCH();
+  }
+  CASE(OP_LESS) {
+    ARITHMETIC_OP(lessNumbers, OP_LESS_INT, OP_LESS_NUM);
+    DISPATCH();
+  }
+  CASE(OP_NOT) {
+    push(BOOL_VAL(isFalsey(pop())));
+    DISPATCH();
+  }
+  CASE(OP_PRINT) {
+    printValue(pop());
+    DISPATCH();
+  }
+  CASE(OP_DEFINE_GLOBAL) {
+    ObjString *variableName = READ_STRING();
+    int slot = globalSlot(variableName);
+    if (slot == -1)
+      RUNTIME_ERROR("Too many global variables");
+
+    vm.globalSlots[slot].value = pop();
+    vm.globalSlots[slot].defined = true;
+    DISPATCH();
+  }
+  CASE(OP_GET_GLOBAL) {
+    ObjString *name = READ_STRING();
+    GlobalSlot *global = findGlobal(name);
 
-      push(value);
-      break;
-    }
-    case OP_SET_GLOBAL: {
-      ObjString *name = READ_STRING();
-      // tableSet returns true if it is a new
-      // value that is being set, else it
-      // returns false, hence this if branch
-      if (tableSet(&vm.globals, name, peek(0))) {
-        tableDelete(&vm.globals, name);
-        runtimeError("Undefined variable '%s'", name->chars);
-        return INTERPRET_RUNTIME_ERROR;
-      }
-      break;
-    }
+    if (global == NULL)
+      RUNTIME_ERROR("Undefined variable %s \n", name->chars);
 
-    case OP_SET_LOCAL: {
-      uint8_t slot = READ_BYTE();
-      vm.stack[slot] = peek(0);
-      break;
-    }
+    push(global->value);
+    DISPATCH();
+  }
+  CASE(OP_SET_GLOBAL) {
+    ObjString *name = READ_STRING();
+    GlobalSlot *global = findGlobal(name);
 
-    case OP_GET_LOCAL: {
-      uint8_t slot = READ_BYTE();
-      push(vm.stack[slot]);
-      break;
+    if (global == NULL)
+      RUNTIME_ERROR("Undefined variable '%s'", name->chars);
+
+    global->value = peek(0);
+    DISPATCH();
+  }
+  CASE(OP_DEFINE_GLOBAL_SLOT) {
+    GlobalSlot *global = &vm.globalSlots[READ_BYTE()];
+    global->value = pop();
+    global->defined = true;
+    DISPATCH();
+  }
+  CASE(OP_GET_GLOBAL_SLOT) {
+    GlobalSlot *global = &vm.globalSlots[READ_BYTE()];
+    if (!global->defined)
+      RUNTIME_ERROR("Undefined variable %s \n", global->name->chars);
+
+    push(global->value);
+    DISPATCH();
+  }
+  CASE(OP_SET_GLOBAL_SLOT) {
+    GlobalSlot *global = &vm.globalSlots[READ_BYTE()];
+    if (!global->defined)
+      RUNTIME_ERROR("Undefined variable '%s'", global->name->chars);
+
+    global->value = peek(0);
+    DISPATCH();
+  }
+
+  CASE(OP_SET_LOCAL) {
+    uint8_t slot = READ_BYTE();
+    vm.stack[slot] = peek(0);
+    DISPATCH();
+  }
+
+  CASE(OP_GET_LOCAL) {
+    uint8_t slot = READ_BYTE();
+    push(vm.stack[slot]);
+    DISPATCH();
+  }
+
+  CASE(OP_JUMP_IF_FALSE) {
+    // Calculate the offset to jump
+    uint16_t offset = READ_SHORT();
+    if (isFalsey(peek(0)))
+      ip += offset;
+    DISPATCH();
+  }
+
+  CASE(OP_JUMP) {
+    uint16_t offset = READ_SHORT();
+    ip += offset;
+    DISPATCH();
+  }
+
+  CASE(OP_LOOP) {
+    uint16_t offset = READ_SHORT();
+    ip -= offset;
+    if (tracingEnabled) {
+      ip = traceLoop(ip, ip + offset - 3);
+      SELECT_DISPATCH();
     }
+    DISPATCH();
+  }
 
-    case OP_JUMP_IF_FALSE: {
-      // Calculate the offset to jump
-      uint16_t offset = READ_SHORT();
-      if (isFalsey(peek(0)))
-        vm.ip += offset;
-      break;
+  CASE(OP_ADD_RK) {
+    Value a = READ_RK();
+    Value b = READ_RK();
+    if (IS_STRING(a) && IS_STRING(b)) {
+      push(a);
+      push(b);
+      concatnate();
+    } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+      push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+    } else {
+      RUNTIME_ERROR("Operands must be numbers or two strings");
     }
+    DISPATCH();
+  }
+  CASE(OP_SUBSTRACT_RK) {
+    Value a = READ_RK();
+    Value b = READ_RK();
+    REGISTER_OP(a, b, NUMBER_VAL, -);
+    DISPATCH();
+  }
+  CASE(OP_MULTIPLY_RK) {
+    Value a = READ_RK();
+    Value b = READ_RK();
+    REGISTER_OP(a, b, NUMBER_VAL, *);
+    DISPATCH();
+  }
+  CASE(OP_DIVIDE_RK) {
+    Value a = READ_RK();
+    Value b = READ_RK();
+    REGISTER_OP(a, b, NUMBER_VAL, /);
+    DISPATCH();
+  }
+  CASE(OP_EQUAL_RK) {
+    Value a = READ_RK();
+    Value b = READ_RK();
+    push(BOOL_VAL(valueEquals(a, b)));
+    DISPATCH();
+  }
+  CASE(OP_GREATOR_RK) {
+    Value a = READ_RK();
+    Value b = READ_RK();
+    REGISTER_OP(a, b, BOOL_VAL, >);
+    DISPATCH();
+  }
+  CASE(OP_LESS_RK) {
+    Value a = READ_RK();
+    Value b = READ_RK();
+    REGISTER_OP(a, b, BOOL_VAL, <);
+    DISPATCH();
+  }
 
-    case OP_JUMP: {
-      uint16_t offset = READ_SHORT();
-      vm.ip += offset;
-      break;
+  CASE(OP_ADD_SET) {
+    uint8_t slot = READ_BYTE();
+    Value a = READ_RK();
+    Value b = READ_RK();
+    if (IS_STRING(a) && IS_STRING(b)) {
+      push(a);
+      push(b);
+      concatnate();
+      vm.stack[slot] = pop();
+    } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+      vm.stack[slot] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+    } else {
+      RUNTIME_ERROR("Operands must be numbers or two strings");
     }
+    DISPATCH();
+  }
+  CASE(OP_SUBSTRACT_SET) {
+    STORE_OP(NUMBER_VAL, -);
+    DISPATCH();
+  }
+  CASE(OP_MULTIPLY_SET) {
+    STORE_OP(NUMBER_VAL, *);
+    DISPATCH();
+  }
+  CASE(OP_DIVIDE_SET) {
+    STORE_OP(NUMBER_VAL, /);
+    DISPATCH();
+  }
+  CASE(OP_MOVE) {
+    uint8_t slot = READ_BYTE();
+    vm.stack[slot] = READ_RK();
+    DISPATCH();
+  }
 
-    case OP_LOOP: {
-      uint16_t offset = READ_SHORT();
-      vm.ip -= offset;
-      break;
+  // Superinstructions. A fused conditional jump only pushes the
+  // condition when it jumps, the fallthrough path had popped it
+  CASE(OP_LESS_LOCAL_CONSTANT_JUMP) {
+    Value a = vm.stack[READ_BYTE()];
+    Value b = READ_CONSTANT();
+    uint16_t offset = READ_SHORT();
+    bool less;
+    if (IS_INT(a) && IS_INT(b))
+      less = AS_INT(a) < AS_INT(b);
+    else if (IS_NUMBER(a) && IS_NUMBER(b))
+      less = AS_NUMBER(a) < AS_NUMBER(b);
+    else
+      RUNTIME_ERROR("Operands must be numbers for binary operations");
+    if (!less) {
+      push(BOOL_VAL(false));
+      ip += offset;
+    }
+    DISPATCH();
+  }
+  CASE(OP_ADD_LOCAL_CONSTANT) {
+    Value a = vm.stack[READ_BYTE()];
+    Value b = READ_CONSTANT();
+    uint8_t slot = READ_BYTE();
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+      addNumbers(&vm.stack[slot], a, b);
+    } else if (IS_STRING(a) && IS_STRING(b)) {
+      push(a);
+      push(b);
+      concatnate();
+      vm.stack[slot] = pop();
+    } else {
+      RUNTIME_ERROR("Operands must be numbers or two strings");
+    }
+    DISPATCH();
+  }
+  CASE(OP_LESS_RK_JUMP) {
+    Value a = READ_RK();
+    Value b = READ_RK();
+    uint16_t offset = READ_SHORT();
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+      RUNTIME_ERROR("Operands must be numbers for binary operations");
+    if (!(AS_NUMBER(a) < AS_NUMBER(b))) {
+      push(BOOL_VAL(false));
+      ip += offset;
     }
+    DISPATCH();
+  }
+  CASE(OP_NOT_EQUAL) {
+    Value b = pop();
+    Value a = pop();
+    push(BOOL_VAL(!valueEquals(a, b)));
+    DISPATCH();
+  }
+  CASE(OP_NOT_LESS) {
+    BINARY_OP(NOT_BOOL_VAL, <);
+    DISPATCH();
+  }
+  CASE(OP_NOT_GREATOR) {
+    BINARY_OP(NOT_BOOL_VAL, >);
+    DISPATCH();
+  }
+  CASE(OP_SET_GLOBAL_SLOT_POP) {
+    GlobalSlot *global = &vm.globalSlots[READ_BYTE()];
+    if (!global->defined)
+      RUNTIME_ERROR("Undefined variable '%s'", global->name->chars);
+
+    global->value = pop();
+    DISPATCH();
+  }
+  CASE(OP_SET_LOCAL_POP) {
+    uint8_t slot = READ_BYTE();
+    vm.stack[slot] = pop();
+    DISPATCH();
+  }
+
+  // Quickened instructions. Each guards the operand types its generic
+  // form saw and hands the instruction back to it when they change. The
+  // double forms also take an int meeting a double, AS_NUMBER widens it
+  CASE(OP_ADD_NUM) {
+    if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+      NUMBER_OP(NUMBER_VAL, +);
+    else
+      DEQUICKEN(OP_ADD);
+    DISPATCH();
+  }
+  CASE(OP_ADD_STR) {
+    if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
+      concatnate();
+    else
+      DEQUICKEN(OP_ADD);
+    DISPATCH();
+  }
+  CASE(OP_SUBSTRACT_NUM) {
+    if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+      NUMBER_OP(NUMBER_VAL, -);
+    else
+      DEQUICKEN(OP_SUBSTRACT);
+    DISPATCH();
+  }
+  CASE(OP_MULTIPLY_NUM) {
+    if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+      NUMBER_OP(NUMBER_VAL, *);
+    else
+      DEQUICKEN(OP_MULTIPLY);
+    DISPATCH();
+  }
+  CASE(OP_DIVIDE_NUM) {
+    if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+      NUMBER_OP(NUMBER_VAL, /);
+    else
+      DEQUICKEN(OP_DIVIDE);
+    DISPATCH();
+  }
+  CASE(OP_GREATOR_NUM) {
+    if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+      NUMBER_OP(BOOL_VAL, >);
+    else
+      DEQUICKEN(OP_GREATOR);
+    DISPATCH();
+  }
+  CASE(OP_LESS_NUM) {
+    if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+      NUMBER_OP(BOOL_VAL, <);
+    else
+      DEQUICKEN(OP_LESS);
+    DISPATCH();
+  }
+  // The int forms overflow into doubles themselves, they only hand back
+  // when an operand stops being an int
+  CASE(OP_ADD_INT) {
+    if (IS_INT(peek(0)) && IS_INT(peek(1)))
+      INT_OP(addNumbers);
+    else
+      DEQUICKEN(OP_ADD);
+    DISPATCH();
+  }
+  CASE(OP_SUBSTRACT_INT) {
+    if (IS_INT(peek(0)) && IS_INT(peek(1)))
+      INT_OP(subtractNumbers);
+    else
+      DEQUICKEN(OP_SUBSTRACT);
+    DISPATCH();
+  }
+  CASE(OP_MULTIPLY_INT) {
+    if (IS_INT(peek(0)) && IS_INT(peek(1)))
+      INT_OP(multiplyNumbers);
+    else
+      DEQUICKEN(OP_MULTIPLY);
+    DISPATCH();
+  }
+  CASE(OP_GREATOR_INT) {
+    if (IS_INT(peek(0)) && IS_INT(peek(1)))
+      INT_OP(greaterNumbers);
+    else
+      DEQUICKEN(OP_GREATOR);
+    DISPATCH();
+  }
+  CASE(OP_LESS_INT) {
+    if (IS_INT(peek(0)) && IS_INT(peek(1)))
+      INT_OP(lessNumbers);
+    else
+      DEQUICKEN(OP_LESS);
+    DISPATCH();
+  }
+#ifndef VM_COMPUTED_GOTO
     }
   }
+#endif
 
+#undef DISPATCH
+#undef CASE
+#undef COUNT_INSTRUCTION
+#undef NUMBER_OP
+#undef DEQUICKEN
+#undef QUICKEN
+#undef NOT_BOOL_VAL
+#undef STORE_OP
+#undef REGISTER_OP
 #undef BINARY_OP
+#undef RUNTIME_ERROR
+#undef READ_RK
 #undef READ_SHORT
 #undef READ_STRING
 #undef READ_CONSTANT
@@ -297,34 +885,68 @@ InterpreterResult interpret(char *source) {
 
   if (!compile(source, &chunk)) {
     freeChunk(&chunk);
+    releaseArena();
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  // The JIT takes the chunk as compiled, superinstructions only save
+  // dispatches the native code does not have
+  JitCode jit;
+  bool native = jitEnabled && jitCompile(&chunk, &jit);
+
+#ifdef VM_PROFILE_OPCODES
+  // Profiles describe the sequences the compiler emits, not the fused ones
+  if (!native && vm.profile == NULL && superinstructionsEnabled &&
+#else
+  if (!native && superinstructionsEnabled &&
+#endif
+      !fuseSuperinstructions(&chunk)) {
+    freeChunk(&chunk);
+    releaseArena();
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  // The verifier proved no path needs more than maxStackDepth slots,
+  // checking it once here lets push() and pop() run unchecked
+  if (chunk.maxStackDepth > STACK_MAX) {
+    fprintf(stderr, "Script needs %d stack slots, the limit is %d\n",
+            chunk.maxStackDepth, STACK_MAX);
+    if (native)
+      jitFree(&jit);
+    freeChunk(&chunk);
+    releaseArena();
     return INTERPRET_COMPILE_ERROR;
   }
 
   vm.chunk = &chunk;
   vm.ip = vm.chunk->code;
 
-  InterpreterResult result = run();
-  freeChunk(&chunk);
-  return result;
-}
+#ifdef VM_PROFILE_OPCODES
+  vm.executionCounts = ALLOCATE(uint64_t, chunk.count, MEM_RUNTIME);
+  memset(vm.executionCounts, 0, sizeof(uint64_t) * chunk.count);
+#endif
 
-// Push operation for the stack
-void push(Value value) {
-  if (vm.stackTop - vm.stack >= STACK_MAX) {
-    fprintf(stderr, "Stack overflow\n");
-    exit(1);
-  }
-  *vm.stackTop = value;
-  vm.stackTop++;
-}
+  // Traces hook run()'s back-edges, native code never takes them
+  bool traced = tracingEnabled && !native;
+  if (traced)
+    initTraces(&chunk);
+
+  InterpreterResult result = native ? jit.entry() : run();
+  if (traced)
+    freeTraces();
+  if (native)
+    jitFree(&jit);
+  else if (printQuickened)
+    dissassembleChunk(&chunk, "quickened");
+
+#ifdef VM_PROFILE_OPCODES
+  if (vm.profile != NULL)
+    writeOpcodeProfile(&chunk, vm.executionCounts, vm.profile);
+  FREE_ARRAY(uint64_t, vm.executionCounts, chunk.count, MEM_RUNTIME);
+#endif
 
-// Pop operation for the stack
-Value pop() {
-  if (vm.stackTop == vm.stack) {
-    fprintf(stderr, "Stack underflow\n");
-    exit(1);
-  }
-  vm.stackTop--;
-  Value value = *vm.stackTop;
-  return value;
+  vm.chunk = NULL;
+  freeChunk(&chunk);
+  releaseArena();
+  return result;
 }
@@ -1,11 +1,22 @@
 #ifndef vm_vm_h
 #define vm_vm_h
 #include "../chunk/chunk.h"
+#include "../intern/intern.h"
 #include "../table/table.h"
 #include "../value/value.h"
 #include <stdint.h>
 
 #define STACK_MAX 256
+// Global slot indexes are one byte operands
+#define GLOBALS_MAX UINT8_COUNT
+
+// A global variable in the flat array the slot instructions index
+typedef struct {
+  Value value;
+  ObjString *name;
+  bool defined; // Set by the global's declaration, until then it is an error
+                // to read or assign it
+} GlobalSlot;
 
 typedef struct {
   Chunk *chunk;
@@ -18,14 +29,50 @@ typedef struct {
   Value stack[STACK_MAX];
   Value *stackTop;
   // Keep track of all the string
-  Table strings;
-  // Keep track of all the global variables
+  InternTable strings;
+  // Mixed into every string hash. Random per VM, so keys that collide
+  // in one process cannot be worked out from the source
+  uint64_t hashSeed;
+  // Maps the name of every global variable to its slot index
   Table globals;
+  GlobalSlot globalSlots[GLOBALS_MAX];
+  int globalCount;
 
+  // The old generation, and the nursery objects are linked to until a
+  // collection promotes them
   Obj *objects;
+  Obj *youngObjects;
+  size_t nurseryBytes;
+  // Old objects the write barrier found pointing at young ones
+  int rememberedCount;
+  int rememberedCapacity;
+  Obj **remembered;
+  // Bytes the collected heap holds, and the size that starts the next
+  // collection
+  size_t bytesAllocated;
+  size_t nextGC;
+  // Marked objects whose references are not marked yet
+  int grayCount;
+  int grayCapacity;
+  Obj **grayStack;
+#ifdef VM_COUNT_INSTRUCTIONS
+  // Number of instructions dispatched by run()
+  uint64_t instructionCount;
+#endif
+#ifdef VM_PROFILE_OPCODES
+  // How often the instruction at each offset of the chunk ran, written
+  // as an n-gram profile to profile when the chunk finishes
+  uint64_t *executionCounts;
+  FILE *profile;
+#endif
 } VM;
 
 extern VM vm;
+// When false run() never rewrites instructions into quickened forms
+extern bool quickeningEnabled;
+// When true interpret() disassembles the chunk after run() finished
+// with it, showing which instructions were quickened
+extern bool printQuickened;
 
 // Enum for the interpretation
 typedef enum {
@@ -34,12 +81,97 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR,
 } InterpreterResult;
 
+uint64_t randomSeed();
 void initVM();
 void freeVM();
 InterpreterResult interpret(char *source);
 
-// Stack operations
-void push(Value value);
-Value pop();
+int globalSlot(ObjString *name);
+
+// Shared with the native code the JIT emits
+void runtimeError(const char *format, ...);
+bool isFalsey(Value value);
+bool valueEquals(Value a, Value b);
+void concatnate();
+bool foldInstruction(uint8_t instruction, Value a, Value b, Value *result);
+
+// Stack operations. They are unchecked, interpret() only runs chunks the
+// verifier proved never pop an empty stack or grow past STACK_MAX
+static inline void push(Value value) {
+  *vm.stackTop = value;
+  vm.stackTop++;
+}
+
+static inline Value pop() {
+  vm.stackTop--;
+  return *vm.stackTop;
+}
+
+
+// Arithmetic on two numbers, stored straight into the result slot. Two
+// ints give an int while the exact result fits 32 bits, anything else is
+// computed on doubles. Multiplication and negation leave the int path
+// where doubles would produce -0. The compiler folds constants with them
+// too, so folded code computes what run() would
+static inline void addNumbers(Value *result, Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) {
+    int64_t sum = (int64_t)AS_INT(a) + AS_INT(b);
+    if (sum == (int32_t)sum) {
+      *result = INT_VAL((int32_t)sum);
+      return;
+    }
+  }
+  *result = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+}
+
+static inline void subtractNumbers(Value *result, Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) {
+    int64_t difference = (int64_t)AS_INT(a) - AS_INT(b);
+    if (difference == (int32_t)difference) {
+      *result = INT_VAL((int32_t)difference);
+      return;
+    }
+  }
+  *result = NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+}
+
+static inline void multiplyNumbers(Value *result, Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) {
+    int64_t product = (int64_t)AS_INT(a) * AS_INT(b);
+    if (product == (int32_t)product &&
+        (product != 0 || (AS_INT(a) >= 0 && AS_INT(b) >= 0))) {
+      *result = INT_VAL((int32_t)product);
+      return;
+    }
+  }
+  *result = NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+}
+
+static inline void negateNumber(Value *result, Value value) {
+  if (IS_INT(value) && AS_INT(value) != 0 && AS_INT(value) != INT32_MIN)
+    *result = INT_VAL(-AS_INT(value));
+  else
+    *result = NUMBER_VAL(-AS_NUMBER(value));
+}
+
+static inline bool numberLess(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b))
+    return AS_INT(a) < AS_INT(b);
+  return AS_NUMBER(a) < AS_NUMBER(b);
+}
+
+static inline bool numberGreater(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b))
+    return AS_INT(a) > AS_INT(b);
+  return AS_NUMBER(a) > AS_NUMBER(b);
+}
+
+static inline void lessNumbers(Value *result, Value a, Value b) {
+  *result = BOOL_VAL(numberLess(a, b));
+}
+
+static inline void greaterNumbers(Value *result, Value a, Value b) {
+  *result = BOOL_VAL(numberGreater(a, b));
+}
 
 #endif